@@ -0,0 +1,385 @@
+#include "position.h"
+#include "types.h"
+#include "move.h"
+#include "batch.h"
+#include "arena.h"
+#include "eval.h"
+
+#include <chrono>
+#include <cmath>
+#include <fstream>
+#include <functional>
+#include <iomanip>
+#include <iostream>
+#include <string>
+#include <vector>
+
+/* Microbenchmarks for the hot paths of move generation and evaluation. Every
+ * benchmark runs over a fixed corpus of positions (by default
+ * tests/movegen_lazerpo.txt) and reports the mean time per operation over
+ * several samples, along with the standard deviation and the fastest sample.
+ *
+ * Usage: bench [--corpus file] [--samples n] [--filter name] [--json]
+ */
+
+// Settings from the command line
+struct BenchOptions {
+  std::string corpus = "tests/movegen_lazerpo.txt";
+  int samples = 10;
+  std::string filter;
+  bool json = false;
+};
+
+// Timing results of one benchmark
+struct BenchResult {
+  std::string name;
+  U64 opsPerRun;
+  double mean;
+  double stddev;
+  double min;
+};
+
+// Position from the corpus along with data precomputed outside the timed
+// loops.
+struct CorpusEntry {
+  std::string fen;
+  Position position;
+  std::vector<Move> moves;
+  std::vector<std::pair<Piece, int>> pieces;
+};
+
+// Written to at the end of every run so the work cannot be optimized away.
+volatile U64 sink;
+
+// Loads the FENs from the corpus. Lines may be of the form "fen,count" as in
+// the movegen tests.
+bool loadCorpus(std::string filename, std::vector<CorpusEntry>& corpus) {
+  std::ifstream file(filename);
+  if (!file.is_open()) {
+    std::cout << "Unable to open file " << filename << std::endl;
+    return false;
+  }
+
+  std::string line;
+  while (getline(file, line)) {
+    if (line.size() == 0 || line[0] == '#')
+      continue;
+    CorpusEntry e;
+    e.fen = line.substr(0, line.find(","));
+    e.position.loadFEN(e.fen);
+    e.moves = e.position.getLegalMoves();
+    for (int sq = 0; sq < 64; sq++) {
+      Piece p = e.position.getPiece(sq);
+      if (p != Piece::NO_PIECE)
+        e.pieces.push_back(std::make_pair(p, sq));
+    }
+    corpus.push_back(e);
+  }
+  return corpus.size() > 0;
+}
+
+// Times fn, which performs opsPerRun operations per call. The number of calls
+// per sample is calibrated so that each sample takes roughly 20ms.
+BenchResult measure(std::string name, U64 opsPerRun, int samples,
+    std::function<U64()> fn) {
+  typedef std::chrono::steady_clock Clock;
+  BenchResult r;
+  r.name = name;
+  r.opsPerRun = opsPerRun;
+
+  // Calibrate
+  U64 reps = 1;
+  while (true) {
+    auto start = Clock::now();
+    for (U64 i = 0; i < reps; i++)
+      sink = fn();
+    std::chrono::duration<double> d = Clock::now() - start;
+    if (d.count() > 0.02 || reps >= (ONE << 30))
+      break;
+    reps *= 2;
+  }
+
+  // Measure
+  std::vector<double> nsPerOp;
+  for (int s = 0; s < samples; s++) {
+    auto start = Clock::now();
+    for (U64 i = 0; i < reps; i++)
+      sink = fn();
+    std::chrono::duration<double, std::nano> d = Clock::now() - start;
+    nsPerOp.push_back(d.count() / (reps * opsPerRun));
+  }
+
+  double sum = 0, min = nsPerOp[0];
+  for (unsigned int i = 0; i < nsPerOp.size(); i++) {
+    sum += nsPerOp[i];
+    min = std::min(min, nsPerOp[i]);
+  }
+  r.mean = sum / nsPerOp.size();
+  double var = 0;
+  for (unsigned int i = 0; i < nsPerOp.size(); i++)
+    var += (nsPerOp[i] - r.mean) * (nsPerOp[i] - r.mean);
+  r.stddev = std::sqrt(var / nsPerOp.size());
+  r.min = min;
+  return r;
+}
+
+// Runs every benchmark whose name contains the filter.
+std::vector<BenchResult> runBenchmarks(std::vector<CorpusEntry>& corpus,
+    BenchOptions& opt) {
+  std::vector<BenchResult> results;
+  auto run = [&](std::string name, U64 ops, std::function<U64()> fn) {
+    if (name.find(opt.filter) == std::string::npos || ops == 0)
+      return;
+    results.push_back(measure(name, ops, opt.samples, fn));
+  };
+
+  // Totals used to report time per operation
+  U64 numPieces = 0, numMoves = 0;
+  U64 piecesOfType[6] = {};
+  for (unsigned int i = 0; i < corpus.size(); i++) {
+    numPieces += corpus[i].pieces.size();
+    numMoves += corpus[i].moves.size();
+    for (unsigned int j = 0; j < corpus[i].pieces.size(); j++)
+      piecesOfType[corpus[i].pieces[j].first % 6]++;
+  }
+
+  run("bitscan", numPieces, [&]() {
+    U64 x = 0;
+    for (unsigned int i = 0; i < corpus.size(); i++) {
+      for (unsigned int j = 0; j < corpus[i].pieces.size(); j++)
+        x += Position::bitscan(ONE << corpus[i].pieces[j].second);
+    }
+    return x;
+  });
+
+  const char* typeNames[6] = {"king", "queen", "rook", "bishop", "knight",
+    "pawn"};
+  for (int t = 0; t < 6; t++) {
+    run(std::string("getAttackedSquares/") + typeNames[t], piecesOfType[t],
+        [&, t]() {
+      U64 x = 0;
+      for (unsigned int i = 0; i < corpus.size(); i++) {
+        Position& p = corpus[i].position;
+        for (unsigned int j = 0; j < corpus[i].pieces.size(); j++) {
+          if (corpus[i].pieces[j].first % 6 == t)
+            x ^= p.getAttackedSquares(corpus[i].pieces[j].first,
+                corpus[i].pieces[j].second);
+        }
+      }
+      return x;
+    });
+  }
+
+  run("getAttackedSquares/color", 2 * corpus.size(), [&]() {
+    U64 x = 0;
+    for (unsigned int i = 0; i < corpus.size(); i++) {
+      x ^= corpus[i].position.getAttackedSquares(Color::WHITE);
+      x ^= corpus[i].position.getAttackedSquares(Color::BLACK);
+    }
+    return x;
+  });
+
+  run("getOccupied", corpus.size(), [&]() {
+    U64 x = 0;
+    for (unsigned int i = 0; i < corpus.size(); i++)
+      x ^= corpus[i].position.getOccupied();
+    return x;
+  });
+
+  run("makeMove+unmakeMove", numMoves, [&]() {
+    U64 x = 0;
+    for (unsigned int i = 0; i < corpus.size(); i++) {
+      Position& p = corpus[i].position;
+      for (unsigned int j = 0; j < corpus[i].moves.size(); j++) {
+        p.makeMove(corpus[i].moves[j]);
+        x += p.getClock();
+        p.unmakeMove(corpus[i].moves[j]);
+      }
+    }
+    return x;
+  });
+
+  run("copyMake", numMoves, [&]() {
+    U64 x = 0;
+    for (unsigned int i = 0; i < corpus.size(); i++) {
+      Position& p = corpus[i].position;
+      for (unsigned int j = 0; j < corpus[i].moves.size(); j++)
+        x += p.afterMove(corpus[i].moves[j]).getClock();
+    }
+    return x;
+  });
+
+  run("getLegalMoves", corpus.size(), [&]() {
+    U64 x = 0;
+    for (unsigned int i = 0; i < corpus.size(); i++)
+      x += corpus[i].position.getLegalMoves().size();
+    return x;
+  });
+
+  run("getLegalMoves/arena", corpus.size(), [&]() {
+    U64 x = 0;
+    Arena& arena = Arena::forThread();
+    for (unsigned int i = 0; i < corpus.size(); i++) {
+      ArenaScope scope(arena);
+      MoveList moves{ArenaAllocator<Move>(arena)};
+      corpus[i].position.getLegalMoves(moves);
+      x += moves.size();
+    }
+    return x;
+  });
+
+  run("countLegalMoves", corpus.size(), [&]() {
+    U64 x = 0;
+    for (unsigned int i = 0; i < corpus.size(); i++)
+      x += corpus[i].position.countLegalMoves();
+    return x;
+  });
+
+  run("hasLegalMove", corpus.size(), [&]() {
+    U64 x = 0;
+    for (unsigned int i = 0; i < corpus.size(); i++)
+      x += corpus[i].position.hasLegalMove();
+    return x;
+  });
+
+  run("inCheck", corpus.size(), [&]() {
+    U64 x = 0;
+    for (unsigned int i = 0; i < corpus.size(); i++)
+      x += corpus[i].position.inCheck();
+    return x;
+  });
+
+  run("nameMoves", numMoves, [&]() {
+    U64 x = 0;
+    for (unsigned int i = 0; i < corpus.size(); i++) {
+      corpus[i].position.nameMoves(corpus[i].moves);
+      x += corpus[i].moves.size();
+    }
+    return x;
+  });
+
+  run("loadFEN", corpus.size(), [&]() {
+    U64 x = 0;
+    Position p;
+    for (unsigned int i = 0; i < corpus.size(); i++) {
+      p.loadFEN(corpus[i].fen);
+      x += p.getClock();
+    }
+    return x;
+  });
+
+  // Evaluation with the pawn terms from the pawn hash table, which holds
+  // every pawn structure of the corpus after the first run, and counted
+  // afresh each time
+  run("evaluate", corpus.size(), [&]() {
+    U64 x = 0;
+    for (unsigned int i = 0; i < corpus.size(); i++)
+      x += evaluate(corpus[i].position);
+    return x;
+  });
+
+  run("evaluate/uncached", corpus.size(), [&]() {
+    U64 x = 0;
+    for (unsigned int i = 0; i < corpus.size(); i++) {
+      U64 bbs[12];
+      for (int j = 0; j < 12; j++)
+        bbs[j] = corpus[i].position.getBitboard((Piece)j);
+      long long score = 0;
+      forEachEvalTerm(bbs, [&](int k, int weight) {
+        score += (long long)evalParams[k] * weight;
+      });
+      x += score;
+    }
+    return x;
+  });
+
+  // Labeling many positions: one at a time through Position, and in groups
+  // through PositionBatch
+  run("labels/single", corpus.size(), [&]() {
+    U64 x = 0;
+    for (unsigned int i = 0; i < corpus.size(); i++) {
+      Position& p = corpus[i].position;
+      x ^= p.getOccupied();
+      x ^= p.getAttackedSquares(Color::WHITE);
+      x ^= p.getAttackedSquares(Color::BLACK);
+      x += p.inCheck();
+    }
+    return x;
+  });
+
+  PositionBatch batch;
+  for (int copies = 0; copies < 64; copies++)
+    for (unsigned int i = 0; i < corpus.size(); i++)
+      batch.add(corpus[i].position);
+  run("labels/batch", batch.size(), [&]() {
+    batch.compute(false);
+    return batch.getOccupied(0) ^ batch.getAttacks(0, Color::WHITE);
+  });
+
+  return results;
+}
+
+// Prints the results as a table.
+void printTable(std::vector<BenchResult>& results) {
+  std::cout << std::left << std::setw(28) << "benchmark" << std::right
+    << std::setw(12) << "ns/op" << std::setw(12) << "stddev"
+    << std::setw(12) << "min" << std::endl;
+  std::cout << std::fixed << std::setprecision(2);
+  for (unsigned int i = 0; i < results.size(); i++) {
+    std::cout << std::left << std::setw(28) << results[i].name << std::right
+      << std::setw(12) << results[i].mean << std::setw(12)
+      << results[i].stddev << std::setw(12) << results[i].min << std::endl;
+  }
+}
+
+// Prints the results as JSON so runs can be compared between commits.
+void printJSON(std::vector<BenchResult>& results, BenchOptions& opt) {
+  std::cout << "{" << std::endl;
+  std::cout << "  \"corpus\": \"" << opt.corpus << "\"," << std::endl;
+  std::cout << "  \"samples\": " << opt.samples << "," << std::endl;
+  std::cout << "  \"benchmarks\": [" << std::endl;
+  std::cout << std::fixed << std::setprecision(3);
+  for (unsigned int i = 0; i < results.size(); i++) {
+    std::cout << "    {\"name\": \"" << results[i].name << "\", "
+      << "\"ops\": " << results[i].opsPerRun << ", "
+      << "\"ns_per_op\": " << results[i].mean << ", "
+      << "\"stddev\": " << results[i].stddev << ", "
+      << "\"min\": " << results[i].min << "}";
+    if (i + 1 < results.size())
+      std::cout << ",";
+    std::cout << std::endl;
+  }
+  std::cout << "  ]" << std::endl;
+  std::cout << "}" << std::endl;
+}
+
+int main(int argc, char** argv) {
+  BenchOptions opt;
+  for (int i = 1; i < argc; i++) {
+    std::string arg(argv[i]);
+    if (arg == "--json")
+      opt.json = true;
+    else if (arg == "--corpus" && i + 1 < argc)
+      opt.corpus = argv[++i];
+    else if (arg == "--samples" && i + 1 < argc)
+      opt.samples = std::max(1, std::stoi(argv[++i]));
+    else if (arg == "--filter" && i + 1 < argc)
+      opt.filter = argv[++i];
+    else {
+      std::cout << "Usage: bench [--corpus file] [--samples n] "
+        << "[--filter name] [--json]" << std::endl;
+      return 1;
+    }
+  }
+
+  std::vector<CorpusEntry> corpus;
+  if (!loadCorpus(opt.corpus, corpus))
+    return 1;
+
+  std::vector<BenchResult> results = runBenchmarks(corpus, opt);
+  if (opt.json)
+    printJSON(results, opt);
+  else
+    printTable(results);
+  return 0;
+}
@@ -0,0 +1,128 @@
+#ifndef ARENA_H
+#define ARENA_H
+
+#include "types.h"
+
+#include <cstddef>
+#include <vector>
+
+/* A bump allocator for short lived, per-thread data such as move lists.
+ *
+ * Allocating only advances an offset in the current block, and nothing is
+ * freed individually. Instead the arena is rewound: either completely with
+ * reset(), eg between games, or back to a mark taken earlier, which is how
+ * the search frees everything a node allocated when it returns. Both are
+ * O(1). Blocks are kept when rewinding, so after warming up an arena stops
+ * asking the heap for memory at all, and threads never contend for the
+ * general allocator.
+ *
+ * An arena must only be used by one thread. Arena::forThread() gives each
+ * thread its own.
+ *
+ * Usage:
+ *   ArenaScope scope(arena);                 // rewinds when it goes away
+ *   MoveList moves{ArenaAllocator<Move>(arena)};
+ *   position.getLegalMoves(moves);
+ */
+
+class Arena {
+  public:
+    // Position to rewind to
+    struct Mark {
+      size_t block;
+      size_t offset;
+    };
+
+    Arena(size_t blockSize = 1 << 16);
+    ~Arena();
+    Arena(const Arena&) = delete;
+    Arena& operator=(const Arena&) = delete;
+
+    void* allocate(size_t, size_t);
+    Mark getMark();
+    void rewind(Mark);
+    void reset();
+
+    // Statistics, in bytes
+    size_t getUsed();
+    size_t getPeak();
+    size_t getCapacity();
+    void resetPeak();
+
+    static Arena& forThread();
+
+  private:
+    struct Block {
+      char* data;
+      size_t size;
+      size_t start;  // bytes in all earlier blocks
+    };
+
+    std::vector<Block> blocks;
+    size_t blockSize;
+    size_t current;
+    size_t offset;
+    size_t peak;
+
+    void* allocateSlow(size_t, size_t);
+};
+
+// Allocates from the arena now and rewinds it to this point when destroyed.
+class ArenaScope {
+  public:
+    ArenaScope(Arena& a) : arena(a), mark(a.getMark()) {}
+    ~ArenaScope() { arena.rewind(mark); }
+
+  private:
+    Arena& arena;
+    Arena::Mark mark;
+};
+
+// Lets standard containers allocate from an arena. Memory given back by the
+// container is only reclaimed when the arena is rewound.
+template<class T>
+class ArenaAllocator {
+  public:
+    typedef T value_type;
+
+    ArenaAllocator(Arena& a) : arena(&a) {}
+    template<class U>
+    ArenaAllocator(const ArenaAllocator<U>& other) : arena(other.arena) {}
+
+    T* allocate(size_t n) {
+      return (T*)arena->allocate(n * sizeof(T), alignof(T));
+    }
+    void deallocate(T*, size_t) {}
+
+    template<class U>
+    bool operator==(const ArenaAllocator<U>& other) const {
+      return arena == other.arena;
+    }
+    template<class U>
+    bool operator!=(const ArenaAllocator<U>& other) const {
+      return arena != other.arena;
+    }
+
+  private:
+    template<class U> friend class ArenaAllocator;
+    Arena* arena;
+};
+
+template<class T>
+using ArenaVector = std::vector<T, ArenaAllocator<T>>;
+
+// The fast path of allocate, kept inline. Falls back to the next block when
+// the current one is full.
+inline void* Arena::allocate(size_t bytes, size_t align) {
+  size_t start = (offset + align - 1) & ~(align - 1);
+  if (current < blocks.size() && start + bytes <= blocks[current].size) {
+    offset = start + bytes;
+    size_t used = blocks[current].start + offset;
+    if (used > peak)
+      peak = used;
+    return blocks[current].data + start;
+  }
+  return allocateSlow(bytes, align);
+}
+
+#endif
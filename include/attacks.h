@@ -0,0 +1,67 @@
+#ifndef ATTACKS_H
+#define ATTACKS_H
+
+#include "types.h"
+
+/* Set-wise attack generation. Instead of looking up the attacks of one piece
+ * at a time, these compute the union of the attacks of every piece in a
+ * bitboard at once, so the cost does not depend on the number of pieces.
+ *
+ * Sliding attacks use Kogge-Stone occluded fills: each of the 8 directions is
+ * filled in three shift-and-mask steps (by 1, 2 and 4 squares). When the CPU
+ * supports AVX2, four directions are filled per instruction; otherwise the
+ * directions are filled one after another with plain 64-bit operations.
+ */
+
+// Files used to stop shifts from wrapping around the edge of the board.
+const U64 FILE_A = 0x0101010101010101ULL;
+const U64 FILE_H = 0x8080808080808080ULL;
+const U64 NOT_FILE_A = ~FILE_A;
+const U64 NOT_FILE_H = ~FILE_H;
+const U64 NOT_FILE_AB = ~(FILE_A | (FILE_A << 1));
+const U64 NOT_FILE_GH = ~(FILE_H | (FILE_H >> 1));
+
+// Ranks used for pawn pushes and promotions.
+const U64 RANK_1 = 0x00000000000000ffULL;
+const U64 RANK_3 = 0x0000000000ff0000ULL;
+const U64 RANK_6 = 0x0000ff0000000000ULL;
+const U64 RANK_8 = 0xff00000000000000ULL;
+
+// Squares attacked by every knight in the bitboard.
+inline U64 knightAttacksSetwise(U64 b) {
+  U64 l1 = (b >> 1) & NOT_FILE_H;
+  U64 l2 = (b >> 2) & NOT_FILE_GH;
+  U64 r1 = (b << 1) & NOT_FILE_A;
+  U64 r2 = (b << 2) & NOT_FILE_AB;
+  U64 h1 = l1 | r1;
+  U64 h2 = l2 | r2;
+  return (h1 << 16) | (h1 >> 16) | (h2 << 8) | (h2 >> 8);
+}
+
+// Squares attacked by every king in the bitboard.
+inline U64 kingAttacksSetwise(U64 b) {
+  U64 a = ((b << 1) & NOT_FILE_A) | ((b >> 1) & NOT_FILE_H);
+  b |= a;
+  return a | (b << 8) | (b >> 8);
+}
+
+// Squares attacked by every white pawn in the bitboard.
+inline U64 whitePawnAttacksSetwise(U64 b) {
+  return ((b << 7) & NOT_FILE_H) | ((b << 9) & NOT_FILE_A);
+}
+
+// Squares attacked by every black pawn in the bitboard.
+inline U64 blackPawnAttacksSetwise(U64 b) {
+  return ((b >> 9) & NOT_FILE_H) | ((b >> 7) & NOT_FILE_A);
+}
+
+// Squares attacked by the orthogonal sliders (rooks and queens) and diagonal
+// sliders (bishops and queens) given, where empty is the set of unoccupied
+// squares. Attacked squares include the first blocker in each direction.
+U64 slidingAttacksSetwise(U64 orthogonal, U64 diagonal, U64 empty);
+
+// The portable implementation, exposed so that it can be compared with the
+// vectorized one.
+U64 slidingAttacksScalar(U64 orthogonal, U64 diagonal, U64 empty);
+
+#endif
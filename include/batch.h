@@ -0,0 +1,64 @@
+#ifndef BATCH_H
+#define BATCH_H
+
+#include "types.h"
+#include "position.h"
+
+#include <vector>
+
+/* Analysis of many unrelated positions at once, for data pipelines which
+ * label millions of positions.
+ *
+ * Positions are stored in structure-of-arrays layout: one array per piece
+ * bitboard, so that the same bitboard of consecutive positions sits side by
+ * side in memory. Occupancy, attack maps and check status are then computed
+ * for groups of eight positions with SIMD instructions: one AVX-512
+ * instruction or two AVX2 instructions per group, chosen at load time, with
+ * SSE2 or plain 64-bit code as the fallback.
+ *
+ * Legal move counts are optional, since they are computed one position at a
+ * time.
+ */
+
+class PositionBatch {
+  public:
+    static const int LANES = 8;
+
+    // Instruction sets the attack kernel is compiled for. AUTO picks the
+    // best the CPU supports; the others are for testing each variant.
+    enum Kernel {
+      AUTO,
+      AVX512,
+      AVX2,
+      GENERIC,
+    };
+
+    PositionBatch();
+
+    void clear();
+    void add(Position&);
+    size_t size();
+    void compute(bool, Kernel = AUTO);
+    static bool isKernelSupported(Kernel);
+
+    // Results, available after compute
+    U64 getOccupied(size_t);
+    U64 getAttacks(size_t, Color);
+    bool inCheck(size_t);
+    int getLegalMoveCount(size_t);
+
+  private:
+    // Inputs
+    std::vector<U64> bbs[12];
+    std::vector<U8> flags;
+    std::vector<Color> players;
+    std::vector<U16> clocks;
+
+    // Outputs
+    std::vector<U64> occupied;
+    std::vector<U64> attacks[2];
+    std::vector<U8> check;
+    std::vector<U16> moveCounts;
+};
+
+#endif
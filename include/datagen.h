@@ -0,0 +1,70 @@
+#ifndef DATAGEN_H
+#define DATAGEN_H
+
+#include "types.h"
+#include "position.h"
+#include "search.h"
+
+#include <string>
+#include <type_traits>
+#include <vector>
+
+/* Self-play training data. Many games are played in parallel, each starting
+ * with a few random moves so that games differ, and every quiet position (not
+ * in check, best move neither a capture nor a promotion, score not a mate) is
+ * labeled with its search score and the result of the game.
+ *
+ * Positions are written as a stream of fixed size PackedPosition records with
+ * no header, so files can simply be concatenated. Each thread collects whole
+ * games into its own buffer, which is written out in one piece when full, so
+ * the threads rarely wait on the file.
+ */
+
+// A labeled position in 32 bytes, in host byte order.
+//
+// occupied: the occupied squares.
+// pieces: the Piece on each occupied square in ascending square order, four
+//   bits each, the first in the low bits of pieces[0].
+// score: search score in centipawns from white's point of view.
+// result: of the game for white: 0 loss, 1 draw, 2 win.
+// flags: Position's castling and en passant flags.
+struct PackedPosition {
+  U64 occupied;
+  U8 pieces[16];
+  I16 score;
+  U8 result;
+  U8 flags;
+  U8 player;
+  U8 clock;
+  U16 ply;
+
+  static PackedPosition pack(Position&, int, int, int);
+  void unpack(Position&);
+  void getBitboards(U64*);
+};
+
+static_assert(sizeof(PackedPosition) == 32, "PackedPosition is a file format");
+static_assert(std::is_trivially_copyable<PackedPosition>::value,
+    "PackedPosition is written as raw bytes");
+
+struct DatagenOptions {
+  U64 games = 1000;
+  int threads = 1;
+  U64 nodes = 5000;         // per move
+  int depth = MAX_PLY - 1;  // per move
+  int randomPlies = 8;
+  int maxPlies = 400;
+  int hashMB = 16;
+  U64 seed = 1;
+  std::string outputFile = "data.bin";
+
+  // A game is adjudicated as won once the score has been at least this
+  // large for the same side for this many plies in a row
+  int winScore = 2000;
+  int winPlies = 8;
+};
+
+int runDatagen(DatagenOptions&);
+bool loadPackedPositions(std::string, std::vector<PackedPosition>&);
+
+#endif
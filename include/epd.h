@@ -0,0 +1,30 @@
+#ifndef EPD_H
+#define EPD_H
+
+#include "types.h"
+
+#include <string>
+#include <utility>
+#include <vector>
+
+/* Extended Position Description files: one position per line, given by the
+ * first four fields of a FEN (board, player, castling, en passant) followed
+ * by operations such as
+ *
+ *   bm Nf3; id "opening 12";
+ *
+ * A line may instead hold a full FEN with the clocks. Blank lines and lines
+ * starting with '#' are skipped.
+ */
+
+struct EPDEntry {
+  std::string fen;
+  std::vector<std::pair<std::string, std::string>> operations;
+
+  std::string getOperation(std::string);
+};
+
+bool loadEPD(std::string, std::vector<EPDEntry>&);
+bool parseEPDLine(std::string, EPDEntry&);
+
+#endif
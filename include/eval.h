@@ -0,0 +1,172 @@
+#ifndef EVAL_H
+#define EVAL_H
+
+#include "types.h"
+#include "position.h"
+
+#include <array>
+#include <string>
+#include <vector>
+
+/* Static evaluation: material and piece-square tables, in centipawns from the
+ * point of view of the player to move. The king uses separate tables for the
+ * middlegame and the endgame, blended by the amount of material left.
+ *
+ * Every weight is an entry of one parameter vector, so that the evaluation can
+ * be tuned (see tune.h). The evaluation is linear in the parameters:
+ *
+ *   score = sum of params[i] * weight[i] / EVAL_SCALE
+ *
+ * where forEachEvalTerm gives the weights of a position. Parameters are laid
+ * out as
+ *   PARAM_PIECE_VALUES + type:          value of a piece, indexed as a white
+ *                                       Piece (the king's is unused)
+ *   PARAM_TABLES + 64*type + sq:        piece-square tables from white's point
+ *                                       of view, sq ^ 56 for white pieces; the
+ *                                       king's is the middlegame table
+ *   PARAM_KING_ENDGAME + sq:            the king's endgame table
+ *   PARAM_PASSED + rank:                passed pawns, by rank counted from
+ *                                       the pawn's own side
+ *   PARAM_ISOLATED, PARAM_DOUBLED,      weak pawns, for each one
+ *   PARAM_BACKWARD
+ *   PARAM_SHIELD + i:                   pawns i + 1 ranks in front of a king
+ *                                       on its first rank, on the king's file
+ *                                       or next to it, blended like the
+ *                                       king's middlegame table
+ *
+ * The pawn terms depend only on the pawns, which rarely change, so evaluate
+ * counts them once per pawn structure and keeps the counts in a per-thread
+ * PawnHashTable keyed by the position's pawn key.
+ */
+
+const int PARAM_PIECE_VALUES = 0;
+const int PARAM_TABLES = 6;
+const int PARAM_KING_ENDGAME = PARAM_TABLES + 6*64;
+const int PARAM_PASSED = PARAM_KING_ENDGAME + 64;
+const int PARAM_ISOLATED = PARAM_PASSED + 8;
+const int PARAM_DOUBLED = PARAM_ISOLATED + 1;
+const int PARAM_BACKWARD = PARAM_DOUBLED + 1;
+const int PARAM_SHIELD = PARAM_BACKWARD + 1;
+const int NUM_EVAL_PARAMS = PARAM_SHIELD + 2;
+
+// Parameters from PARAM_PASSED up to the shield, which are weighted by counts
+// of pawns alone
+const int NUM_PAWN_PARAMS = PARAM_SHIELD - PARAM_PASSED;
+
+// Fixed piece values, used for move ordering and for measuring how far the
+// game has progressed. Indexed as a white Piece.
+const int PIECE_VALUES[6] = {0, 900, 500, 330, 320, 100};
+
+// Non-pawn material at which the king is scored entirely by the middlegame
+// table: everything but pawns on the board at the start. Weights are given
+// as multiples of this, so that blending the king tables stays exact.
+const int EVAL_SCALE = 2 * (900 + 2*500 + 2*330 + 2*320);
+
+typedef std::array<int, NUM_EVAL_PARAMS> EvalParams;
+
+// Parameters used by evaluate, initially the defaults
+extern EvalParams evalParams;
+
+EvalParams defaultEvalParams();
+std::string evalParamName(int);
+bool loadEvalParams(std::string, EvalParams&);
+bool saveEvalParams(std::string, EvalParams&);
+void printEvalParams(EvalParams&);
+
+// Counts of the pawn terms of a position. counts holds white's count minus
+// black's for each parameter from PARAM_PASSED; shield holds, by color and
+// king file, the number of pawns one and two ranks in front of a king on its
+// first rank.
+struct PawnFeatures {
+  I8 counts[NUM_PAWN_PARAMS];
+  U8 shield[2][8][2];
+};
+
+void computePawnFeatures(U64, U64, PawnFeatures&);
+
+// Cache of PawnFeatures keyed by pawn key, replacing whatever is in the slot.
+// Each thread has its own, so no locking is needed.
+class PawnHashTable {
+  public:
+    PawnHashTable(int = 14);
+
+    const PawnFeatures& probe(U64, U64, U64);
+    void clear();
+    U64 getHits();
+    U64 getProbes();
+
+    static PawnHashTable& forThread();
+
+  private:
+    struct Entry {
+      U64 key;
+      PawnFeatures features;
+    };
+
+    std::vector<Entry> entries;
+    U64 mask;
+    U64 hits = 0;
+    U64 probes = 0;
+};
+
+int evaluate(Position&);
+
+// Calls fn(index, weight) for the parameters of the evaluation of the pieces,
+// which are given as bitboards indexed by Piece, with the pawn terms already
+// counted. Weights are from white's point of view.
+template<class Fn>
+inline void forEachEvalTerm(const U64* bbs, const PawnFeatures& pawns, Fn fn) {
+  int material = 0;
+  for (int type = W_QUEEN; type < W_PAWN; type++)
+    material += PIECE_VALUES[type]
+      * Position::popcount(bbs[type] | bbs[type + 6]);
+  if (material > EVAL_SCALE)
+    material = EVAL_SCALE;
+
+  for (int color = 0; color < 2; color++) {
+    int sign = (color == WHITE) ? 1 : -1;
+    int flip = (color == WHITE) ? 56 : 0;
+    for (int type = W_QUEEN; type <= W_PAWN; type++) {
+      U64 b = bbs[type + 6*color];
+      if (b == 0)
+        continue;
+      fn(PARAM_PIECE_VALUES + type,
+          sign * EVAL_SCALE * Position::popcount(b));
+      for (; b != 0; b &= b - 1) {
+        int sq = Position::bitscan(b) ^ flip;
+        fn(PARAM_TABLES + 64*type + sq, sign * EVAL_SCALE);
+      }
+    }
+
+    // King, blended between the two tables
+    U64 king = bbs[W_KING + 6*color];
+    if (king == 0)
+      continue;
+    int sq = Position::bitscan(king) ^ flip;
+    fn(PARAM_TABLES + sq, sign * material);
+    fn(PARAM_KING_ENDGAME + sq, sign * (EVAL_SCALE - material));
+
+    // The table squares of the first rank are 56 to 63
+    if (sq >= 56) {
+      for (int i = 0; i < 2; i++) {
+        int n = pawns.shield[color][sq % 8][i];
+        if (n != 0)
+          fn(PARAM_SHIELD + i, sign * material * n);
+      }
+    }
+  }
+
+  for (int i = 0; i < NUM_PAWN_PARAMS; i++)
+    if (pawns.counts[i] != 0)
+      fn(PARAM_PASSED + i, pawns.counts[i] * EVAL_SCALE);
+}
+
+// As above, counting the pawn terms from the bitboards.
+template<class Fn>
+inline void forEachEvalTerm(const U64* bbs, Fn fn) {
+  PawnFeatures pawns;
+  computePawnFeatures(bbs[W_PAWN], bbs[B_PAWN], pawns);
+  forEachEvalTerm(bbs, pawns, fn);
+}
+
+#endif
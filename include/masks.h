@@ -0,0 +1,184 @@
+#ifndef MASKS_H
+#define MASKS_H
+
+#include "types.h"
+
+/* Precalculated masks used for fast move generation. These are generated at
+ * compile time and live in read-only memory, so nothing needs to be
+ * initialized before a Position can be used.
+ *
+ * attackOnEmpty[p][sq]: squares attacked by piece p (indexed as a white
+ *   Piece, pawns excluded) from sq on an otherwise empty board.
+ * blockerMask[p][sq]: the "blockers and beyond" squares for sliding piece p on
+ *   sq. This is attackOnEmpty without the outermost square in each direction.
+ * behindMask[from][to]: the squares on the ray from "from" through "to" which
+ *   lie beyond "to". Zero if the squares do not share a line.
+ * betweenMask[from][to]: the squares strictly between "from" and "to". Zero
+ *   if the squares do not share a line.
+ *
+ * See notes.txt for how these are used.
+ */
+
+struct MaskTables {
+  U64 attackOnEmpty[5][64];
+  U64 blockerMask[5][64];
+  U64 behindMask[64][64];
+  U64 betweenMask[64][64];
+};
+
+// Returns if the given file-rank coordinate is inbounds
+constexpr bool maskInBounds(int f, int r) {
+  return (f >= 0) && (f <= 7) && (r >= 0) && (r <= 7);
+}
+
+// Generates the bitboard of rook attacks on an otherwise empty board with a
+// rook on the given file and rank.
+constexpr U64 calculateRookAttackOnEmpty(int f, int r) {
+  U64 b = 0;
+  // Attacks along file
+  for (int i = 0; i < 8; i++)
+    b ^= ONE << (8*i + f);
+  // Attacks along rank
+  b ^= 0x00000000000000ffULL << (8*r);
+  // Note that the rook's square gets xor'd twice and ends up as 0, as it
+  // should.
+  return b;
+}
+
+// Generates the bitboard of bishop attacks on an otherwise empty board with a
+// bishop on the given file and rank
+constexpr U64 calculateBishopAttackOnEmpty(int f, int r) {
+  U64 b = 0;
+  const int df[4] = {-1, 1, 1, -1};
+  const int dr[4] = {1, 1, -1, -1};
+  // Loop for each of 4 directions
+  for (int i = 0; i < 4; i++) {
+    int tf = f;
+    int tr = r;
+    while (maskInBounds(tf += df[i], tr += dr[i]))
+      b |= ONE << (8*tr + tf);
+  }
+  return b;
+}
+
+// Generates the bitboard of king attacks on an otherwise empty board with a
+// king on the given file and rank
+constexpr U64 calculateKingAttackOnEmpty(int f, int r) {
+  U64 b = 0;
+  const int df[8] = {-1, 0, 1, -1, 1, -1, 0, 1};
+  const int dr[8] = {1, 1, 1, 0, 0, -1, -1, -1};
+  for (int i = 0; i < 8; i++)
+    if (maskInBounds(f + df[i], r + dr[i]))
+      b |= ONE << (8*(r + dr[i]) + f + df[i]);
+  return b;
+}
+
+// Generates the bitboard of knight attacks on an otherwise empty board with a
+// knight on the given file and rank
+constexpr U64 calculateKnightAttackOnEmpty(int f, int r) {
+  U64 b = 0;
+  const int df[8] = {-1, 1, -2, 2, -2, 2, -1, 1};
+  const int dr[8] = {2, 2, 1, 1, -1, -1, -2, -2};
+  for (int i = 0; i < 8; i++)
+    if (maskInBounds(f + df[i], r + dr[i]))
+      b |= ONE << (8*(r + dr[i]) + f + df[i]);
+  return b;
+}
+
+// Calculates the "blockers and beyond" mask for a rook on the given file and
+// rank.
+constexpr U64 calculateRookBlockerMask(int f, int r) {
+  U64 b = 0;
+  // Attacks along file, ignoring outermost two
+  for (int i = 1; i <= 6; i++)
+    b |= ONE << (8*i + f);
+  // Attacks along rank, ignoring outermost two
+  b |= 0x000000000000007eULL << (8*r);
+  // Eliminate rook's own square
+  b &= ~(ONE << (8*r + f));
+  return b;
+}
+
+// Calculates the "blockers and beyond" mask for a bishop on the given file and
+// rank.
+constexpr U64 calculateBishopBlockerMask(int f, int r) {
+  return calculateBishopAttackOnEmpty(f, r) & 0x007e7e7e7e7e7e00ULL;
+}
+
+// Calculates the "behind" mask from one square to another. This mask is all
+// 1's along the ray from the "from" point to the "to" point, but only behind
+// the "to" point. It is assumed that the two points can be connected by a
+// queen move, unless the two points are equal, in which case this just returns
+// 0.
+constexpr U64 calculateBehindMask(int fromF, int fromR, int toF, int toR) {
+  if (fromF == toF && fromR == toR)
+    return 0;
+
+  int fDir = (fromF < toF) ? 1 : (fromF > toF) ? -1 : 0;
+  int rDir = (fromR < toR) ? 1 : (fromR > toR) ? -1 : 0;
+
+  U64 b = 0;
+  for (int f = toF + fDir, r = toR + rDir; maskInBounds(f, r);
+      f += fDir, r += rDir)
+    b |= ONE << (8*r + f);
+  return b;
+}
+
+// Fills in every table. Indices follow the white Pieces: king 0, queen 1,
+// rook 2, bishop 3, knight 4.
+constexpr MaskTables generateMaskTables() {
+  MaskTables t = {};
+  const int fDir[8] = {-1, 0, 1, -1, 1, -1, 0, 1};
+  const int rDir[8] = {1, 1, 1, 0, 0, -1, -1, -1};
+  for (int f = 0; f < 8; f++) {
+    for (int r = 0; r < 8; r++) {
+      int sq = 8*r + f;
+      // Attack on otherwise empty bitboards
+      U64 rook = calculateRookAttackOnEmpty(f, r);
+      U64 bishop = calculateBishopAttackOnEmpty(f, r);
+      t.attackOnEmpty[2][sq] = rook;
+      t.attackOnEmpty[3][sq] = bishop;
+      t.attackOnEmpty[1][sq] = rook | bishop;
+      t.attackOnEmpty[0][sq] = calculateKingAttackOnEmpty(f, r);
+      t.attackOnEmpty[4][sq] = calculateKnightAttackOnEmpty(f, r);
+
+      // "Blockers and beyond" bitboards
+      U64 rookBlocker = calculateRookBlockerMask(f, r);
+      U64 bishopBlocker = calculateBishopBlockerMask(f, r);
+      t.blockerMask[2][sq] = rookBlocker;
+      t.blockerMask[3][sq] = bishopBlocker;
+      t.blockerMask[1][sq] = rookBlocker | bishopBlocker;
+
+      // Behind and between masks
+      for (int i = 0; i < 8; i++) {
+        U64 between = 0;
+        for (int toF = f + fDir[i], toR = r + rDir[i]; maskInBounds(toF, toR);
+            toF += fDir[i], toR += rDir[i]) {
+          t.behindMask[sq][8*toR + toF] = calculateBehindMask(f, r, toF, toR);
+          t.betweenMask[sq][8*toR + toF] = between;
+          between |= ONE << (8*toR + toF);
+        }
+      }
+    }
+  }
+  return t;
+}
+
+inline constexpr MaskTables MASKS = generateMaskTables();
+
+// Castling rights which survive a move from or to each square, in the layout
+// of Position's flags. Moving a king or rook, or capturing a rook, clears the
+// rights which depend on that square, so make/unmake only needs
+// flags &= CASTLING_RIGHTS_MASK[from] & CASTLING_RIGHTS_MASK[to].
+inline constexpr U8 CASTLING_RIGHTS_MASK[64] = {
+  0x7f, 0xff, 0xff, 0xff, 0x3f, 0xff, 0xff, 0xbf,
+  0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff,
+  0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff,
+  0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff,
+  0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff,
+  0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff,
+  0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff,
+  0xdf, 0xff, 0xff, 0xff, 0xcf, 0xff, 0xff, 0xef,
+};
+
+#endif
@@ -0,0 +1,59 @@
+#ifndef MATCH_H
+#define MATCH_H
+
+#include "types.h"
+#include "search.h"
+#include "position.h"
+
+#include <string>
+#include <vector>
+
+/* Plays two engine configurations against each other to test a change.
+ *
+ * Games run concurrently on a pool of threads, each with its own Position and
+ * its own Search for both engines, so nothing but the results is shared. Each
+ * opening from the EPD file is played twice with colors swapped, which cancels
+ * out how good the opening is for either side. Games end on checkmate or
+ * stalemate, or are adjudicated as drawn by the fifty move rule, threefold
+ * repetition, insufficient material or a maximum length. A player whose clock
+ * runs out loses.
+ *
+ * After every game the result so far is tested with a sequential probability
+ * ratio test (SPRT): H0 is that engine A is elo0 stronger than B, H1 that it
+ * is elo1 stronger. The log likelihood ratio (LLR) of the results is compared
+ * with bounds from the accepted error rates alpha and beta, and the match
+ * stops as soon as it crosses one, so a clear change needs few games.
+ */
+
+struct EngineConfig {
+  std::string name;
+  SearchOptions options;
+};
+
+struct MatchOptions {
+  int games = 100;
+  int concurrency = 1;
+  int baseMs = 10000;
+  int incrementMs = 100;
+  int maxPlies = 400;
+  std::string openingsFile;
+  std::string pgnFile;
+
+  // SPRT bounds and error rates
+  bool sprt = true;
+  double elo0 = 0;
+  double elo1 = 5;
+  double alpha = 0.05;
+  double beta = 0.05;
+
+  EngineConfig engines[2] = {{"A", SearchOptions()}, {"B", SearchOptions()}};
+};
+
+int runMatch(MatchOptions&);
+
+// Adjudication, shared with self-play data generation. keys holds the
+// earlier positions of the game, most recent last.
+bool isThreefoldRepetition(Position&, std::vector<U64>&);
+bool isInsufficientMaterial(Position&);
+
+#endif
@@ -3,6 +3,8 @@
 
 #include "types.h"
 
+#include <type_traits>
+
 /* This class represents a move that a piece makes from one square to another.
  * Legality of the move is not assumed. A Move requires a from-square, a
  * to-square, and a MoveType (to indicate capture, castling, etc.)
@@ -15,6 +17,9 @@
  * Note that for castling moves, the from- and to-squares should refer to the
  * king. The movement of the rook will be handled by the makeMove function
  * implicitly.
+ *
+ * Moves are small plain data (16 bytes, with the name in a fixed buffer) so
+ * that move lists are cheap to fill and copy and never touch the heap.
  */
 
 class Move {
@@ -33,6 +38,7 @@ class Move {
     U8       getFlags();
     U16      getClock();
     std::string getName();
+    std::string getCoordinates();
 
     Piece getPromotedPiece();
     bool isCapture();
@@ -43,20 +49,28 @@ class Move {
     void debugPrint();
 
   private:
-    // These fields are required to make the move.
+    // Longest name, eg "Qa1xb2#" or "exd8=Q+", plus the terminator
+    static const int NAME_SIZE = 8;
+
+    // These fields are required to make the move. Enums are stored in single
+    // bytes to keep the move small.
     U8 from;
     U8 to;
-    MoveType type;
+    U8 type;
+    I8 movingPiece;
 
     // Once the move is made, relevant information for unmaking the move will
     // be stored here.
     U8 savedFlags;
+    I8 capturedPiece;
     U16 savedClock;
-    Piece movingPiece;
-    Piece capturedPiece;
 
     // Used for naming the move
-    std::string name;
+    char name[NAME_SIZE];
 };
 
+static_assert(std::is_trivially_copyable<Move>::value,
+    "Move lists are copied as plain memory");
+static_assert(sizeof(Move) == 16, "Move should stay small");
+
 #endif
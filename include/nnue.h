@@ -0,0 +1,69 @@
+#ifndef NNUE_H
+#define NNUE_H
+
+#include "types.h"
+
+#include <memory>
+#include <string>
+
+/* An efficiently updatable neural network (NNUE) evaluation.
+ *
+ * The network has 768 inputs, one for each piece on each square, a hidden
+ * layer of NNUE_HIDDEN neurons for each side's point of view, and one output:
+ *
+ *   output = (sum of crelu(us[i]) * w[i] + crelu(them[i]) * w[H + i] + bias)
+ *            * NNUE_SCALE / (NNUE_QA * NNUE_QB)
+ *
+ * where us and them are the hidden layers of the player to move and the
+ * opponent, and crelu clamps to [0, NNUE_QA]. The hidden layers (together, the
+ * accumulator) are the sum of the first layer's weights for every piece on
+ * the board, so a move only needs to add and subtract the weights of the
+ * pieces it changes. Position does this in placePiece and removePiece when it
+ * has an accumulator; see Position::setAccumulator.
+ *
+ * Inputs are numbered from each side's point of view as
+ *   (own piece ? 0 : 384) + 64 * type + square
+ * where type runs pawn, knight, bishop, rook, queen, king and black's squares
+ * are flipped vertically. Weights are quantized to int16: the first layer by
+ * NNUE_QA and the output by NNUE_QB (the output bias by both). Network files
+ * hold, in little endian and with no header,
+ *   int16 featureWeights[768][NNUE_HIDDEN]
+ *   int16 featureBias[NNUE_HIDDEN]
+ *   int16 outputWeights[2 * NNUE_HIDDEN]
+ *   int16 outputBias
+ * possibly padded to a multiple of 64 bytes, which is the layout written by
+ * common trainers for this simple architecture.
+ *
+ * Accumulator updates are compiled for AVX2 and plain SSE2 and chosen when the
+ * program loads; the output layer uses AVX2 or SSE2 integer kernels, with a
+ * scalar fallback on other CPUs.
+ */
+
+const int NNUE_INPUTS = 768;
+const int NNUE_HIDDEN = 256;
+const int NNUE_QA = 255;
+const int NNUE_QB = 64;
+const int NNUE_SCALE = 400;
+
+struct alignas(64) Network {
+  I16 featureWeights[NNUE_INPUTS * NNUE_HIDDEN];
+  I16 featureBias[NNUE_HIDDEN];
+  I16 outputWeights[2 * NNUE_HIDDEN];
+  I16 outputBias;
+
+  static std::shared_ptr<const Network> load(std::string);
+};
+
+// The hidden layers for both points of view, indexed by Color.
+struct alignas(64) Accumulator {
+  I16 values[2][NNUE_HIDDEN];
+  const Network* network;
+
+  void refresh(const U64*);
+  void add(Piece, int);
+  void remove(Piece, int);
+  void move(Piece, int, int);
+  int evaluate(Color);
+};
+
+#endif
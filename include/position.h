@@ -3,28 +3,79 @@
 
 #include "types.h"
 #include "move.h"
+#include "arena.h"
+#include "nnue.h"
 
+#include <type_traits>
 #include <vector>
 
-class Position {
+/* The board state is plain data (bitboards, flags, player and clock) so that
+ * a Position can be copied with a memcpy. It is aligned to a cache line, so a
+ * copy touches as few lines as possible. Search can therefore either make and
+ * unmake moves in place, or keep a stack of positions and use afterMove.
+ *
+ * Move lists can be returned as a std::vector, or filled into a MoveList
+ * allocated from an Arena, which is what the search and perft use so that
+ * no node touches the heap.
+ *
+ * A Position may be given an NNUE Accumulator (see nnue.h), which it then
+ * keeps up to date as pieces are placed and removed. The accumulator is not
+ * part of the copy: afterMove(Move) returns a position without one, and
+ * afterMove(Move, Accumulator*) copies this position's accumulator into the
+ * one given and updates it for the move.
+ */
+
+// The most legal moves of any position is 218.
+const int MAX_MOVES = 256;
+
+typedef ArenaVector<Move> MoveList;
+
+class alignas(64) Position {
+  friend class Tablebase;
+  friend class PositionBatch;
+  friend struct PackedPosition;
+
   public:
     Position();
     Position(std::string);
 
     void initPieces();
     void loadFEN(std::string);
+    std::string getFEN();
     void printBoard();
     static void printBitBoard(U64);
     void makeMove(Move&);
     void unmakeMove(Move&);
+    Position afterMove(Move) const;
+    Position afterMove(Move, Accumulator*) const;
+    void makeNullMove(Move&);
+    void unmakeNullMove(Move&);
+    Position afterNullMove() const;
     std::vector<Move> getLegalMoves();
+    void getLegalMoves(MoveList&);
+    int countLegalMoves();
+    bool hasLegalMove();
     int lookupMove(std::string, std::vector<Move>&);
     void nameMoves(std::vector<Move>&);
+    U64 perft(int);
     U16 getClock();
+    U64 getKey();
+    U64 getPawnKey();
     bool inCheck();
     Color getPlayer();
+    void setAccumulator(Accumulator*);
+    Accumulator* getAccumulator();
 
-    static void populateMaskArrays();
+    // Functions for retrieving board information
+    Piece getPiece(int);
+    U64 getBitboard(Piece);
+    U64 getAttackedSquares(Piece, int);
+    U64 getAttackedSquares(Color);
+    U64 getOccupied();
+    U64 getOccupied(Color);
+    bool inCheck(Color);
+    static int bitscan(U64);
+    static int popcount(U64);
 
   private:
     /**
@@ -57,19 +108,29 @@ class Position {
     Color player; 
     U16 clock;
 
-    // Masks used for fast calculations
-    static U64 attackOnEmpty[5][64];
-    static U64 blockerMask[5][64];
-    static U64 behindMask[64][64];
+    // Zobrist key, see zobrist.h, and the key of the pawns alone
+    U64 key;
+    U64 pawnKey;
+
+    // Hidden layers of the NNUE for this position, or null if not kept
+    Accumulator* accumulator;
 
     // Constants for De Bruijn multiplication
-    static U64 deb;
-    static int debArray[64];
+    static constexpr U64 deb = 0x03f79d71b4cb0a89;
+    static constexpr int debArray[64] = {
+      0,  1, 48,  2, 57, 49, 28,  3,
+      61, 58, 50, 42, 38, 29, 17,  4,
+      62, 55, 59, 36, 53, 51, 43, 22,
+      45, 39, 33, 30, 24, 18, 12,  5,
+      63, 47, 56, 27, 60, 41, 37, 16,
+      54, 35, 52, 21, 44, 32, 23, 11,
+      46, 26, 40, 15, 34, 20, 31, 10,
+      25, 14, 19,  9, 13,  8,  7,  6
+    };
 
     // Functions for manipulating the board
     Color switchPlayer();
     void setEPFile(int);
-    void setCastlingFlag(int, Color);
     void placePiece(Piece, int);
     void movePiece(Piece, int, int);
     Piece removePiece(int);
@@ -77,31 +138,35 @@ class Position {
 
     // Functions for retrieving board information
     int getEPFile();
-    Piece getPiece(int);
-    U64 getAttackedSquares(Piece, int);
-    U64 getAttackedSquares(Color);
-    U64 getOccupied();
-    U64 getOccupied(Color);
-    bool inCheck(Color);
+    U64 computeKey();
+    U64 computePawnKey();
     bool inCheckmate();
     bool isLegalMove(Move&);
+    int countLegalMovesUpTo(int);
+
+    // Specializations for the player to move (or, for unmakeMoveAs, the
+    // player who made the move), which the functions above dispatch to
+    template<Color> void makeMoveAs(Move&);
+    template<Color> void unmakeMoveAs(Move&);
+    template<Color, class List> void getLegalMovesAs(List&);
+    template<Color, class List> void getEvasionsAs(List&, U64);
+    template<Color> U64 getCheckersAs(int);
+    template<Color> int countLegalMovesAs(int);
+    template<Color> bool isLegalMoveAs(Move&);
+    template<Color> Piece removeCapturedPiece(int);
+    template<Color> static Piece promotedPiece(MoveType);
     bool canCastle(Color, int);
-    void addCastlingMoveIfAble(std::vector<Move>&, Color, int);
+    template<class List> void addCastlingMoveIfAble(List&, Color, int);
 
     // Functions for naming moves
     std::string nameMove(Move&, int);
     
-    // Functions for calculating the masks
-    static U64 calculateRookAttackOnEmpty(int, int);
-    static U64 calculateBishopAttackOnEmpty(int, int);
-    static U64 calculateKingAttackOnEmpty(int, int);
-    static U64 calculateKnightAttackOnEmpty(int, int);
-    static U64 calculateRookBlockerMask(int, int);
-    static U64 calculateBishopBlockerMask(int, int);
-    static U64 calculateBehindMask(int, int, int, int);
-
     // Miscellaneous utility functions
-    static void addPawnMoves(std::vector<Move>&, int, int);
+    template<class List>
+    static void addPawnMoves(List&, Piece, U64, int, MoveType);
+    template<class List>
+    static void addPromotions(List&, Piece, U64, int, bool);
+    template<Color> static int countPawnMoves(U64, U64, U64, U64);
     static bool inBounds(int, int);
     static int frToSquare(int, int);
     static std::string frToString(int, int);
@@ -112,7 +177,10 @@ class Position {
     static Piece makeColor(Piece, Color);
     static Color getColor(Piece);
     static Color oppositeColor(Color);
-    static int bitscan(U64);
 };
 
+static_assert(std::is_trivially_copyable<Position>::value,
+    "Position must be copyable with memcpy");
+static_assert(alignof(Position) == 64, "Position must be cache aligned");
+
 #endif
@@ -0,0 +1,41 @@
+#ifndef REGRESSION_H
+#define REGRESSION_H
+
+#include "types.h"
+
+#include <string>
+
+/* Regression runner for the suites under tests/. The kind of suite is given
+ * by the file name prefix:
+ *
+ *   makemove_*.txt  A FEN followed by moves ("from to type"). Every move must
+ *                   be legal, and unmaking must restore the position exactly.
+ *   movegen_*.txt   Lines of "fen,count" giving the number of legal moves,
+ *                   which getLegalMoves and countLegalMoves must both give.
+ *   perft_*.txt     A FEN followed by lines of "depth nodes".
+ *   attacks_*.txt   Lines of "seed boards". Set-wise sliding attacks on that
+ *                   many random boards, from both the dispatched kernel and
+ *                   the portable one, must match attacks traced ray by ray.
+ *   batch_*.txt     Lines of "seed positions". PositionBatch, with each
+ *                   attack kernel the CPU can run, must agree with the
+ *                   single position API on positions from random games.
+ *   server_*.txt    Lines of "request => reply", sent in order to the game
+ *                   server's request handler, whose replies must match.
+ *
+ * Suites run in parallel and each reports its wall time. Nodes per second of
+ * every suite listed in the baseline file must not fall more than the
+ * tolerance below the stored value.
+ */
+
+struct RegressionOptions {
+  std::string directory = "tests";
+  std::string baselineFile = "tests/baseline_nps.txt";
+  std::string filter;
+  int threads = 0;
+  double tolerance = 0.3;
+  bool updateBaseline = false;
+};
+
+int runRegressionTests(RegressionOptions&);
+
+#endif
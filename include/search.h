@@ -0,0 +1,187 @@
+#ifndef SEARCH_H
+#define SEARCH_H
+
+#include "types.h"
+#include "position.h"
+#include "move.h"
+#include "arena.h"
+#include "nnue.h"
+#include "timeman.h"
+
+#include <atomic>
+#include <chrono>
+#include <functional>
+#include <string>
+#include <vector>
+
+/* Alpha-beta search with iterative deepening, a transposition table and a
+ * quiescence search over captures. Each Search has its own table and state,
+ * so threads (for example the games of a match) each use their own instance.
+ * Move lists and other per-node data come from the instance's arena, which is
+ * rewound as each node returns.
+ *
+ * With a network file, positions are evaluated by the NNUE. The search keeps
+ * one accumulator per ply, and each child copies its parent's and updates it
+ * for the move.
+ *
+ * Within the tree, moves after the first are searched with a null window
+ * (principal variation search) and late quiet moves at reduced depth, and are
+ * searched again fully only if they beat alpha. Null move pruning and
+ * futility pruning skip nodes which are clearly too good or too bad, and
+ * positions in check are searched a ply deeper. SearchOptions turns each of
+ * these off.
+ *
+ * To find the best N lines (MultiPV), each iteration searches the root N
+ * times, each time leaving out the first moves of the lines already found.
+ * The passes share the transposition table, so later passes mostly follow
+ * what earlier ones stored and cost much less than the first.
+ *
+ * Scores are in centipawns from the point of view of the player to move. A
+ * mate in n plies scores MATE_SCORE - n for the winner.
+ */
+
+const int MAX_PLY = 128;
+const int MATE_SCORE = 30000;
+const int INFINITE_SCORE = 32000;
+
+// When to stop thinking. Zero means no limit. With a clock, the time manager
+// decides how much of it to use. A ponder search ignores the time limits until
+// Search::ponderHit is called.
+struct SearchLimits {
+  int depth = MAX_PLY - 1;
+  U64 nodes = 0;
+  int timeMs = 0;       // fixed time for the move
+  int clockMs = 0;      // time left for the player to move
+  int incrementMs = 0;
+  int movesToGo = 0;    // until the next time control, 0 for none
+  bool ponder = false;
+  int multiPV = 1;      // number of best lines to find
+};
+
+// Settings which change how the engine plays, eg to compare two versions in
+// a match.
+struct SearchOptions {
+  int hashMB = 16;
+  bool quiescence = true;
+  bool tablebases = true;
+  std::string nnueFile;  // empty for the hand written evaluation
+
+  // Selectivity, which can be turned off to measure what each saves
+  bool pvs = true;             // null windows after the first move
+  bool aspiration = true;      // narrow root windows around the last score
+  bool nullMove = true;        // prune if passing still beats beta
+  bool lmr = true;             // reduce late quiet moves
+  bool futility = true;        // skip quiet moves far below alpha near leaves
+  bool checkExtensions = true; // search one ply deeper when in check
+
+  bool set(std::string, std::string);
+};
+
+// One of the best lines found at the root
+struct SearchLine {
+  int score = 0;
+  std::vector<Move> pv;
+};
+
+// Outcome of a search, and progress reports during one. With several lines,
+// best, score and pv describe the first, and a report is about lines[line].
+struct SearchResult {
+  Move best;
+  int score = 0;
+  int depth = 0;
+  U64 nodes = 0;
+  double seconds = 0;
+  std::vector<Move> pv;
+  std::vector<SearchLine> lines;  // best first
+  int line = 0;
+  size_t arenaPeak = 0;  // most arena memory in use at once, in bytes
+  U64 pawnHashHits = 0;  // pawn hash table lookups, and those which hit
+  U64 pawnHashProbes = 0;
+};
+
+// One slot of the transposition table. Moves are packed into 16 bits: from,
+// to and type.
+struct TTEntry {
+  U64 key;
+  I16 score;
+  U8 depth;
+  U8 bound;
+  U16 move;
+};
+
+class TranspositionTable {
+  public:
+    enum Bound : U8 {
+      NONE = 0,
+      UPPER,
+      LOWER,
+      EXACT,
+    };
+
+    void resize(int);
+    void clear();
+    TTEntry* probe(U64);
+    void store(U64, int, int, Bound, U16);
+
+  private:
+    std::vector<TTEntry> entries;
+    U64 mask = 0;
+};
+
+class Search {
+  public:
+    Search(SearchOptions = SearchOptions());
+
+    SearchResult think(Position&, SearchLimits&, std::vector<U64>&);
+    void stop();
+    void ponderHit();
+    bool isThinking();
+    void newGame();
+    void setInfoCallback(std::function<void(SearchResult&)>);
+    SearchOptions& getOptions();
+
+    static bool isMateScore(int);
+    static U16 packMove(Move&);
+    static int findPackedMove(U16, std::vector<Move>&);
+
+  private:
+    SearchOptions options;
+    TranspositionTable tt;
+    std::function<void(SearchResult&)> infoCallback;
+    Arena arena;
+    std::shared_ptr<const Network> network;
+    std::vector<Accumulator> accumulators;  // one per ply
+
+    // State of the current search
+    std::atomic<bool> stopped;
+    std::atomic<bool> pondering;
+    std::atomic<bool> thinking;
+    std::atomic<int> ponderHitMs;  // when the ponder search became real
+    SearchLimits limits;
+    TimeManager timeManager;
+    bool failedLow;
+    std::chrono::steady_clock::time_point startTime;
+    U64 pawnHitsAtStart, pawnProbesAtStart;
+    U64 nodes;
+    std::vector<U64> keys;
+    std::vector<U16> excludedRootMoves;  // by earlier MultiPV passes
+    U16 pv[MAX_PLY][MAX_PLY];
+    int pvLength[MAX_PLY];
+    U16 killers[MAX_PLY][2];
+    int history[12][64];
+
+    int searchRoot(Position&, int, int);
+    int negamax(Position&, int, int, int, int, bool = true);
+    int quiescence(Position&, int, int, int);
+    bool isDraw(Position&, int);
+    Position afterMove(Position&, Move&, int);
+    bool isExcludedRootMove(Move&);
+    void checkLimits();
+    void orderMoves(Position&, MoveList&, ArenaVector<int>&, U16, int);
+    static void pickMove(MoveList&, ArenaVector<int>&, unsigned int);
+    std::vector<Move> buildPV(Position&);
+    void recordStats(SearchResult&);
+    double elapsed();
+};
+
+#endif
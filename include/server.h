@@ -0,0 +1,43 @@
+#ifndef SERVER_H
+#define SERVER_H
+
+#include "types.h"
+
+#include <string>
+#include <vector>
+
+/* Serves many games at once over a Unix domain socket. A single thread runs
+ * an event loop (epoll) over every client connection, and games live in a
+ * fixed pool of session slots addressed by id, so any connection may play any
+ * game and thousands of games cost no more than their slots.
+ *
+ * Requests and replies are single lines. Every reply starts with "ok" or
+ * "error <reason>".
+ *
+ *   new [fen]         start a game, replies "ok <id>"
+ *   move <id> <move>  play a move, given either as in the console game (eg
+ *                     Nf3, exd5, O-O) or as squares (eg g1f3, e7e8q);
+ *                     replies "ok <name> <status>"
+ *   undo <id>         take back the last move, replies "ok <status>"
+ *   moves <id>        "ok" followed by the legal moves
+ *   fen <id>          "ok <fen>"
+ *   status <id>       "ok <status>", where status is one of playing, check,
+ *                     checkmate, stalemate or fifty
+ *   history <id>      "ok" followed by the moves played so far
+ *   close <id>        end the game and free its slot
+ *   quit              close the connection
+ */
+
+struct ServerOptions {
+  std::string socketPath = "tchess.sock";
+  int maxSessions = 4096;
+  int maxConnections = 1024;
+};
+
+int runServer(ServerOptions&);
+
+// Answers each request line as a connection to the server would, against a
+// small pool of sessions of its own, and returns the replies. For the tests.
+std::vector<std::string> replayServerRequests(std::vector<std::string>&);
+
+#endif
@@ -0,0 +1,36 @@
+#ifndef SOLVE_H
+#define SOLVE_H
+
+#include "types.h"
+#include "search.h"
+
+#include <string>
+
+/* Runs a test suite of EPD positions, such as Win At Chess, to measure how
+ * well the search finds the right moves for the time it is given.
+ *
+ * Each position needs a bm (best move) or am (avoid move) operation, with one
+ * or more moves in SAN; positions with neither are skipped. A position is
+ * solved if the move the search settles on is one of the best moves and none
+ * of the moves to avoid. Its time to solution is when the search first chose
+ * such a move and kept it to the end, and is only counted for solved
+ * positions.
+ *
+ * Positions are shared out to a pool of threads, each with its own Search,
+ * and every search gets the same fixed time or node budget. The summary gives
+ * the number solved, the mean time to solution and the aggregate NPS of all
+ * threads, so a change which speeds the search up can be checked to solve at
+ * least as many positions.
+ */
+
+struct SolveOptions {
+  std::string epdFile;
+  int threads = 1;
+  int timeMs = 1000;  // per position, 0 for no limit
+  U64 nodes = 0;      // per position, 0 for no limit
+  SearchOptions engine;
+};
+
+int runSolver(SolveOptions&);
+
+#endif
@@ -0,0 +1,112 @@
+#ifndef STATS_H
+#define STATS_H
+
+#include "types.h"
+
+/* Instrumentation of the hot paths: event counters and scoped cycle timers,
+ * kept per thread and summed into a table printed when the program exits.
+ *
+ * Everything here compiles to nothing unless TCHESS_STATS is defined, which
+ * the Makefile does when building with STATS=1:
+ *   make clean all STATS=1
+ *
+ * Usage:
+ *   STAT_INC(STAT_REMOVE_PIECE_SCANS);
+ *   STAT_ADD(STAT_BLOCKER_ITERATIONS, n);
+ *   STAT_TIMER(TIMER_GET_LEGAL_MOVES);  // times the enclosing scope
+ */
+
+enum StatCounter {
+  STAT_MAKE_MOVES,
+  STAT_GET_LEGAL_MOVES,
+  STAT_LEGALITY_CHECKS,
+  STAT_LEGALITY_REJECTIONS,
+  STAT_REMOVE_PIECE_SCANS,
+  STAT_REMOVE_PIECE_SCAN_STEPS,
+  STAT_ATTACK_LOOKUPS,
+  STAT_BLOCKER_ITERATIONS,
+  STAT_COLOR_ATTACK_MAPS,
+  NUM_STAT_COUNTERS,
+};
+
+enum StatTimer {
+  TIMER_GET_LEGAL_MOVES,
+  TIMER_IS_LEGAL_MOVE,
+  TIMER_MAKE_MOVE,
+  TIMER_UNMAKE_MOVE,
+  TIMER_COLOR_ATTACK_MAP,
+  TIMER_NAME_MOVES,
+  NUM_STAT_TIMERS,
+};
+
+#ifdef TCHESS_STATS
+
+#include <chrono>
+#if defined(__x86_64__) || defined(__i386__)
+#include <x86intrin.h>
+#endif
+
+class Stats {
+  public:
+    // Statistics gathered by one thread. Each thread writes only to its own.
+    struct ThreadStats {
+      U64 counters[NUM_STAT_COUNTERS];
+      U64 timerCalls[NUM_STAT_TIMERS];
+      U64 timerCycles[NUM_STAT_TIMERS];
+    };
+
+    static ThreadStats& local() {
+      thread_local ThreadStats* stats = registerThread();
+      return *stats;
+    }
+
+    // Returns a timestamp in cycles, or nanoseconds where there is no cycle
+    // counter.
+    static U64 now() {
+#if defined(__x86_64__) || defined(__i386__)
+      return __rdtsc();
+#else
+      return std::chrono::duration_cast<std::chrono::nanoseconds>(
+          std::chrono::steady_clock::now().time_since_epoch()).count();
+#endif
+    }
+
+    static void report();
+
+  private:
+    static ThreadStats* registerThread();
+};
+
+// Adds the time spent in the enclosing scope to the given timer.
+class ScopedStatTimer {
+  public:
+    ScopedStatTimer(StatTimer t) {
+      timer = t;
+      start = Stats::now();
+    }
+    ~ScopedStatTimer() {
+      Stats::ThreadStats& s = Stats::local();
+      s.timerCalls[timer]++;
+      s.timerCycles[timer] += Stats::now() - start;
+    }
+
+  private:
+    StatTimer timer;
+    U64 start;
+};
+
+#define STAT_CONCAT_(a, b) a##b
+#define STAT_CONCAT(a, b) STAT_CONCAT_(a, b)
+#define STAT_INC(c) (Stats::local().counters[c]++)
+#define STAT_ADD(c, n) (Stats::local().counters[c] += (n))
+#define STAT_TIMER(t) ScopedStatTimer STAT_CONCAT(statTimer, __LINE__)(t)
+
+#else
+
+#define STAT_INC(c) ((void)0)
+#define STAT_ADD(c, n) ((void)0)
+#define STAT_TIMER(t) ((void)0)
+
+#endif
+
+#endif
@@ -0,0 +1,147 @@
+#ifndef TABLEBASE_H
+#define TABLEBASE_H
+
+#include "types.h"
+#include "position.h"
+
+#include <atomic>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <vector>
+
+/* Endgame tablebases for material configurations of at most four pieces
+ * (kings included), such as KQK, KRK, KPK or KQKR.
+ *
+ * A table is identified by its material signature: the white pieces followed
+ * by the black pieces, each side starting with its king and listing the rest
+ * in Piece order (Q, R, B, N, P). Only one of a signature and its color-flipped
+ * twin is stored; "KKQ" positions are probed through the "KQK" table by
+ * mirroring the board.
+ *
+ * Tables are generated by retrograde analysis. Every placement of the pieces is
+ * indexed as
+ *   index = sideToMove * 64^n + sq[0] + 64*sq[1] + ... + 64^(n-1)*sq[n-1]
+ * Mates are found first, and from there results are propagated backwards one
+ * ply at a time by generating unmoves. Moves which leave the table (captures
+ * and promotions) are resolved by probing the smaller tables, which are
+ * generated first.
+ *
+ * Results are stored as distance to mate (DTM) in plies, bit-packed using only
+ * as many bits per entry as the longest mate requires. Tables may be cached on
+ * disk and are then memory mapped read-only when loaded.
+ *
+ * Known limitation: en passant rights are not part of the index, so in tables
+ * with pawns on both sides the rare positions where en passant is the only
+ * good move may be scored as if it were unavailable.
+ */
+
+enum TBResult {
+  TB_LOSS = -1,
+  TB_DRAW = 0,
+  TB_WIN = 1,
+};
+
+class Tablebase {
+  public:
+    static const int MAX_PIECES = 4;
+
+    Tablebase(std::string);
+    ~Tablebase();
+
+    bool generate(int);
+    bool save(std::string);
+    bool load(std::string);
+    std::string getSignature();
+    int getMaxPlies();
+    U64 getSizeInBytes();
+    void printSummary();
+
+    // Registry of tables shared by the whole program
+    static void setCacheDirectory(std::string);
+    static void setThreads(int);
+    static Tablebase* get(std::string);
+    static bool probe(Position&, TBResult&, int&);
+    static std::string getMaterialSignature(Position&);
+    static std::string canonicalSignature(std::string);
+
+  private:
+    // Generation states of individual entries
+    enum EntryState : U8 {
+      UNKNOWN = 0,
+      WIN,
+      LOSS,
+      DRAW,
+      ILLEGAL,
+    };
+
+    std::string signature;
+    int numPieces;
+    Piece pieces[MAX_PIECES];
+    U64 numEntries;
+
+    // Packed results: each entry holds 0 for a draw (or illegal placement) or
+    // the DTM in plies plus one. Odd DTM values are wins for the side to move.
+    int bitsPerEntry;
+    int maxPlies;
+    std::vector<U64> packed;
+    const U64* data;
+
+    // Memory mapping, if the table was loaded from disk
+    void* mapAddress;
+    size_t mapLength;
+
+    // Scratch space used only during generation
+    std::vector<U8> state;
+    std::vector<U16> plies;
+    std::vector<U16> exitLoss;
+    std::vector<U8> blocked;
+    std::unique_ptr<std::atomic<U8>[]> counts;
+    std::map<std::string, Tablebase*> subTables;
+
+    // Indexing
+    U64 encode(const int*, Color);
+    void decode(U64, int*, Color&);
+    bool isCanonicalOrder(const int*);
+    void canonicalizeOrder(int*);
+    U64 indexOf(Position&, bool);
+    bool setupPosition(U64, Position&);
+
+    // Generation steps
+    void initializeRange(U64, U64, std::vector<std::vector<U64>>&);
+    void propagateRange(std::vector<U64>&, size_t, size_t, int,
+        std::vector<std::vector<U64>>&);
+    void schedule(std::vector<std::vector<U64>>&, int, U64, EntryState);
+    bool probeExit(Position&, TBResult&, int&);
+    void pack();
+
+    // Reading packed entries
+    U64 readEntry(U64);
+    TBResult probeIndex(U64, int&);
+
+    static std::map<std::string, std::unique_ptr<Tablebase>> registry;
+    static std::recursive_mutex registryMutex;
+
+    // Tables by the material index of the positions they cover, for probes
+    // which take no lock. A table is stored before its state is published.
+    enum MaterialState : U8 {
+      MATERIAL_UNKNOWN = 0,
+      MATERIAL_MISSING,
+      MATERIAL_FOUND,
+      MATERIAL_FLIPPED,  // found under the color-flipped signature
+    };
+    static const int MATERIAL_INDICES = 59049;  // 3^10
+    static std::atomic<U8> materialStates[MATERIAL_INDICES];
+    static std::atomic<Tablebase*> materialTables[MATERIAL_INDICES];
+    static std::string cacheDirectory;
+    static int threads;
+
+    static int materialIndex(Position&);
+    static U8 findMaterial(Position&, int);
+    static void forgetMaterial();
+    static bool parseSignature(std::string, Piece*, int&);
+    static std::string flipSignature(std::string);
+};
+
+#endif
@@ -0,0 +1,35 @@
+#ifndef TIMEMAN_H
+#define TIMEMAN_H
+
+#include "types.h"
+
+/* Decides how long to think about a move under a clock.
+ *
+ * From the time left, the increment and the moves until the next time
+ * control, the time manager sets two limits. The soft limit is the time the
+ * move should normally take: it is checked between iterations, since an
+ * iteration which is started after it would rarely finish. It is scaled
+ * down when the best move has stayed the same for several iterations, and up
+ * when the best move changed or the score fell (a fail low), since the search
+ * has then just found out it was wrong. The hard limit is checked during
+ * search and is never exceeded, so that the engine cannot lose on time.
+ *
+ * With a fixed time per move both limits are that time, and iterations are
+ * only stopped by the hard limit.
+ */
+
+class TimeManager {
+  public:
+    void start(int, int, int, int);
+    bool isActive();
+    int getSoftMs();
+    int getHardMs();
+    bool stopAfterIteration(double, int, bool, bool);
+
+  private:
+    int softMs = 0;
+    int hardMs = 0;
+    bool fixed = false;
+};
+
+#endif
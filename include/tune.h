@@ -0,0 +1,40 @@
+#ifndef TUNE_H
+#define TUNE_H
+
+#include "types.h"
+#include "eval.h"
+
+#include <string>
+#include <vector>
+
+/* Texel tuning of the evaluation parameters (see eval.h) against the results
+ * of games, using positions written by datagen.
+ *
+ * The evaluation s of each position is mapped to an expected result with
+ *   sigmoid(s) = 1 / (1 + 10^(-K * s / 400))
+ * and the parameters are fitted by gradient descent (Adam) to minimize the
+ * mean squared difference from the actual results. Since the evaluation is
+ * linear in its parameters, the gradient of each position is its error
+ * times the weights from forEachEvalTerm. Positions are kept as 32 byte
+ * PackedPositions and every epoch is split among threads, each summing its
+ * own gradient.
+ *
+ * K is fitted first, to the starting parameters, unless given. With
+ * quiescence, each position is first replaced by the end of the principal
+ * line of a capture search, so that only quiet positions are scored.
+ */
+
+struct TuneOptions {
+  std::vector<std::string> dataFiles;
+  std::string paramsFile;              // starting parameters, or defaults
+  std::string outputFile = "eval_params.txt";
+  int threads = 1;
+  int epochs = 100;
+  double learningRate = 1.0;
+  double k = 0;                        // 0 to fit
+  bool quiescence = false;
+};
+
+int runTuner(TuneOptions&);
+
+#endif
@@ -7,8 +7,13 @@
 // Shorthand for unsigned integers.
 typedef uint8_t  U8;
 typedef uint16_t U16;
+typedef uint32_t U32;
 typedef uint64_t U64;
 
+// Shorthand for signed integers.
+typedef int8_t  I8;
+typedef int16_t I16;
+
 // More readable form of 1UL.
 const U64 ONE = 1;
 
@@ -0,0 +1,30 @@
+#ifndef UCI_H
+#define UCI_H
+
+#include "types.h"
+
+#include <iostream>
+
+/* The Universal Chess Interface, for playing through chess GUIs and
+ * tournament managers. Commands are read from in and replies written to out;
+ * the search runs on its own thread so that stop and ponderhit are answered
+ * while it thinks.
+ *
+ *   uci, isready, ucinewgame, quit
+ *   setoption name <name> value <value>
+ *       Hash, Ponder, MultiPV and every engine option of SearchOptions::set (eg
+ *       NullMove, LMR, NNUE)
+ *   position (startpos | fen <fen>) [moves <move>...]
+ *   go [wtime ms] [btime ms] [winc ms] [binc ms] [movestogo n] [depth n]
+ *      [nodes n] [movetime ms] [infinite] [ponder]
+ *   stop, ponderhit
+ *
+ * With go ponder, the engine thinks on the position after the move it
+ * expects, without a time limit. If the opponent plays that move, ponderhit
+ * turns the same search into a normal one, keeping everything it has already
+ * searched, and the time it spent counts towards its soft limit.
+ */
+
+int runUCI(std::istream&, std::ostream&);
+
+#endif
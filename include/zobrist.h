@@ -0,0 +1,61 @@
+#ifndef ZOBRIST_H
+#define ZOBRIST_H
+
+#include "types.h"
+
+/* Random keys for Zobrist hashing. The key of a position is the xor of the
+ * keys of every piece on its square, of its castling rights and en passant
+ * file, and of the side key if black is to move. Making a move then only
+ * needs to xor out what changed and xor in the result.
+ *
+ * The keys are generated at compile time from a fixed seed, like the masks in
+ * masks.h, so keys are the same from run to run and nothing needs to be
+ * initialized.
+ *
+ * pieces[p][sq]: piece p on sq.
+ * flags[f]: the upper or lower four bits of Position's flags; castling
+ *   rights are keyed by flags >> 4 and en passant by (flags & 0x0f) + 16.
+ *   Entries 16 to 23 (en passant flag clear) are zero.
+ * side: black to move.
+ *
+ * Position also keeps a pawn key, the xor of the piece keys of the pawns
+ * alone, for caching evaluation terms which depend only on the pawns.
+ */
+
+struct ZobristKeys {
+  U64 pieces[12][64];
+  U64 flags[32];
+  U64 side;
+};
+
+// SplitMix64, a small generator with good statistical quality.
+constexpr U64 splitMix64(U64& state) {
+  state += 0x9e3779b97f4a7c15ULL;
+  U64 z = state;
+  z = (z ^ (z >> 30)) * 0xbf58476d1ce4e5b9ULL;
+  z = (z ^ (z >> 27)) * 0x94d049bb133111ebULL;
+  return z ^ (z >> 31);
+}
+
+constexpr ZobristKeys generateZobristKeys() {
+  ZobristKeys z = {};
+  U64 state = 0x7463686573730001ULL;
+  for (int p = 0; p < 12; p++)
+    for (int sq = 0; sq < 64; sq++)
+      z.pieces[p][sq] = splitMix64(state);
+  for (int i = 1; i < 16; i++)
+    z.flags[i] = splitMix64(state);
+  for (int i = 24; i < 32; i++)
+    z.flags[i] = splitMix64(state);
+  z.side = splitMix64(state);
+  return z;
+}
+
+inline constexpr ZobristKeys ZOBRIST = generateZobristKeys();
+
+// Key of the castling rights and en passant file in a flags byte.
+constexpr U64 flagsKey(U8 flags) {
+  return ZOBRIST.flags[flags >> 4] ^ ZOBRIST.flags[(flags & 0x0f) + 16];
+}
+
+#endif
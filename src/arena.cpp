@@ -0,0 +1,84 @@
+#include "arena.h"
+#include "types.h"
+
+#include <algorithm>
+#include <new>
+
+Arena::Arena(size_t blockSize) {
+  this->blockSize = blockSize;
+  current = 0;
+  offset = 0;
+  peak = 0;
+}
+
+Arena::~Arena() {
+  for (unsigned int i = 0; i < blocks.size(); i++)
+    ::operator delete(blocks[i].data);
+}
+
+// Moves on to the next block, which is kept from earlier use if it is big
+// enough and made otherwise, and allocates from it.
+void* Arena::allocateSlow(size_t bytes, size_t align) {
+  size_t next = (current < blocks.size()) ? current + 1 : current;
+  size_t needed = bytes + align;
+  if (next < blocks.size() && blocks[next].size < needed) {
+    for (size_t i = next; i < blocks.size(); i++)
+      ::operator delete(blocks[i].data);
+    blocks.resize(next);
+  }
+  if (next == blocks.size()) {
+    size_t size = std::max(blockSize, needed);
+    size_t start = (next == 0) ? 0
+      : blocks[next - 1].start + blocks[next - 1].size;
+    blocks.push_back(Block{(char*)::operator new(size), size, start});
+  }
+  current = next;
+  offset = 0;
+  return allocate(bytes, align);
+}
+
+// Returns the current position, to be passed to rewind later.
+Arena::Mark Arena::getMark() {
+  return Mark{current, offset};
+}
+
+// Frees everything allocated since the mark was taken.
+void Arena::rewind(Mark m) {
+  current = m.block;
+  offset = m.offset;
+}
+
+// Frees everything. The blocks are kept for reuse.
+void Arena::reset() {
+  current = 0;
+  offset = 0;
+}
+
+// Bytes in use, counting unused space at the end of earlier blocks.
+size_t Arena::getUsed() {
+  if (blocks.empty())
+    return 0;
+  return blocks[current].start + offset;
+}
+
+// Highest getUsed() since the arena was made or resetPeak was called.
+size_t Arena::getPeak() {
+  return peak;
+}
+
+// Bytes held from the heap.
+size_t Arena::getCapacity() {
+  if (blocks.empty())
+    return 0;
+  return blocks.back().start + blocks.back().size;
+}
+
+void Arena::resetPeak() {
+  peak = getUsed();
+}
+
+// Returns the calling thread's arena.
+Arena& Arena::forThread() {
+  thread_local Arena arena;
+  return arena;
+}
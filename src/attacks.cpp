@@ -0,0 +1,113 @@
+#include "attacks.h"
+#include "types.h"
+
+#if defined(__x86_64__) && defined(__GNUC__)
+#include <immintrin.h>
+#define TCHESS_HAVE_AVX2_PATH
+#endif
+
+// Occluded fill from the generators gen through the propagators pro (the empty
+// squares) in the direction given by a left shift of s, returning the squares
+// attacked in that direction. mask removes squares which wrapped around the
+// board.
+static inline U64 fillLeft(U64 gen, U64 pro, int s, U64 mask) {
+  pro &= mask;
+  gen |= pro & (gen << s);
+  pro &= pro << s;
+  gen |= pro & (gen << (2*s));
+  pro &= pro << (2*s);
+  gen |= pro & (gen << (4*s));
+  return (gen << s) & mask;
+}
+
+// Like fillLeft, but for a right shift of s.
+static inline U64 fillRight(U64 gen, U64 pro, int s, U64 mask) {
+  pro &= mask;
+  gen |= pro & (gen >> s);
+  pro &= pro >> s;
+  gen |= pro & (gen >> (2*s));
+  pro &= pro >> (2*s);
+  gen |= pro & (gen >> (4*s));
+  return (gen >> s) & mask;
+}
+
+U64 slidingAttacksScalar(U64 orthogonal, U64 diagonal, U64 empty) {
+  U64 a = 0;
+  a |= fillLeft(orthogonal, empty, 8, ~0ULL);       // north
+  a |= fillRight(orthogonal, empty, 8, ~0ULL);      // south
+  a |= fillLeft(orthogonal, empty, 1, NOT_FILE_A);  // east
+  a |= fillRight(orthogonal, empty, 1, NOT_FILE_H); // west
+  a |= fillLeft(diagonal, empty, 9, NOT_FILE_A);    // northeast
+  a |= fillLeft(diagonal, empty, 7, NOT_FILE_H);    // northwest
+  a |= fillRight(diagonal, empty, 7, NOT_FILE_A);   // southeast
+  a |= fillRight(diagonal, empty, 9, NOT_FILE_H);   // southwest
+  return a;
+}
+
+#ifdef TCHESS_HAVE_AVX2_PATH
+
+// The same fills with the four directions which shift left in one vector
+// (north, east, northeast, northwest) and the four which shift right in
+// another (south, west, southwest, southeast). Lanes are listed low to high.
+__attribute__((target("avx2")))
+static U64 slidingAttacksAVX2(U64 orthogonal, U64 diagonal, U64 empty) {
+  const __m256i gen0 = _mm256_set_epi64x(diagonal, diagonal, orthogonal,
+      orthogonal);
+  const __m256i pro0 = _mm256_set1_epi64x(empty);
+  const __m256i s1 = _mm256_set_epi64x(7, 9, 1, 8);
+  const __m256i s2 = _mm256_add_epi64(s1, s1);
+  const __m256i s4 = _mm256_add_epi64(s2, s2);
+  const __m256i leftMask = _mm256_set_epi64x(NOT_FILE_H, NOT_FILE_A,
+      NOT_FILE_A, ~0ULL);
+  const __m256i rightMask = _mm256_set_epi64x(NOT_FILE_A, NOT_FILE_H,
+      NOT_FILE_H, ~0ULL);
+
+  // Left shifting directions
+  __m256i gen = gen0;
+  __m256i pro = _mm256_and_si256(pro0, leftMask);
+  gen = _mm256_or_si256(gen, _mm256_and_si256(pro, _mm256_sllv_epi64(gen, s1)));
+  pro = _mm256_and_si256(pro, _mm256_sllv_epi64(pro, s1));
+  gen = _mm256_or_si256(gen, _mm256_and_si256(pro, _mm256_sllv_epi64(gen, s2)));
+  pro = _mm256_and_si256(pro, _mm256_sllv_epi64(pro, s2));
+  gen = _mm256_or_si256(gen, _mm256_and_si256(pro, _mm256_sllv_epi64(gen, s4)));
+  __m256i a = _mm256_and_si256(_mm256_sllv_epi64(gen, s1), leftMask);
+
+  // Right shifting directions
+  gen = gen0;
+  pro = _mm256_and_si256(pro0, rightMask);
+  gen = _mm256_or_si256(gen, _mm256_and_si256(pro, _mm256_srlv_epi64(gen, s1)));
+  pro = _mm256_and_si256(pro, _mm256_srlv_epi64(pro, s1));
+  gen = _mm256_or_si256(gen, _mm256_and_si256(pro, _mm256_srlv_epi64(gen, s2)));
+  pro = _mm256_and_si256(pro, _mm256_srlv_epi64(pro, s2));
+  gen = _mm256_or_si256(gen, _mm256_and_si256(pro, _mm256_srlv_epi64(gen, s4)));
+  a = _mm256_or_si256(a, _mm256_and_si256(_mm256_srlv_epi64(gen, s1),
+        rightMask));
+
+  // Union of the four lanes
+  __m128i x = _mm_or_si128(_mm256_castsi256_si128(a),
+      _mm256_extracti128_si256(a, 1));
+  x = _mm_or_si128(x, _mm_unpackhi_epi64(x, x));
+  return (U64)_mm_cvtsi128_si64(x);
+}
+
+#endif
+
+typedef U64 (*SlidingAttacksFn)(U64, U64, U64);
+
+// Picks the fastest implementation the CPU supports.
+static SlidingAttacksFn chooseSlidingAttacks() {
+#ifdef TCHESS_HAVE_AVX2_PATH
+  __builtin_cpu_init();
+  if (__builtin_cpu_supports("avx2"))
+    return slidingAttacksAVX2;
+#endif
+  return slidingAttacksScalar;
+}
+
+// The implementation is chosen on the first call rather than during static
+// initialization, so that positions may be used from other static
+// initializers.
+U64 slidingAttacksSetwise(U64 orthogonal, U64 diagonal, U64 empty) {
+  static const SlidingAttacksFn impl = chooseSlidingAttacks();
+  return impl(orthogonal, diagonal, empty);
+}
@@ -0,0 +1,237 @@
+#include "batch.h"
+#include "attacks.h"
+#include "position.h"
+#include "types.h"
+
+#include <cstring>
+
+// Eight bitboards, one per position in a group. The compiler maps operations
+// on these to whichever vector instructions the target has.
+typedef U64 U64x8 __attribute__((vector_size(64)));
+
+#define BATCH_INLINE static inline __attribute__((always_inline))
+
+BATCH_INLINE U64x8 load8(const U64* p) {
+  U64x8 v;
+  memcpy(&v, p, sizeof(v));
+  return v;
+}
+
+BATCH_INLINE void store8(U64* p, U64x8 v) {
+  memcpy(p, &v, sizeof(v));
+}
+
+// Occluded fills, as in attacks.cpp, but for eight positions at once.
+BATCH_INLINE U64x8 fillLeft8(U64x8 gen, U64x8 pro, int s, U64 mask) {
+  pro &= mask;
+  gen |= pro & (gen << s);
+  pro &= pro << s;
+  gen |= pro & (gen << (2*s));
+  pro &= pro << (2*s);
+  gen |= pro & (gen << (4*s));
+  return (gen << s) & mask;
+}
+
+BATCH_INLINE U64x8 fillRight8(U64x8 gen, U64x8 pro, int s, U64 mask) {
+  pro &= mask;
+  gen |= pro & (gen >> s);
+  pro &= pro >> s;
+  gen |= pro & (gen >> (2*s));
+  pro &= pro >> (2*s);
+  gen |= pro & (gen >> (4*s));
+  return (gen >> s) & mask;
+}
+
+// Attacks of one side, whose bitboards start at own (king first, as in the
+// Piece enum).
+BATCH_INLINE U64x8 sideAttacks8(const U64x8* own, U64x8 empty, bool white) {
+  U64x8 orth = own[W_ROOK] | own[W_QUEEN];
+  U64x8 diag = own[W_BISHOP] | own[W_QUEEN];
+  U64x8 a = fillLeft8(orth, empty, 8, ~0ULL)
+    | fillRight8(orth, empty, 8, ~0ULL)
+    | fillLeft8(orth, empty, 1, NOT_FILE_A)
+    | fillRight8(orth, empty, 1, NOT_FILE_H)
+    | fillLeft8(diag, empty, 9, NOT_FILE_A)
+    | fillLeft8(diag, empty, 7, NOT_FILE_H)
+    | fillRight8(diag, empty, 7, NOT_FILE_A)
+    | fillRight8(diag, empty, 9, NOT_FILE_H);
+
+  // Knights
+  U64x8 n = own[W_KNIGHT];
+  U64x8 h1 = ((n >> 1) & NOT_FILE_H) | ((n << 1) & NOT_FILE_A);
+  U64x8 h2 = ((n >> 2) & NOT_FILE_GH) | ((n << 2) & NOT_FILE_AB);
+  a |= (h1 << 16) | (h1 >> 16) | (h2 << 8) | (h2 >> 8);
+
+  // Kings
+  U64x8 k = own[W_KING];
+  U64x8 side = ((k << 1) & NOT_FILE_A) | ((k >> 1) & NOT_FILE_H);
+  k |= side;
+  a |= side | (k << 8) | (k >> 8);
+
+  // Pawns
+  U64x8 p = own[W_PAWN];
+  if (white)
+    a |= ((p << 7) & NOT_FILE_H) | ((p << 9) & NOT_FILE_A);
+  else
+    a |= ((p >> 9) & NOT_FILE_H) | ((p >> 7) & NOT_FILE_A);
+  return a;
+}
+
+// Computes occupancy and both sides' attack maps for n positions, where n is a
+// multiple of eight. Inlined into each kernel below, which compiles it for
+// its instruction set.
+BATCH_INLINE void computeBatchAttacksBody(const U64* const* bbs, size_t n,
+    U64* occupied, U64* whiteAttacks, U64* blackAttacks) {
+  for (size_t i = 0; i < n; i += PositionBatch::LANES) {
+    U64x8 b[12];
+    U64x8 occ = {};
+    for (int j = 0; j < 12; j++) {
+      b[j] = load8(bbs[j] + i);
+      occ |= b[j];
+    }
+    U64x8 empty = ~occ;
+    store8(occupied + i, occ);
+    store8(whiteAttacks + i, sideAttacks8(b, empty, true));
+    store8(blackAttacks + i, sideAttacks8(b + 6, empty, false));
+  }
+}
+
+// Compiled once per instruction set and dispatched by the loader.
+#if defined(__x86_64__) && defined(__GNUC__)
+#define TCHESS_HAVE_BATCH_CLONES
+__attribute__((target_clones("avx512f", "avx2", "default")))
+#endif
+void computeBatchAttacks(const U64* const* bbs, size_t n, U64* occupied,
+    U64* whiteAttacks, U64* blackAttacks) {
+  computeBatchAttacksBody(bbs, n, occupied, whiteAttacks, blackAttacks);
+}
+
+// The same code for one chosen instruction set, so that the tests can check
+// every variant the CPU can run, not only the one the loader picks.
+#ifdef TCHESS_HAVE_BATCH_CLONES
+__attribute__((target("avx512f")))
+static void computeBatchAttacksAVX512(const U64* const* bbs, size_t n,
+    U64* occupied, U64* whiteAttacks, U64* blackAttacks) {
+  computeBatchAttacksBody(bbs, n, occupied, whiteAttacks, blackAttacks);
+}
+
+__attribute__((target("avx2")))
+static void computeBatchAttacksAVX2(const U64* const* bbs, size_t n,
+    U64* occupied, U64* whiteAttacks, U64* blackAttacks) {
+  computeBatchAttacksBody(bbs, n, occupied, whiteAttacks, blackAttacks);
+}
+#endif
+
+static void computeBatchAttacksGeneric(const U64* const* bbs, size_t n,
+    U64* occupied, U64* whiteAttacks, U64* blackAttacks) {
+  computeBatchAttacksBody(bbs, n, occupied, whiteAttacks, blackAttacks);
+}
+
+// Returns true if the CPU can run the kernel.
+bool PositionBatch::isKernelSupported(Kernel kernel) {
+#ifdef TCHESS_HAVE_BATCH_CLONES
+  __builtin_cpu_init();
+  if (kernel == AVX512)
+    return __builtin_cpu_supports("avx512f");
+  if (kernel == AVX2)
+    return __builtin_cpu_supports("avx2");
+  return true;
+#else
+  return kernel == AUTO || kernel == GENERIC;
+#endif
+}
+
+PositionBatch::PositionBatch() {
+}
+
+// Removes every position.
+void PositionBatch::clear() {
+  for (int i = 0; i < 12; i++)
+    bbs[i].clear();
+  flags.clear();
+  players.clear();
+  clocks.clear();
+}
+
+// Appends a copy of the position.
+void PositionBatch::add(Position& p) {
+  for (int i = 0; i < 12; i++)
+    bbs[i].push_back(p.bbs[i]);
+  flags.push_back(p.flags);
+  players.push_back(p.player);
+  clocks.push_back(p.clock);
+}
+
+size_t PositionBatch::size() {
+  return players.size();
+}
+
+// Computes the results for every position. Legal moves are only counted if
+// countMoves is true. The attack maps are computed with the given kernel,
+// which the CPU must support, or by default with the best it supports.
+void PositionBatch::compute(bool countMoves, Kernel kernel) {
+  size_t n = size();
+  size_t padded = (n + LANES - 1) / LANES * LANES;
+
+  // Pad the inputs with empty boards so every group is complete
+  const U64* columns[12];
+  for (int i = 0; i < 12; i++) {
+    bbs[i].resize(padded, 0);
+    columns[i] = bbs[i].data();
+  }
+  occupied.resize(padded);
+  attacks[0].resize(padded);
+  attacks[1].resize(padded);
+  void (*fn)(const U64* const*, size_t, U64*, U64*, U64*) =
+    computeBatchAttacks;
+#ifdef TCHESS_HAVE_BATCH_CLONES
+  if (kernel == AVX512)
+    fn = computeBatchAttacksAVX512;
+  else if (kernel == AVX2)
+    fn = computeBatchAttacksAVX2;
+#endif
+  if (kernel == GENERIC)
+    fn = computeBatchAttacksGeneric;
+  fn(columns, padded, occupied.data(), attacks[0].data(), attacks[1].data());
+  for (int i = 0; i < 12; i++)
+    bbs[i].resize(n);
+
+  // A side is in check if its king is attacked by the other side
+  check.resize(n);
+  for (size_t i = 0; i < n; i++) {
+    int c = players[i];
+    U64 king = bbs[6*c + W_KING][i];
+    check[i] = (king & attacks[1 - c][i]) != 0;
+  }
+
+  moveCounts.assign(n, 0);
+  if (!countMoves)
+    return;
+  Position p;
+  for (size_t i = 0; i < n; i++) {
+    for (int j = 0; j < 12; j++)
+      p.bbs[j] = bbs[j][i];
+    p.flags = flags[i];
+    p.player = players[i];
+    p.clock = clocks[i];
+    moveCounts[i] = p.countLegalMoves();
+  }
+}
+
+U64 PositionBatch::getOccupied(size_t i) {
+  return occupied[i];
+}
+
+// Returns the squares attacked by the given side.
+U64 PositionBatch::getAttacks(size_t i, Color c) {
+  return attacks[c][i];
+}
+
+// Returns true if the side to move is in check.
+bool PositionBatch::inCheck(size_t i) {
+  return check[i];
+}
+
+int PositionBatch::getLegalMoveCount(size_t i) {
+  return moveCounts[i];
+}
@@ -0,0 +1,238 @@
+#include "datagen.h"
+#include "arena.h"
+#include "match.h"
+#include "position.h"
+#include "search.h"
+#include "types.h"
+#include "move.h"
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <fstream>
+#include <iomanip>
+#include <iostream>
+#include <memory>
+#include <mutex>
+#include <random>
+#include <thread>
+#include <vector>
+
+// Records each thread collects before writing them out (2 MB)
+static const size_t BUFFER_RECORDS = 1 << 16;
+
+// Packs the position with its label. score is from the point of view of the
+// player to move, result is 1, 0 or -1 for a white win, draw or black win.
+PackedPosition PackedPosition::pack(Position& p, int score, int result,
+    int ply) {
+  PackedPosition pp = {};
+  pp.occupied = p.getOccupied();
+  int i = 0;
+  for (U64 b = pp.occupied; b != 0; b &= b - 1, i++)
+    pp.pieces[i / 2] |= p.getPiece(Position::bitscan(b)) << (4 * (i % 2));
+  pp.score = (p.getPlayer() == Color::WHITE) ? score : -score;
+  pp.result = result + 1;
+  pp.flags = p.flags;
+  pp.player = p.player;
+  pp.clock = std::min((int)p.clock, 255);
+  pp.ply = std::min(ply, 65535);
+  return pp;
+}
+
+// Fills in the twelve piece bitboards, indexed by Piece.
+void PackedPosition::getBitboards(U64* bbs) {
+  for (int i = 0; i < 12; i++)
+    bbs[i] = 0;
+  int i = 0;
+  for (U64 b = occupied; b != 0; b &= b - 1, i++) {
+    int piece = (pieces[i / 2] >> (4 * (i % 2))) & 0x0f;
+    bbs[piece] |= b & -b;
+  }
+}
+
+// Sets up the position which was packed.
+void PackedPosition::unpack(Position& p) {
+  getBitboards(p.bbs);
+  p.flags = flags;
+  p.player = (Color)player;
+  p.clock = clock;
+  p.key = p.computeKey();
+  p.pawnKey = p.computePawnKey();
+  if (p.accumulator)
+    p.accumulator->refresh(p.bbs);
+}
+
+// Plays random moves from the starting position. Returns false if the game
+// ended on the way.
+static bool playRandomOpening(Position& p, int plies, std::mt19937_64& rng,
+    std::vector<U64>& keys) {
+  p.initPieces();
+  keys.clear();
+  for (int i = 0; i < plies; i++) {
+    std::vector<Move> moves = p.getLegalMoves();
+    if (moves.empty())
+      return false;
+    keys.push_back(p.getKey());
+    p.makeMove(moves[rng() % moves.size()]);
+  }
+  return p.hasLegalMove();
+}
+
+// Plays one game against itself and appends its quiet positions, labeled
+// with the result, to positions. Returns the result for white.
+static int playSelfPlayGame(DatagenOptions& opt, Search& search,
+    std::mt19937_64& rng, std::vector<U64>& keys,
+    ArenaVector<PackedPosition>& positions) {
+  Position p;
+  while (!playRandomOpening(p, opt.randomPlies, rng, keys))
+    ;
+  search.newGame();
+  size_t first = positions.size();
+  int result = 0;
+  int winning = 0;  // plies in a row with a decisive score, + white, - black
+
+  for (int ply = opt.randomPlies;; ply++) {
+    std::vector<Move> moves = p.getLegalMoves();
+    if (moves.empty()) {
+      if (p.inCheck())
+        result = (p.getPlayer() == Color::WHITE) ? -1 : 1;
+      break;
+    }
+    if (p.getClock() >= 100 || isThreefoldRepetition(p, keys)
+        || isInsufficientMaterial(p) || ply >= opt.maxPlies)
+      break;
+
+    SearchLimits limits;
+    limits.nodes = opt.nodes;
+    limits.depth = opt.depth;
+    SearchResult r = search.think(p, limits, keys);
+    int m = Search::findPackedMove(Search::packMove(r.best), moves);
+    if (m == -1)
+      m = 0;
+    Move& best = moves[m];
+
+    if (!p.inCheck() && !best.isCapture()
+        && best.getPromotedPiece() == NO_PIECE
+        && !Search::isMateScore(r.score))
+      positions.push_back(PackedPosition::pack(p, r.score, 0, ply));
+
+    // Stop once one side has been clearly winning for a while
+    int whiteScore = (p.getPlayer() == Color::WHITE) ? r.score : -r.score;
+    if (whiteScore >= opt.winScore)
+      winning = std::max(winning, 0) + 1;
+    else if (whiteScore <= -opt.winScore)
+      winning = std::min(winning, 0) - 1;
+    else
+      winning = 0;
+    if (std::abs(winning) >= opt.winPlies) {
+      result = (winning > 0) ? 1 : -1;
+      break;
+    }
+
+    keys.push_back(p.getKey());
+    p.makeMove(best);
+  }
+
+  for (size_t i = first; i < positions.size(); i++)
+    positions[i].result = result + 1;
+  return result;
+}
+
+int runDatagen(DatagenOptions& opt) {
+  std::ofstream out(opt.outputFile, std::ios::binary | std::ios::app);
+  if (!out.is_open()) {
+    std::cout << "Cannot write " << opt.outputFile << std::endl;
+    return 1;
+  }
+  int numThreads = std::max(1, opt.threads);
+  std::cout << "Generating " << opt.games << " games on " << numThreads
+    << " threads, " << opt.nodes << " nodes per move, into "
+    << opt.outputFile << std::endl;
+
+  std::mutex outMutex;
+  std::atomic<U64> next(0);
+  std::atomic<U64> gamesDone(0), written(0);
+  std::atomic<U64> results[3] = {{0}, {0}, {0}};
+  auto start = std::chrono::steady_clock::now();
+  double lastReport = 0;
+
+  auto elapsed = [&]() {
+    std::chrono::duration<double> d = std::chrono::steady_clock::now() - start;
+    return d.count();
+  };
+
+  // Writes a thread's buffer in one piece
+  auto flush = [&](std::vector<PackedPosition>& buffer) {
+    if (buffer.empty())
+      return;
+    std::lock_guard<std::mutex> lock(outMutex);
+    out.write((const char*)buffer.data(),
+        buffer.size() * sizeof(PackedPosition));
+    written += buffer.size();
+    buffer.clear();
+
+    if (elapsed() - lastReport >= 10) {
+      lastReport = elapsed();
+      std::cout << std::fixed << std::setprecision(0) << gamesDone
+        << " games, " << written << " positions, "
+        << written / lastReport * 3600 << " positions/hour" << std::endl;
+    }
+  };
+
+  std::vector<std::thread> workers;
+  for (int t = 0; t < numThreads; t++) {
+    workers.push_back(std::thread([&]() {
+      SearchOptions so;
+      so.hashMB = opt.hashMB;
+      std::unique_ptr<Search> search(new Search(so));
+      Arena& arena = Arena::forThread();
+      std::vector<U64> keys;
+      std::vector<PackedPosition> buffer;
+      buffer.reserve(BUFFER_RECORDS);
+
+      for (U64 g = next++; g < opt.games; g = next++) {
+        // Each game has its own seed, so the openings do not depend on the
+        // number of threads
+        std::mt19937_64 rng(opt.seed * 0x9e3779b97f4a7c15ULL + g);
+        arena.reset();
+        ArenaVector<PackedPosition> positions{
+          ArenaAllocator<PackedPosition>(arena)};
+        positions.reserve(opt.maxPlies);
+        int result = playSelfPlayGame(opt, *search, rng, keys, positions);
+        results[result + 1]++;
+        gamesDone++;
+
+        buffer.insert(buffer.end(), positions.begin(), positions.end());
+        if (buffer.size() >= BUFFER_RECORDS)
+          flush(buffer);
+      }
+      flush(buffer);
+    }));
+  }
+  for (unsigned int t = 0; t < workers.size(); t++)
+    workers[t].join();
+
+  double seconds = elapsed();
+  std::cout << std::fixed << std::setprecision(1) << "Wrote " << written
+    << " positions from " << gamesDone << " games in " << seconds << "s ("
+    << std::setprecision(0) << written / seconds * 3600
+    << " positions/hour). White won " << results[2] << ", drew "
+    << results[1] << ", lost " << results[0] << "." << std::endl;
+  return 0;
+}
+
+// Reads every record in the file. Returns false if it cannot be read or is
+// not a whole number of records.
+bool loadPackedPositions(std::string path,
+    std::vector<PackedPosition>& positions) {
+  std::ifstream in(path, std::ios::binary | std::ios::ate);
+  if (!in.is_open())
+    return false;
+  std::streamsize bytes = in.tellg();
+  if (bytes < 0 || bytes % sizeof(PackedPosition) != 0)
+    return false;
+  in.seekg(0);
+  size_t first = positions.size();
+  positions.resize(first + bytes / sizeof(PackedPosition));
+  return (bool)in.read((char*)(positions.data() + first), bytes);
+}
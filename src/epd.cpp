@@ -0,0 +1,101 @@
+#include "epd.h"
+
+#include <cctype>
+#include <fstream>
+#include <sstream>
+
+// Returns the operand of the named operation without quotes, or an empty
+// string if the entry has no such operation.
+std::string EPDEntry::getOperation(std::string name) {
+  for (auto& op : operations)
+    if (op.first == name)
+      return op.second;
+  return "";
+}
+
+static bool isNumber(std::string s) {
+  if (s.empty())
+    return false;
+  for (char c : s)
+    if (!isdigit((unsigned char)c))
+      return false;
+  return true;
+}
+
+static std::string trim(std::string s) {
+  size_t first = s.find_first_not_of(" \t\r\n");
+  if (first == std::string::npos)
+    return "";
+  size_t last = s.find_last_not_of(" \t\r\n");
+  return s.substr(first, last - first + 1);
+}
+
+// Parses a single line. Returns false if it does not hold a position.
+bool parseEPDLine(std::string line, EPDEntry& entry) {
+  line = trim(line);
+  if (line.empty() || line[0] == '#')
+    return false;
+
+  std::istringstream in(line);
+  std::string fields[4];
+  for (int i = 0; i < 4; i++)
+    if (!(in >> fields[i]))
+      return false;
+  entry.fen = fields[0] + " " + fields[1] + " " + fields[2] + " " + fields[3];
+  entry.operations.clear();
+
+  // Clocks of a full FEN, otherwise the defaults
+  std::string rest;
+  std::getline(in, rest);
+  rest = trim(rest);
+  std::istringstream clocks(rest);
+  std::string halfmove, fullmove;
+  clocks >> halfmove >> fullmove;
+  if (isNumber(halfmove) && isNumber(fullmove)) {
+    entry.fen += " " + halfmove + " " + fullmove;
+    rest.clear();
+    std::getline(clocks, rest);
+  }
+  else
+    entry.fen += " 0 1";
+
+  // Operations are an opcode followed by operands up to a ';', which may be
+  // part of a quoted string. The last ';' may be missing.
+  rest += ";";
+  std::string op;
+  bool quoted = false;
+  for (char c : rest) {
+    if (c == '"')
+      quoted = !quoted;
+    if (c == ';' && !quoted) {
+      op = trim(op);
+      if (!op.empty()) {
+        size_t space = op.find_first_of(" \t");
+        std::string name = op.substr(0, space);
+        std::string value = (space == std::string::npos) ? ""
+          : trim(op.substr(space));
+        if (value.size() >= 2 && value.front() == '"' && value.back() == '"')
+          value = value.substr(1, value.size() - 2);
+        entry.operations.push_back({name, value});
+      }
+      op.clear();
+    }
+    else
+      op += c;
+  }
+  return true;
+}
+
+// Reads every position in the file. Returns false if it cannot be read.
+bool loadEPD(std::string path, std::vector<EPDEntry>& entries) {
+  std::ifstream file(path);
+  if (!file.is_open())
+    return false;
+  std::string line;
+  while (std::getline(file, line)) {
+    EPDEntry entry;
+    if (parseEPDLine(line, entry))
+      entries.push_back(entry);
+  }
+  return true;
+}
@@ -0,0 +1,334 @@
+#include "eval.h"
+#include "attacks.h"
+#include "position.h"
+#include "types.h"
+
+#include <cstring>
+#include <fstream>
+#include <iomanip>
+#include <iostream>
+
+/* Piece-square tables from white's point of view, written with the eighth
+ * rank at the top so they read like a board. A white piece on square sq uses
+ * entry sq ^ 56, and a black piece uses entry sq.
+ */
+static const int PAWN_TABLE[64] = {
+   0,  0,  0,  0,  0,  0,  0,  0,
+  50, 50, 50, 50, 50, 50, 50, 50,
+  10, 10, 20, 30, 30, 20, 10, 10,
+   5,  5, 10, 25, 25, 10,  5,  5,
+   0,  0,  0, 20, 20,  0,  0,  0,
+   5, -5,-10,  0,  0,-10, -5,  5,
+   5, 10, 10,-20,-20, 10, 10,  5,
+   0,  0,  0,  0,  0,  0,  0,  0
+};
+
+static const int KNIGHT_TABLE[64] = {
+  -50,-40,-30,-30,-30,-30,-40,-50,
+  -40,-20,  0,  0,  0,  0,-20,-40,
+  -30,  0, 10, 15, 15, 10,  0,-30,
+  -30,  5, 15, 20, 20, 15,  5,-30,
+  -30,  0, 15, 20, 20, 15,  0,-30,
+  -30,  5, 10, 15, 15, 10,  5,-30,
+  -40,-20,  0,  5,  5,  0,-20,-40,
+  -50,-40,-30,-30,-30,-30,-40,-50
+};
+
+static const int BISHOP_TABLE[64] = {
+  -20,-10,-10,-10,-10,-10,-10,-20,
+  -10,  0,  0,  0,  0,  0,  0,-10,
+  -10,  0,  5, 10, 10,  5,  0,-10,
+  -10,  5,  5, 10, 10,  5,  5,-10,
+  -10,  0, 10, 10, 10, 10,  0,-10,
+  -10, 10, 10, 10, 10, 10, 10,-10,
+  -10,  5,  0,  0,  0,  0,  5,-10,
+  -20,-10,-10,-10,-10,-10,-10,-20
+};
+
+static const int ROOK_TABLE[64] = {
+   0,  0,  0,  0,  0,  0,  0,  0,
+   5, 10, 10, 10, 10, 10, 10,  5,
+  -5,  0,  0,  0,  0,  0,  0, -5,
+  -5,  0,  0,  0,  0,  0,  0, -5,
+  -5,  0,  0,  0,  0,  0,  0, -5,
+  -5,  0,  0,  0,  0,  0,  0, -5,
+  -5,  0,  0,  0,  0,  0,  0, -5,
+   0,  0,  0,  5,  5,  0,  0,  0
+};
+
+static const int QUEEN_TABLE[64] = {
+  -20,-10,-10, -5, -5,-10,-10,-20,
+  -10,  0,  0,  0,  0,  0,  0,-10,
+  -10,  0,  5,  5,  5,  5,  0,-10,
+   -5,  0,  5,  5,  5,  5,  0, -5,
+    0,  0,  5,  5,  5,  5,  0, -5,
+  -10,  5,  5,  5,  5,  5,  0,-10,
+  -10,  0,  5,  0,  0,  0,  0,-10,
+  -20,-10,-10, -5, -5,-10,-10,-20
+};
+
+static const int KING_MIDDLEGAME_TABLE[64] = {
+  -30,-40,-40,-50,-50,-40,-40,-30,
+  -30,-40,-40,-50,-50,-40,-40,-30,
+  -30,-40,-40,-50,-50,-40,-40,-30,
+  -30,-40,-40,-50,-50,-40,-40,-30,
+  -20,-30,-30,-40,-40,-30,-30,-20,
+  -10,-20,-20,-20,-20,-20,-20,-10,
+   20, 20,  0,  0,  0,  0, 20, 20,
+   20, 30, 10,  0,  0, 10, 30, 20
+};
+
+static const int KING_ENDGAME_TABLE[64] = {
+  -50,-40,-30,-20,-20,-30,-40,-50,
+  -30,-20,-10,  0,  0,-10,-20,-30,
+  -30,-10, 20, 30, 30, 20,-10,-30,
+  -30,-10, 30, 40, 40, 30,-10,-30,
+  -30,-10, 30, 40, 40, 30,-10,-30,
+  -30,-10, 20, 30, 30, 20,-10,-30,
+  -30,-30,  0,  0,  0,  0,-30,-30,
+  -50,-30,-30,-30,-30,-30,-30,-50
+};
+
+// Passed pawns by rank, counted from the pawn's own side
+static const int PASSED_PAWN[8] = {0, 5, 10, 20, 35, 60, 100, 0};
+
+// Weak pawns
+static const int ISOLATED_PAWN = -15;
+static const int DOUBLED_PAWN = -10;
+static const int BACKWARD_PAWN = -8;
+
+// Pawns one and two ranks in front of a king on its first rank
+static const int PAWN_SHIELD[2] = {10, 5};
+
+// Tables indexed as a white Piece, the king's being the middlegame one
+static const int* const TABLES[6] = {KING_MIDDLEGAME_TABLE, QUEEN_TABLE,
+  ROOK_TABLE, BISHOP_TABLE, KNIGHT_TABLE, PAWN_TABLE};
+
+EvalParams evalParams = defaultEvalParams();
+
+// Returns the hand written parameters above.
+EvalParams defaultEvalParams() {
+  EvalParams params;
+  for (int type = 0; type < 6; type++) {
+    params[PARAM_PIECE_VALUES + type] = PIECE_VALUES[type];
+    for (int sq = 0; sq < 64; sq++)
+      params[PARAM_TABLES + 64*type + sq] = TABLES[type][sq];
+  }
+  for (int sq = 0; sq < 64; sq++)
+    params[PARAM_KING_ENDGAME + sq] = KING_ENDGAME_TABLE[sq];
+  for (int rank = 0; rank < 8; rank++)
+    params[PARAM_PASSED + rank] = PASSED_PAWN[rank];
+  params[PARAM_ISOLATED] = ISOLATED_PAWN;
+  params[PARAM_DOUBLED] = DOUBLED_PAWN;
+  params[PARAM_BACKWARD] = BACKWARD_PAWN;
+  for (int i = 0; i < 2; i++)
+    params[PARAM_SHIELD + i] = PAWN_SHIELD[i];
+  return params;
+}
+
+// Returns a readable name for the parameter, eg "knight a1" or "value rook".
+std::string evalParamName(int i) {
+  static const char* names[6] = {"king", "queen", "rook", "bishop", "knight",
+    "pawn"};
+  if (i < PARAM_TABLES)
+    return std::string("value ") + names[i - PARAM_PIECE_VALUES];
+  if (i >= PARAM_SHIELD)
+    return "pawn shield " + std::to_string(i - PARAM_SHIELD + 1);
+  if (i == PARAM_ISOLATED)
+    return "isolated pawn";
+  if (i == PARAM_DOUBLED)
+    return "doubled pawn";
+  if (i == PARAM_BACKWARD)
+    return "backward pawn";
+  if (i >= PARAM_PASSED)
+    return "passed pawn rank " + std::to_string(i - PARAM_PASSED + 1);
+
+  // Tables are written with the eighth rank first
+  int table = (i < PARAM_KING_ENDGAME) ? (i - PARAM_TABLES) / 64 : 6;
+  int sq = ((i - PARAM_TABLES) % 64) ^ 56;
+  std::string square = std::string(1, 'a' + sq % 8) + (char)('1' + sq / 8);
+  if (table == 6)
+    return "king endgame " + square;
+  if (table == 0)
+    return "king middlegame " + square;
+  return std::string(names[table]) + " " + square;
+}
+
+// Reads parameters written by saveEvalParams. Returns false if the file cannot
+// be read or does not hold every parameter.
+bool loadEvalParams(std::string path, EvalParams& params) {
+  std::ifstream in(path);
+  if (!in.is_open())
+    return false;
+  EvalParams loaded;
+  for (int i = 0; i < NUM_EVAL_PARAMS; i++)
+    if (!(in >> loaded[i]))
+      return false;
+  params = loaded;
+  return true;
+}
+
+// Writes the parameters as whitespace separated numbers, in the same layout
+// as the tables above.
+bool saveEvalParams(std::string path, EvalParams& params) {
+  std::ofstream out(path);
+  if (!out.is_open())
+    return false;
+  for (int i = 0; i < PARAM_TABLES; i++)
+    out << params[i] << (i + 1 < PARAM_TABLES ? " " : "\n");
+  for (int i = PARAM_TABLES; i < PARAM_PASSED; i++) {
+    out << std::setw(4) << params[i];
+    int col = (i - PARAM_TABLES) % 64;
+    out << ((col % 8 == 7) ? "\n" : " ");
+    if (col == 63)
+      out << "\n";
+  }
+  for (int i = PARAM_PASSED; i < PARAM_ISOLATED; i++)
+    out << std::setw(4) << params[i] << (i + 1 < PARAM_ISOLATED ? " " : "\n");
+  for (int i = PARAM_ISOLATED; i < NUM_EVAL_PARAMS; i++)
+    out << std::setw(4) << params[i] << (i + 1 < NUM_EVAL_PARAMS ? " " : "\n");
+  return (bool)out;
+}
+
+// Prints the parameters as C++ which can replace the tables above.
+void printEvalParams(EvalParams& params) {
+  static const char* names[7] = {"KING_MIDDLEGAME_TABLE", "QUEEN_TABLE",
+    "ROOK_TABLE", "BISHOP_TABLE", "KNIGHT_TABLE", "PAWN_TABLE",
+    "KING_ENDGAME_TABLE"};
+  std::cout << "const int PIECE_VALUES[6] = {";
+  for (int i = 0; i < 6; i++)
+    std::cout << params[PARAM_PIECE_VALUES + i] << (i < 5 ? ", " : "};\n");
+  for (int t = 0; t < 7; t++) {
+    std::cout << "\nstatic const int " << names[t] << "[64] = {\n";
+    for (int sq = 0; sq < 64; sq++) {
+      if (sq % 8 == 0)
+        std::cout << "  ";
+      std::cout << std::setw(3) << params[PARAM_TABLES + 64*t + sq]
+        << (sq < 63 ? "," : "");
+      if (sq % 8 == 7)
+        std::cout << "\n";
+    }
+    std::cout << "};\n";
+  }
+  std::cout << "\nstatic const int PASSED_PAWN[8] = {";
+  for (int i = 0; i < 8; i++)
+    std::cout << params[PARAM_PASSED + i] << (i < 7 ? ", " : "};\n");
+  std::cout << "\nstatic const int ISOLATED_PAWN = " << params[PARAM_ISOLATED]
+    << ";\nstatic const int DOUBLED_PAWN = " << params[PARAM_DOUBLED]
+    << ";\nstatic const int BACKWARD_PAWN = " << params[PARAM_BACKWARD]
+    << ";\n\nstatic const int PAWN_SHIELD[2] = {" << params[PARAM_SHIELD]
+    << ", " << params[PARAM_SHIELD + 1] << "};\n";
+  std::cout << std::flush;
+}
+
+// Counts the pawn terms for the given white and black pawns.
+void computePawnFeatures(U64 whitePawns, U64 blackPawns, PawnFeatures& f) {
+  memset(&f, 0, sizeof(f));
+  const U64 pawns[2] = {whitePawns, blackPawns};
+  for (int color = 0; color < 2; color++) {
+    int sign = (color == WHITE) ? 1 : -1;
+    U64 own = pawns[color];
+    U64 enemy = pawns[1 - color];
+    U64 enemyAttacks = (color == WHITE) ? blackPawnAttacksSetwise(enemy)
+      : whitePawnAttacksSetwise(enemy);
+
+    for (U64 b = own; b != 0; b &= b - 1) {
+      int sq = Position::bitscan(b);
+      int rank = (color == WHITE) ? sq / 8 : 7 - sq / 8;
+      U64 file = FILE_A << (sq % 8);
+      U64 adjacent = ((file << 1) & NOT_FILE_A) | ((file >> 1) & NOT_FILE_H);
+
+      // Squares on later ranks, from this pawn's side
+      U64 ahead;
+      if (color == WHITE)
+        ahead = (sq / 8 == 7) ? 0 : ~0ULL << (8 * (sq / 8 + 1));
+      else
+        ahead = (sq / 8 == 0) ? 0 : ~0ULL >> (8 * (8 - sq / 8));
+
+      bool doubled = (own & file & ahead) != 0;
+      if (doubled)
+        f.counts[PARAM_DOUBLED - PARAM_PASSED] += sign;
+      if (!doubled && !(enemy & (file | adjacent) & ahead))
+        f.counts[rank] += sign;
+      if (!(own & adjacent))
+        f.counts[PARAM_ISOLATED - PARAM_PASSED] += sign;
+      else if (!(own & adjacent & ~ahead)) {
+        // No neighbor level with it or behind to support its advance, and an
+        // enemy pawn guards the square in front
+        int stop = (color == WHITE) ? sq + 8 : sq - 8;
+        if (stop >= 0 && stop < 64 && (enemyAttacks & (ONE << stop)))
+          f.counts[PARAM_BACKWARD - PARAM_PASSED] += sign;
+      }
+    }
+
+    // Shields of a king on each file of the first rank
+    U64 near[2] = {(color == WHITE) ? RANK_1 << 8 : RANK_8 >> 8,
+      (color == WHITE) ? RANK_3 : RANK_6};
+    for (int kf = 0; kf < 8; kf++) {
+      U64 file = FILE_A << kf;
+      U64 files = file | ((file << 1) & NOT_FILE_A) | ((file >> 1) & NOT_FILE_H);
+      for (int i = 0; i < 2; i++)
+        f.shield[color][kf][i] = Position::popcount(own & files & near[i]);
+    }
+  }
+}
+
+PawnHashTable::PawnHashTable(int bits) {
+  entries.resize((size_t)1 << bits);
+  mask = entries.size() - 1;
+  clear();
+}
+
+// Empties the table. Empty slots have key 0, which is also the key of having
+// no pawns, so the features of an empty slot are those of no pawns.
+void PawnHashTable::clear() {
+  for (unsigned int i = 0; i < entries.size(); i++)
+    memset(&entries[i], 0, sizeof(Entry));
+}
+
+// Returns the features of the pawns with the given key, counting them if they
+// are not in the table.
+const PawnFeatures& PawnHashTable::probe(U64 key, U64 whitePawns,
+    U64 blackPawns) {
+  probes++;
+  Entry& e = entries[key & mask];
+  if (e.key == key) {
+    hits++;
+    return e.features;
+  }
+  e.key = key;
+  computePawnFeatures(whitePawns, blackPawns, e.features);
+  return e.features;
+}
+
+U64 PawnHashTable::getHits() {
+  return hits;
+}
+
+U64 PawnHashTable::getProbes() {
+  return probes;
+}
+
+// The table of the calling thread
+PawnHashTable& PawnHashTable::forThread() {
+  thread_local PawnHashTable table;
+  return table;
+}
+
+// Evaluates with the network if the position keeps an accumulator, and with
+// the parameters otherwise.
+int evaluate(Position& p) {
+  if (p.getAccumulator())
+    return p.getAccumulator()->evaluate(p.getPlayer());
+  U64 bbs[12];
+  for (int i = 0; i < 12; i++)
+    bbs[i] = p.getBitboard((Piece)i);
+  const PawnFeatures& pawns = PawnHashTable::forThread().probe(p.getPawnKey(),
+      bbs[W_PAWN], bbs[B_PAWN]);
+  long long score = 0;
+  forEachEvalTerm(bbs, pawns, [&](int i, int weight) {
+    score += (long long)evalParams[i] * weight;
+  });
+  int s = score / EVAL_SCALE;
+  return (p.getPlayer() == WHITE) ? s : -s;
+}
@@ -0,0 +1,368 @@
+#include "match.h"
+#include "arena.h"
+#include "epd.h"
+#include "position.h"
+#include "search.h"
+#include "types.h"
+#include "move.h"
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cmath>
+#include <fstream>
+#include <iomanip>
+#include <iostream>
+#include <memory>
+#include <mutex>
+#include <sstream>
+#include <thread>
+#include <vector>
+
+static const std::string START_FEN =
+  "rnbqkbnr/pppppppp/8/8/8/8/PPPPPPPP/RNBQKBNR w KQkq - 0 1";
+
+// One finished game. result is 1 if white won, -1 if black won and 0 for a
+// draw. The moves live in the worker's arena, which is reset between games.
+struct GameRecord {
+  GameRecord(Arena& a) : moves(ArenaAllocator<Move>(a)) {}
+
+  int index;
+  std::string fen;
+  std::string white;
+  std::string black;
+  ArenaVector<Move> moves;
+  int result;
+  std::string reason;
+  size_t searchArenaPeak = 0;
+  U64 pawnHashHits = 0;
+  U64 pawnHashProbes = 0;
+};
+
+// Results of engine A against engine B
+struct MatchScore {
+  int wins = 0;
+  int losses = 0;
+  int draws = 0;
+
+  int games() { return wins + losses + draws; }
+  double score() { return (wins + 0.5 * draws) / games(); }
+};
+
+// Expected score of a player rated elo points above the opponent
+static double eloToScore(double elo) {
+  return 1 / (1 + std::pow(10, -elo / 400));
+}
+
+static double scoreToElo(double score) {
+  score = std::min(std::max(score, 0.0005), 0.9995);
+  return -400 * std::log10(1 / score - 1);
+}
+
+// Variance of the score of a single game
+static double scoreVariance(MatchScore& m) {
+  double s = m.score();
+  return (m.wins * (1 - s) * (1 - s) + m.losses * s * s
+    + m.draws * (0.5 - s) * (0.5 - s)) / m.games();
+}
+
+// Log likelihood ratio of H1 (elo1) against H0 (elo0), in the usual normal
+// approximation of the trinomial (win, draw, loss) model. Until A has both
+// gained and dropped points the variance is zero, so a draw is added to keep a
+// one sided match from never stopping.
+static double computeLLR(MatchScore m, double elo0, double elo1) {
+  if (m.games() == 0)
+    return 0;
+  if (m.wins + m.draws == 0 || m.losses + m.draws == 0)
+    m.draws++;
+  double var = scoreVariance(m);
+  if (var <= 0)
+    return 0;
+  double s0 = eloToScore(elo0), s1 = eloToScore(elo1);
+  return m.games() * (s1 - s0) * (2 * m.score() - s0 - s1) / (2 * var);
+}
+
+// Margin of the Elo estimate at 95% confidence
+static double eloMargin(MatchScore& m) {
+  if (m.games() == 0)
+    return 0;
+  double se = std::sqrt(scoreVariance(m) / m.games());
+  double s = m.score();
+  return (scoreToElo(s + 1.96 * se) - scoreToElo(s - 1.96 * se)) / 2;
+}
+
+// Returns true if neither player can possibly mate: bare kings, or a single
+// bishop or knight against a bare king.
+bool isInsufficientMaterial(Position& p) {
+  int pieces = Position::popcount(p.getOccupied());
+  if (pieces == 2)
+    return true;
+  if (pieces == 3)
+    return (p.getBitboard(W_BISHOP) | p.getBitboard(B_BISHOP)
+      | p.getBitboard(W_KNIGHT) | p.getBitboard(B_KNIGHT)) != 0;
+  return false;
+}
+
+// Returns true if the position has occurred twice before. keys holds the
+// earlier positions of the game, most recent last.
+bool isThreefoldRepetition(Position& p, std::vector<U64>& keys) {
+  int n = keys.size();
+  int oldest = std::max(0, n - (int)p.getClock());
+  int seen = 0;
+  for (int i = n - 2; i >= oldest; i -= 2)
+    if (keys[i] == p.getKey() && ++seen >= 2)
+      return true;
+  return false;
+}
+
+// Plays one game between the two searches, white first.
+static void playMatchGame(MatchOptions& opt, Search* players[2],
+    GameRecord& game, std::vector<U64>& keys) {
+  Position p(game.fen);
+  keys.clear();
+  game.moves.reserve(opt.maxPlies);
+  int clocks[2] = {opt.baseMs, opt.baseMs};
+  players[0]->newGame();
+  players[1]->newGame();
+
+  for (int ply = 0;; ply++) {
+    std::vector<Move> moves = p.getLegalMoves();
+    int side = (p.getPlayer() == Color::WHITE) ? 0 : 1;
+    if (moves.empty()) {
+      if (p.inCheck()) {
+        game.result = side == 0 ? -1 : 1;
+        game.reason = "checkmate";
+      }
+      else {
+        game.result = 0;
+        game.reason = "stalemate";
+      }
+      return;
+    }
+    game.result = 0;
+    if (p.getClock() >= 100) {
+      game.reason = "fifty move rule";
+      return;
+    }
+    if (isThreefoldRepetition(p, keys)) {
+      game.reason = "threefold repetition";
+      return;
+    }
+    if (isInsufficientMaterial(p)) {
+      game.reason = "insufficient material";
+      return;
+    }
+    if (ply >= opt.maxPlies) {
+      game.reason = "adjudicated after " + std::to_string(ply) + " plies";
+      return;
+    }
+
+    // The search's time manager decides how much of the clock to use
+    SearchLimits limits;
+    limits.clockMs = std::max(1, clocks[side]);
+    limits.incrementMs = opt.incrementMs;
+    auto start = std::chrono::steady_clock::now();
+    SearchResult r = players[side]->think(p, limits, keys);
+    game.searchArenaPeak = std::max(game.searchArenaPeak, r.arenaPeak);
+    game.pawnHashHits += r.pawnHashHits;
+    game.pawnHashProbes += r.pawnHashProbes;
+    std::chrono::duration<double, std::milli> used =
+      std::chrono::steady_clock::now() - start;
+    clocks[side] -= (int)used.count();
+    if (clocks[side] < 0) {
+      game.result = side == 0 ? -1 : 1;
+      game.reason = std::string(side == 0 ? "white" : "black")
+        + " lost on time";
+      return;
+    }
+    clocks[side] += opt.incrementMs;
+
+    int m = Search::findPackedMove(Search::packMove(r.best), moves);
+    if (m == -1)
+      m = 0;
+    p.nameMoves(moves);
+    game.moves.push_back(moves[m]);
+    keys.push_back(p.getKey());
+    p.makeMove(moves[m]);
+  }
+}
+
+// Writes the game in PGN to the stream.
+static void writePGN(std::ostream& out, GameRecord& game) {
+  std::string result = game.result == 1 ? "1-0"
+    : game.result == -1 ? "0-1" : "1/2-1/2";
+  out << "[Event \"tchess match\"]\n"
+    << "[Site \"?\"]\n"
+    << "[Round \"" << (game.index + 1) << "\"]\n"
+    << "[White \"" << game.white << "\"]\n"
+    << "[Black \"" << game.black << "\"]\n"
+    << "[Result \"" << result << "\"]\n"
+    << "[Termination \"" << game.reason << "\"]\n";
+  if (game.fen != START_FEN)
+    out << "[SetUp \"1\"]\n" << "[FEN \"" << game.fen << "\"]\n";
+  out << "\n";
+
+  // Move numbers continue from the opening's fullmove number
+  std::istringstream fields(game.fen);
+  std::string field, player;
+  int number = 1;
+  for (int i = 0; fields >> field; i++) {
+    if (i == 1)
+      player = field;
+    if (i == 5)
+      number = std::max(1, std::atoi(field.c_str()));
+  }
+  bool white = (player != "b");
+
+  std::string line;
+  for (unsigned int i = 0; i < game.moves.size(); i++) {
+    std::string token;
+    if (white)
+      token = std::to_string(number) + ". ";
+    else if (i == 0)
+      token = std::to_string(number) + "... ";
+    token += game.moves[i].getName();
+    if (!line.empty() && line.size() + token.size() + 1 > 79) {
+      out << line << "\n";
+      line.clear();
+    }
+    line += (line.empty() ? "" : " ") + token;
+    if (!white)
+      number++;
+    white = !white;
+  }
+  if (!line.empty() && line.size() + result.size() + 1 > 79) {
+    out << line << "\n";
+    line.clear();
+  }
+  line += (line.empty() ? "" : " ") + result;
+  out << line << "\n\n";
+  out.flush();
+}
+
+int runMatch(MatchOptions& opt) {
+  // Openings, each of which is played once with either color
+  std::vector<std::string> openings;
+  if (!opt.openingsFile.empty()) {
+    std::vector<EPDEntry> entries;
+    if (!loadEPD(opt.openingsFile, entries)) {
+      std::cout << "Cannot read " << opt.openingsFile << std::endl;
+      return 1;
+    }
+    for (unsigned int i = 0; i < entries.size(); i++)
+      openings.push_back(entries[i].fen);
+  }
+  if (openings.empty())
+    openings.push_back(START_FEN);
+
+  std::ofstream pgn;
+  if (!opt.pgnFile.empty()) {
+    pgn.open(opt.pgnFile, std::ios::app);
+    if (!pgn.is_open()) {
+      std::cout << "Cannot write " << opt.pgnFile << std::endl;
+      return 1;
+    }
+  }
+
+  double lower = std::log(opt.beta / (1 - opt.alpha));
+  double upper = std::log((1 - opt.beta) / opt.alpha);
+  int numThreads = std::max(1, std::min(opt.concurrency, opt.games));
+  std::cout << opt.engines[0].name << " vs " << opt.engines[1].name << ": "
+    << opt.games << " games, " << opt.baseMs / 1000.0 << "+"
+    << opt.incrementMs / 1000.0 << "s, " << openings.size()
+    << " openings, " << numThreads << " threads" << std::endl;
+  if (opt.sprt)
+    std::cout << std::fixed << std::setprecision(2) << "SPRT elo0 "
+      << opt.elo0 << " elo1 " << opt.elo1 << ", alpha " << opt.alpha
+      << " beta " << opt.beta << ", LLR bounds [" << lower << ", "
+      << upper << "]" << std::endl;
+
+  MatchScore score;
+  size_t searchArenaPeak = 0, recordArenaPeak = 0;
+  U64 pawnHashHits = 0, pawnHashProbes = 0;
+  std::mutex resultsMutex;
+  std::atomic<int> next(0);
+  std::atomic<bool> finished(false);
+  std::string verdict;
+  std::vector<std::thread> workers;
+  auto start = std::chrono::steady_clock::now();
+  for (int t = 0; t < numThreads; t++) {
+    workers.push_back(std::thread([&]() {
+      std::unique_ptr<Search> engines[2];
+      for (int e = 0; e < 2; e++)
+        engines[e].reset(new Search(opt.engines[e].options));
+      Arena& arena = Arena::forThread();
+      std::vector<U64> keys;
+
+      for (int g = next++; g < opt.games && !finished; g = next++) {
+        // Even games give engine A white, odd games the same opening with
+        // colors swapped
+        int a = g % 2;
+        Search* players[2] = {engines[a].get(), engines[1 - a].get()};
+        arena.reset();
+        GameRecord game(arena);
+        game.index = g;
+        game.fen = openings[(g / 2) % openings.size()];
+        game.white = opt.engines[a].name;
+        game.black = opt.engines[1 - a].name;
+        playMatchGame(opt, players, game, keys);
+
+        std::lock_guard<std::mutex> lock(resultsMutex);
+        int forA = (a == 0) ? game.result : -game.result;
+        if (forA == 1)
+          score.wins++;
+        else if (forA == -1)
+          score.losses++;
+        else
+          score.draws++;
+        searchArenaPeak = std::max(searchArenaPeak, game.searchArenaPeak);
+        pawnHashHits += game.pawnHashHits;
+        pawnHashProbes += game.pawnHashProbes;
+        recordArenaPeak = std::max(recordArenaPeak, arena.getPeak());
+        if (pgn.is_open())
+          writePGN(pgn, game);
+
+        std::cout << std::fixed << std::setprecision(1) << "Game "
+          << std::setw(4) << (g + 1) << "  " << game.white << " vs "
+          << game.black << "  "
+          << (game.result == 1 ? "1-0" : game.result == -1 ? "0-1" : "1/2")
+          << " (" << game.reason << ")  " << opt.engines[0].name << " +"
+          << score.wins << " -" << score.losses << " =" << score.draws
+          << "  Elo " << scoreToElo(score.score()) << " +/- "
+          << eloMargin(score);
+        if (opt.sprt) {
+          double llr = computeLLR(score, opt.elo0, opt.elo1);
+          std::cout << std::setprecision(2) << "  LLR " << llr;
+          if (!finished && llr >= upper) {
+            verdict = "H1 accepted";
+            finished = true;
+          }
+          else if (!finished && llr <= lower) {
+            verdict = "H0 accepted";
+            finished = true;
+          }
+        }
+        std::cout << std::endl;
+      }
+    }));
+  }
+  for (unsigned int t = 0; t < workers.size(); t++)
+    workers[t].join();
+  std::chrono::duration<double> total = std::chrono::steady_clock::now() - start;
+
+  std::cout << std::fixed << std::setprecision(1) << "Finished "
+    << score.games() << " games in " << total.count() << "s: "
+    << opt.engines[0].name << " +" << score.wins << " -" << score.losses
+    << " =" << score.draws << ", Elo " << scoreToElo(score.score())
+    << " +/- " << eloMargin(score) << std::endl;
+  std::cout << "Arena peak: " << searchArenaPeak / 1024.0
+    << " KB per search, " << recordArenaPeak / 1024.0
+    << " KB per game record" << std::endl;
+  if (pawnHashProbes > 0)
+    std::cout << "Pawn hash: " << 100.0 * pawnHashHits / pawnHashProbes
+      << "% of " << pawnHashProbes << " lookups hit" << std::endl;
+  if (opt.sprt)
+    std::cout << "SPRT: " << (verdict.empty() ? "inconclusive" : verdict)
+      << std::endl;
+  return 0;
+}
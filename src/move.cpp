@@ -1,6 +1,8 @@
 #include "move.h"
 #include "types.h"
 
+#include <algorithm>
+#include <cstring>
 #include <iostream>
 
 Move::Move() {
@@ -11,6 +13,7 @@ Move::Move() {
   savedClock = 0;
   movingPiece = Piece::NO_PIECE;
   capturedPiece = Piece::NO_PIECE;
+  name[0] = '\0';
 }
 
 Move::Move(Piece movingPiece, U8 from, U8 to, MoveType type) {
@@ -21,6 +24,7 @@ Move::Move(Piece movingPiece, U8 from, U8 to, MoveType type) {
   savedFlags = 0;
   savedClock = 0;
   capturedPiece = Piece::NO_PIECE;
+  name[0] = '\0';
 }
 
 void Move::setUnmakeInfo(U8 flags, U16 clock, Piece piece) {
@@ -29,8 +33,11 @@ void Move::setUnmakeInfo(U8 flags, U16 clock, Piece piece) {
   capturedPiece = piece;
 }
 
+// Sets the name, cut to fit the buffer (no legal move name is longer).
 void Move::setName(std::string name) {
-  this->name = name;
+  size_t n = std::min(name.size(), (size_t)NAME_SIZE - 1);
+  memcpy(this->name, name.data(), n);
+  this->name[n] = '\0';
 }
 
 U8 Move::getFrom() {
@@ -42,15 +49,15 @@ U8 Move::getTo() {
 }
 
 MoveType Move::getType() {
-  return type;
+  return (MoveType)type;
 }
 
 Piece Move::getMovingPiece() {
-  return movingPiece;
+  return (Piece)movingPiece;
 }
 
 Piece Move::getCapturedPiece() {
-  return capturedPiece;
+  return (Piece)capturedPiece;
 }
 
 U8 Move::getFlags() {
@@ -62,7 +69,22 @@ U16 Move::getClock() {
 }
 
 std::string Move::getName() {
-  return name;
+  return std::string(name);
+}
+
+// Returns the move as its from and to squares, followed by the letter of the
+// promoted piece if any, eg "g1f3" or "e7e8q". This is the notation of UCI.
+std::string Move::getCoordinates() {
+  const std::string promotions = "nbrq";
+  std::string s;
+  s += (char)('a' + from % 8);
+  s += (char)('1' + from / 8);
+  s += (char)('a' + to % 8);
+  s += (char)('1' + to / 8);
+  Piece prom = getPromotedPiece();
+  if (prom != NO_PIECE)
+    s += promotions[W_KNIGHT - prom % 6];
+  return s;
 }
 
 // If the move is a promotion, this will return the Piece corresponding to the
@@ -0,0 +1,202 @@
+#include "nnue.h"
+#include "types.h"
+
+#include <cstring>
+#include <fstream>
+#include <map>
+#include <mutex>
+
+#if defined(__x86_64__) && defined(__GNUC__)
+#include <immintrin.h>
+#define TCHESS_HAVE_SIMD_NNUE
+#define NNUE_TARGET_CLONES __attribute__((target_clones("avx2", "default")))
+#else
+#define NNUE_TARGET_CLONES
+#endif
+
+// Sixteen weights of a row. The compiler maps operations on these to
+// whichever vector instructions the clone is compiled for.
+typedef I16 I16x16 __attribute__((vector_size(32)));
+const int NNUE_CHUNKS = NNUE_HIDDEN / 16;
+
+// Index of the first layer row for the piece on the square, from the given
+// side's point of view.
+static inline int featureIndex(int perspective, Piece piece, int sq) {
+  int color = piece / 6;
+  int type = 5 - piece % 6;  // our Pieces run king to pawn
+  if (perspective == BLACK)
+    sq ^= 56;
+  return ((color == perspective) ? 0 : 384) + 64*type + sq;
+}
+
+static inline const I16x16* row(const Network* net, int perspective,
+    Piece piece, int sq) {
+  return (const I16x16*)(net->featureWeights
+    + NNUE_HIDDEN * featureIndex(perspective, piece, sq));
+}
+
+// Accumulator kernels: acc += a, acc -= s, and acc += a - s.
+NNUE_TARGET_CLONES
+void nnueAddRow(I16x16* acc, const I16x16* a) {
+  for (int i = 0; i < NNUE_CHUNKS; i++)
+    acc[i] += a[i];
+}
+
+NNUE_TARGET_CLONES
+void nnueSubRow(I16x16* acc, const I16x16* s) {
+  for (int i = 0; i < NNUE_CHUNKS; i++)
+    acc[i] -= s[i];
+}
+
+NNUE_TARGET_CLONES
+void nnueAddSubRow(I16x16* acc, const I16x16* a, const I16x16* s) {
+  for (int i = 0; i < NNUE_CHUNKS; i++)
+    acc[i] += a[i] - s[i];
+}
+
+// Output layer kernels: the dot product of the clamped hidden layers of both
+// sides with the output weights.
+#ifdef TCHESS_HAVE_SIMD_NNUE
+
+// Clamped values are at most 255, so each pair summed by madd fits easily in
+// 32 bits.
+static int outputSSE2(const I16* us, const I16* them, const I16* w) {
+  const __m128i zero = _mm_setzero_si128();
+  const __m128i qa = _mm_set1_epi16(NNUE_QA);
+  __m128i sum = _mm_setzero_si128();
+  for (int i = 0; i < NNUE_HIDDEN; i += 8) {
+    __m128i u = _mm_load_si128((const __m128i*)(us + i));
+    __m128i t = _mm_load_si128((const __m128i*)(them + i));
+    u = _mm_min_epi16(_mm_max_epi16(u, zero), qa);
+    t = _mm_min_epi16(_mm_max_epi16(t, zero), qa);
+    sum = _mm_add_epi32(sum,
+        _mm_madd_epi16(u, _mm_load_si128((const __m128i*)(w + i))));
+    sum = _mm_add_epi32(sum, _mm_madd_epi16(t,
+          _mm_load_si128((const __m128i*)(w + NNUE_HIDDEN + i))));
+  }
+  sum = _mm_add_epi32(sum, _mm_shuffle_epi32(sum, 0x4e));
+  sum = _mm_add_epi32(sum, _mm_shuffle_epi32(sum, 0xb1));
+  return _mm_cvtsi128_si32(sum);
+}
+
+__attribute__((target("avx2")))
+static int outputAVX2(const I16* us, const I16* them, const I16* w) {
+  const __m256i zero = _mm256_setzero_si256();
+  const __m256i qa = _mm256_set1_epi16(NNUE_QA);
+  __m256i sum = _mm256_setzero_si256();
+  for (int i = 0; i < NNUE_HIDDEN; i += 16) {
+    __m256i u = _mm256_load_si256((const __m256i*)(us + i));
+    __m256i t = _mm256_load_si256((const __m256i*)(them + i));
+    u = _mm256_min_epi16(_mm256_max_epi16(u, zero), qa);
+    t = _mm256_min_epi16(_mm256_max_epi16(t, zero), qa);
+    sum = _mm256_add_epi32(sum,
+        _mm256_madd_epi16(u, _mm256_load_si256((const __m256i*)(w + i))));
+    sum = _mm256_add_epi32(sum, _mm256_madd_epi16(t,
+          _mm256_load_si256((const __m256i*)(w + NNUE_HIDDEN + i))));
+  }
+  __m128i x = _mm_add_epi32(_mm256_castsi256_si128(sum),
+      _mm256_extracti128_si256(sum, 1));
+  x = _mm_add_epi32(x, _mm_shuffle_epi32(x, 0x4e));
+  x = _mm_add_epi32(x, _mm_shuffle_epi32(x, 0xb1));
+  return _mm_cvtsi128_si32(x);
+}
+
+#else
+
+static int outputScalar(const I16* us, const I16* them, const I16* w) {
+  int sum = 0;
+  for (int i = 0; i < NNUE_HIDDEN; i++) {
+    int u = us[i] < 0 ? 0 : (us[i] > NNUE_QA ? NNUE_QA : us[i]);
+    int t = them[i] < 0 ? 0 : (them[i] > NNUE_QA ? NNUE_QA : them[i]);
+    sum += u * w[i] + t * w[NNUE_HIDDEN + i];
+  }
+  return sum;
+}
+
+#endif
+
+typedef int (*OutputFn)(const I16*, const I16*, const I16*);
+
+// Picks the fastest output kernel the CPU supports.
+static OutputFn chooseOutput() {
+#ifdef TCHESS_HAVE_SIMD_NNUE
+  __builtin_cpu_init();
+  if (__builtin_cpu_supports("avx2"))
+    return outputAVX2;
+  return outputSSE2;
+#else
+  return outputScalar;
+#endif
+}
+
+// Networks already loaded, shared by every search which uses the same file
+static std::map<std::string, std::shared_ptr<const Network>> loadedNetworks;
+static std::mutex loadedNetworksMutex;
+
+// Loads the network in the file, or returns null if it cannot be read or has
+// the wrong size.
+std::shared_ptr<const Network> Network::load(std::string path) {
+  std::lock_guard<std::mutex> lock(loadedNetworksMutex);
+  auto it = loadedNetworks.find(path);
+  if (it != loadedNetworks.end())
+    return it->second;
+
+  std::ifstream in(path, std::ios::binary | std::ios::ate);
+  if (!in.is_open())
+    return nullptr;
+  const std::streamsize expected = sizeof(I16) * (NNUE_INPUTS * NNUE_HIDDEN
+      + NNUE_HIDDEN + 2 * NNUE_HIDDEN + 1);
+  std::streamsize bytes = in.tellg();
+  if (bytes < expected || bytes >= expected + 64)
+    return nullptr;
+  in.seekg(0);
+
+  std::shared_ptr<Network> net = std::make_shared<Network>();
+  in.read((char*)net->featureWeights, sizeof(net->featureWeights));
+  in.read((char*)net->featureBias, sizeof(net->featureBias));
+  in.read((char*)net->outputWeights, sizeof(net->outputWeights));
+  in.read((char*)&net->outputBias, sizeof(net->outputBias));
+  if (!in)
+    return nullptr;
+  loadedNetworks[path] = net;
+  return net;
+}
+
+// Recomputes both hidden layers from the pieces, given as bitboards indexed
+// by Piece.
+void Accumulator::refresh(const U64* bbs) {
+  for (int c = 0; c < 2; c++) {
+    memcpy(values[c], network->featureBias, sizeof(values[c]));
+    for (int p = 0; p < 12; p++)
+      for (U64 b = bbs[p]; b != 0; b &= b - 1)
+        nnueAddRow((I16x16*)values[c],
+            row(network, c, (Piece)p, __builtin_ctzll(b)));
+  }
+}
+
+void Accumulator::add(Piece piece, int sq) {
+  for (int c = 0; c < 2; c++)
+    nnueAddRow((I16x16*)values[c], row(network, c, piece, sq));
+}
+
+void Accumulator::remove(Piece piece, int sq) {
+  for (int c = 0; c < 2; c++)
+    nnueSubRow((I16x16*)values[c], row(network, c, piece, sq));
+}
+
+void Accumulator::move(Piece piece, int from, int to) {
+  for (int c = 0; c < 2; c++)
+    nnueAddSubRow((I16x16*)values[c], row(network, c, piece, to),
+        row(network, c, piece, from));
+}
+
+// Returns the evaluation in centipawns from the point of view of the player
+// to move. The output kernel is chosen on the first call rather than during
+// static initialization, so that positions may be evaluated from other
+// static initializers.
+int Accumulator::evaluate(Color player) {
+  static const OutputFn outputImpl = chooseOutput();
+  int sum = outputImpl(values[player], values[1 - player],
+      network->outputWeights);
+  return (sum + network->outputBias) * NNUE_SCALE / (NNUE_QA * NNUE_QB);
+}
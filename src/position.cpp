@@ -2,15 +2,15 @@
 #include "position.h"
 #include "types.h"
 #include "move.h"
+#include "masks.h"
+#include "stats.h"
+#include "attacks.h"
+#include "zobrist.h"
 
+#include <climits>
 #include <iostream>
 #include <string>
 
-// Static variables.
-U64 Position::attackOnEmpty[5][64] = {};
-U64 Position::blockerMask[5][64] = {};
-U64 Position::behindMask[64][64] = {};
-
 // Constructor. All bitboards are initially empty.
 Position::Position() {
   for (int i = 0; i < 12; i++)
@@ -18,10 +18,14 @@ Position::Position() {
   flags = 0;
   player = Color::WHITE;
   clock = 0;
+  key = 0;
+  pawnKey = 0;
+  accumulator = nullptr;
 }
 
 // Constructor which uses FEN to set everything up.
 Position::Position(std::string fen) {
+  accumulator = nullptr;
   loadFEN(fen);
 }
 
@@ -89,6 +93,59 @@ void Position::loadFEN(std::string fen) {
   }
 
   // Sixth token: fullmove clock, not used.
+
+  key = computeKey();
+  pawnKey = computePawnKey();
+  if (accumulator)
+    accumulator->refresh(bbs);
+}
+
+// Returns the FEN of the Position. The fullmove number is not tracked, so it
+// is always given as 1.
+std::string Position::getFEN() {
+  std::string fen;
+
+  // Piece locations
+  const std::string letters = "KQRBNPkqrbnp";
+  for (int rank = 7; rank >= 0; rank--) {
+    int empty = 0;
+    for (int file = 0; file < 8; file++) {
+      Piece p = getPiece(frToSquare(file, rank));
+      if (p == Piece::NO_PIECE) {
+        empty++;
+        continue;
+      }
+      if (empty > 0)
+        fen += (char)('0' + empty);
+      empty = 0;
+      fen += letters[p];
+    }
+    if (empty > 0)
+      fen += (char)('0' + empty);
+    if (rank > 0)
+      fen += '/';
+  }
+
+  // Player to move
+  fen += (player == Color::WHITE) ? " w " : " b ";
+
+  // Castling rights
+  if ((flags & 0xf0) == 0)
+    fen += '-';
+  if (flags & 0x40) fen += 'K';
+  if (flags & 0x80) fen += 'Q';
+  if (flags & 0x10) fen += 'k';
+  if (flags & 0x20) fen += 'q';
+
+  // En passant target square
+  if (getEPFile() == -1)
+    fen += " -";
+  else
+    fen += " " + frToString(getEPFile(), (player == Color::WHITE) ? 5 : 2);
+
+  // Halfmove and fullmove clocks
+  fen += " " + std::to_string(clock) + " 1";
+  return fen;
 }
 
 // Sets the Position to the initial game state.
@@ -109,6 +166,10 @@ void Position::initPieces() {
   bbs[9] = (ONE << 58) | (ONE << 61); // Black Bishops
   bbs[10] = (ONE << 57) | (ONE << 62); // Black Knights
   bbs[11] = 0x00FF000000000000; // Black Pawns
+  key = computeKey();
+  pawnKey = computePawnKey();
+  if (accumulator)
+    accumulator->refresh(bbs);
 }
 
 // Prints the board to the console.
@@ -197,121 +258,259 @@ void Position::printBitBoard(U64 b) {
   }
 }
 
+// Constants which depend on the side to move. The specializations of move
+// generation and make/unmake below take them from here as compile-time values
+// instead of branching on the player.
+template<Color Us> struct Side;
+
+template<> struct Side<Color::WHITE> {
+  static constexpr Color them = Color::BLACK;
+  static constexpr int base = 0; // Offset of this side's Pieces
+  static constexpr int push = 8;
+  static constexpr int leftOffset = 7;
+  static constexpr int rightOffset = 9;
+  static constexpr U64 thirdRank = RANK_3;
+  static constexpr U64 lastRank = RANK_8;
+  static constexpr int epRank = 40; // First square of the en passant rank
+  static constexpr int longRookFrom = 0, longRookTo = 3;
+  static constexpr int shortRookFrom = 7, shortRookTo = 5;
+  static constexpr U8 castlingRights = 0xc0;
+  // Squares which must be empty to castle, and those the king crosses or
+  // lands on, which must not be attacked
+  static constexpr U64 longCastleEmpty = 0x000000000000000eULL;
+  static constexpr U64 longCastleSafe = 0x000000000000000cULL;
+  static constexpr U64 shortCastleEmpty = 0x0000000000000060ULL;
+  static constexpr U64 shortCastleSafe = 0x0000000000000060ULL;
+};
+
+template<> struct Side<Color::BLACK> {
+  static constexpr Color them = Color::WHITE;
+  static constexpr int base = 6;
+  static constexpr int push = -8;
+  static constexpr int leftOffset = -9;
+  static constexpr int rightOffset = -7;
+  static constexpr U64 thirdRank = RANK_6;
+  static constexpr U64 lastRank = RANK_1;
+  static constexpr int epRank = 16;
+  static constexpr int longRookFrom = 56, longRookTo = 59;
+  static constexpr int shortRookFrom = 63, shortRookTo = 61;
+  static constexpr U8 castlingRights = 0x30;
+  static constexpr U64 longCastleEmpty = 0x0e00000000000000ULL;
+  static constexpr U64 longCastleSafe = 0x0c00000000000000ULL;
+  static constexpr U64 shortCastleEmpty = 0x6000000000000000ULL;
+  static constexpr U64 shortCastleSafe = 0x6000000000000000ULL;
+};
+
+// Shifts the bitboard towards higher squares for positive offsets and lower
+// squares for negative ones.
+static inline U64 shiftBy(U64 b, int offset) {
+  return (offset > 0) ? (b << offset) : (b >> -offset);
+}
+
 // Actuates the given move, and also prepares that move object so that it can
 // be unmade if necessary.
 void Position::makeMove(Move& move) {
-  // Remove captured piece, if applicable
-  Piece capturedPiece;
-  if (move.getType() == MoveType::EP_CAPTURE) { // en passant
-    if (player == Color::WHITE)
-      capturedPiece = removePiece(Piece::B_PAWN, move.getTo() - 8);
-    else
-      capturedPiece = removePiece(Piece::W_PAWN, move.getTo() + 8);
-  }
-  else if (move.isCapture()) // regular capture
-    capturedPiece = removePiece(move.getTo());
-  else // non-capture
-    capturedPiece = Piece::NO_PIECE;
-
-  // Save information which will be needed to unmake move
-  move.setUnmakeInfo(flags, clock, capturedPiece);
-
-  // Move the moving Piece to its destination
-  Piece movingPiece = removePiece(move.getFrom());
-  Piece prom = move.getPromotedPiece();
-  if (prom != Piece::NO_PIECE)
-    movingPiece = prom;
-  placePiece(movingPiece, move.getTo());
-
-  // For castling moves, move the rook also
-  int c = move.getCastlingDirection();
-  if (c != 0) {
-    if (player == Color::WHITE) {
-      if (c == -1)
-        movePiece(W_ROOK, 0, 3);
-      else
-        movePiece(W_ROOK, 7, 5);
-    }
-    else {
-      if (c == -1)
-        movePiece(B_ROOK, 56, 59);
-      else
-        movePiece(B_ROOK, 63, 61);
-    }
-  }
+  STAT_INC(STAT_MAKE_MOVES);
+  STAT_TIMER(TIMER_MAKE_MOVE);
+  if (player == Color::WHITE)
+    makeMoveAs<Color::WHITE>(move);
+  else
+    makeMoveAs<Color::BLACK>(move);
+}
 
-  // Update castling flags if necessary.
-  if (move.getFrom() == 0 || move.getTo() == 0)
-    setCastlingFlag(-1, Color::WHITE);
-  if (move.getFrom() == 7 || move.getTo() == 7)
-    setCastlingFlag(1, Color::WHITE);
-  if (move.getFrom() == 56 || move.getTo() == 56)
-    setCastlingFlag(-1, Color::BLACK);
-  if (move.getFrom() == 63 || move.getTo() == 63)
-    setCastlingFlag(1, Color::BLACK);
-  if (movingPiece == Piece::W_KING)
-    setCastlingFlag(0, Color::WHITE);
-  if (movingPiece == Piece::B_KING)
-    setCastlingFlag(0, Color::BLACK);
-
-  // Update en passant flag.
-  if (move.getType() == MoveType::DOUBLE_PAWN_PUSH) {
-    setEPFile(move.getFrom() % 8);
+// makeMove for the given player to move. Each MoveType touches only the
+// bitboards it needs: a quiet move changes one bitboard, the flags and the
+// clock.
+template<Color Us>
+void Position::makeMoveAs(Move& move) {
+  typedef Side<Us> S;
+  const Piece pawn = (Piece)(S::base + W_PAWN);
+  const Piece moving = move.getMovingPiece();
+  const int from = move.getFrom();
+  const int to = move.getTo();
+  const MoveType type = move.getType();
+
+  // Information which will be needed to unmake the move
+  const U8 oldFlags = flags;
+  const U16 oldClock = clock;
+  Piece captured = Piece::NO_PIECE;
+
+  switch (type) {
+    case MoveType::QUIET:
+      movePiece(moving, from, to);
+      clock = (moving == pawn) ? 0 : clock + 1;
+      break;
+    case MoveType::DOUBLE_PAWN_PUSH:
+      movePiece(pawn, from, to);
+      clock = 0;
+      break;
+    case MoveType::SHORT_CASTLE:
+      movePiece(moving, from, to);
+      movePiece((Piece)(S::base + W_ROOK), S::shortRookFrom, S::shortRookTo);
+      clock++;
+      break;
+    case MoveType::LONG_CASTLE:
+      movePiece(moving, from, to);
+      movePiece((Piece)(S::base + W_ROOK), S::longRookFrom, S::longRookTo);
+      clock++;
+      break;
+    case MoveType::CAPTURE:
+      captured = removeCapturedPiece<Us>(to);
+      movePiece(moving, from, to);
+      clock = 0;
+      break;
+    case MoveType::EP_CAPTURE:
+      captured = removePiece((Piece)(Side<S::them>::base + W_PAWN),
+          to - S::push);
+      movePiece(pawn, from, to);
+      clock = 0;
+      break;
+    default: // promotions
+      if (type & MoveType::CAPTURE)
+        captured = removeCapturedPiece<Us>(to);
+      removePiece(pawn, from);
+      placePiece(promotedPiece<Us>(type), to);
+      clock = 0;
+      break;
   }
+  move.setUnmakeInfo(oldFlags, oldClock, captured);
 
-  // Switch player.
-  switchPlayer();
+  // Castling rights from the table, and en passant, which only ever lasts
+  // for one move
+  flags &= CASTLING_RIGHTS_MASK[from] & CASTLING_RIGHTS_MASK[to] & 0xf0;
+  if (type == MoveType::DOUBLE_PAWN_PUSH)
+    flags |= 0x08 | (from % 8);
 
-  // Increment clock, or reset it.
-  if (movingPiece == Piece::W_PAWN || movingPiece == Piece::B_PAWN)
-    clock = 0;
-  else if (move.getPromotedPiece() != Piece::NO_PIECE)
-    clock = 0;
-  else if (move.isCapture())
-    clock = 0;
-  else
-    clock++;
+  player = S::them;
+  key ^= flagsKey(oldFlags) ^ flagsKey(flags) ^ ZOBRIST.side;
 }
 
-void Position::unmakeMove(Move& move) {
-  // Switch player back
-  switchPlayer();
-
-  // Move Piece back where it came from
-  Piece movedPiece = removePiece(move.getTo());
-  if (move.getPromotedPiece() != Piece::NO_PIECE) {
-    if (player == Color::WHITE)
-      movedPiece = W_PAWN;
-    else
-      movedPiece = B_PAWN;
-  }
-  placePiece(movedPiece, move.getFrom());
+// Removes and returns the enemy piece on the square, which must not be a
+// king.
+template<Color Us>
+Piece Position::removeCapturedPiece(int sq) {
+  const int base = Side<Side<Us>::them>::base;
+  U64 mask = ONE << sq;
+  int i = W_QUEEN;
+  while (i < W_PAWN && !(bbs[base + i] & mask))
+    i++;
+  bbs[base + i] ^= mask;
+  key ^= ZOBRIST.pieces[base + i][sq];
+  if (i == W_PAWN)
+    pawnKey ^= ZOBRIST.pieces[base + i][sq];
+  if (accumulator)
+    accumulator->remove((Piece)(base + i), sq);
+  return (Piece)(base + i);
+}
 
-  // Restore captured piece
-  if (move.getType() == MoveType::EP_CAPTURE) {
-    if (player == Color::WHITE)
-      placePiece(Piece::B_PAWN, move.getTo() - 8);
-    else
-      placePiece(Piece::W_PAWN, move.getTo() + 8);
-  }
-  else if (move.isCapture())
-    placePiece(move.getCapturedPiece(), move.getTo());
+// The piece of the given player which a promotion of the given type creates.
+template<Color Us>
+Piece Position::promotedPiece(MoveType type) {
+  // Knight, bishop, rook and queen promotions are 0 to 3 in the low bits,
+  // while the Pieces run from W_KNIGHT down to W_QUEEN
+  return (Piece)(Side<Us>::base + W_KNIGHT - (type & 0x03));
+}
 
-  // For castling moves, move the rook back
-  if (move.getType() == MoveType::LONG_CASTLE) {
-    if (player == Color::WHITE)
-      movePiece(W_ROOK, 3, 0);
-    else
-      movePiece(B_ROOK, 59, 56);
-  }
-  else if (move.getType() == MoveType::SHORT_CASTLE) {
-    if (player == Color::WHITE)
-      movePiece(W_ROOK, 5, 7);
-    else
-      movePiece(B_ROOK, 61, 63);
+// Returns the position after the move, leaving this one untouched. There is
+// nothing to unmake, so the undo information saved in the copy of the move is
+// simply discarded.
+Position Position::afterMove(Move move) const {
+  Position next = *this;
+  next.accumulator = nullptr;
+  next.makeMove(move);
+  return next;
+}
+
+// Like afterMove, but the position returned keeps its accumulator in the one
+// given, which starts as a copy of this position's. This position must have
+// an accumulator.
+Position Position::afterMove(Move move, Accumulator* acc) const {
+  Position next = *this;
+  *acc = *accumulator;
+  next.accumulator = acc;
+  next.makeMove(move);
+  return next;
+}
+
+// Passes the turn without moving, as the search does to test whether a
+// position is good even if the opponent could move twice. The move object
+// only keeps what unmakeNullMove needs. En passant is no longer possible, and
+// the clock is reset so that no repetition is found across the null move.
+void Position::makeNullMove(Move& move) {
+  move.setUnmakeInfo(flags, clock, Piece::NO_PIECE);
+  U8 oldFlags = flags;
+  flags &= 0xf0;
+  clock = 0;
+  player = oppositeColor(player);
+  key ^= flagsKey(oldFlags) ^ flagsKey(flags) ^ ZOBRIST.side;
+}
+
+void Position::unmakeNullMove(Move& move) {
+  key ^= flagsKey(flags) ^ flagsKey(move.getFlags()) ^ ZOBRIST.side;
+  flags = move.getFlags();
+  clock = move.getClock();
+  player = oppositeColor(player);
+}
+
+// Returns the position after a null move. No piece moves, so the copy shares
+// this position's accumulator, which must not be changed through it.
+Position Position::afterNullMove() const {
+  Position next = *this;
+  Move move;
+  next.makeNullMove(move);
+  return next;
+}
+
+void Position::unmakeMove(Move& move) {
+  STAT_TIMER(TIMER_UNMAKE_MOVE);
+  // The move was made by the player who is not to move now
+  if (player == Color::BLACK)
+    unmakeMoveAs<Color::WHITE>(move);
+  else
+    unmakeMoveAs<Color::BLACK>(move);
+}
+
+// unmakeMove for a move which was made by the given player.
+template<Color Us>
+void Position::unmakeMoveAs(Move& move) {
+  typedef Side<Us> S;
+  const Piece pawn = (Piece)(S::base + W_PAWN);
+  const Piece moving = move.getMovingPiece();
+  const int from = move.getFrom();
+  const int to = move.getTo();
+  const MoveType type = move.getType();
+
+  player = Us;
+  switch (type) {
+    case MoveType::QUIET:
+    case MoveType::DOUBLE_PAWN_PUSH:
+      movePiece(moving, to, from);
+      break;
+    case MoveType::SHORT_CASTLE:
+      movePiece(moving, to, from);
+      movePiece((Piece)(S::base + W_ROOK), S::shortRookTo, S::shortRookFrom);
+      break;
+    case MoveType::LONG_CASTLE:
+      movePiece(moving, to, from);
+      movePiece((Piece)(S::base + W_ROOK), S::longRookTo, S::longRookFrom);
+      break;
+    case MoveType::CAPTURE:
+      movePiece(moving, to, from);
+      placePiece(move.getCapturedPiece(), to);
+      break;
+    case MoveType::EP_CAPTURE:
+      movePiece(pawn, to, from);
+      placePiece((Piece)(Side<S::them>::base + W_PAWN), to - S::push);
+      break;
+    default: // promotions
+      removePiece(promotedPiece<Us>(type), to);
+      placePiece(pawn, from);
+      placePiece(move.getCapturedPiece(), to);
+      break;
   }
 
   // Restore flags and clock
+  key ^= flagsKey(flags) ^ flagsKey(move.getFlags()) ^ ZOBRIST.side;
   flags = move.getFlags();
   clock = move.getClock();
 }
@@ -319,15 +518,53 @@ void Position::unmakeMove(Move& move) {
 // Returns a vector containing all of the fully legal moves which could be
 // made in the current position.
 std::vector<Move> Position::getLegalMoves() {
+  STAT_INC(STAT_GET_LEGAL_MOVES);
+  STAT_TIMER(TIMER_GET_LEGAL_MOVES);
   std::vector<Move> moves;
+  if (player == Color::WHITE)
+    getLegalMovesAs<Color::WHITE>(moves);
+  else
+    getLegalMovesAs<Color::BLACK>(moves);
+  return moves;
+}
 
-  U64 friends = getOccupied(player);
-  U64 enemies = getOccupied(oppositeColor(player));
+// Like getLegalMoves, but appends the moves to a list in an arena. Room for
+// the most moves a position can have is reserved up front, since memory given
+// back when a vector grows is not reused until the arena is rewound.
+void Position::getLegalMoves(MoveList& moves) {
+  STAT_INC(STAT_GET_LEGAL_MOVES);
+  STAT_TIMER(TIMER_GET_LEGAL_MOVES);
+  moves.reserve(moves.size() + MAX_MOVES);
+  if (player == Color::WHITE)
+    getLegalMovesAs<Color::WHITE>(moves);
+  else
+    getLegalMovesAs<Color::BLACK>(moves);
+}
+
+// getLegalMoves for the given player to move. Moves are appended to the list.
+template<Color Us, class List>
+void Position::getLegalMovesAs(List& moves) {
+  typedef Side<Us> S;
+  size_t first = moves.size();
+
+  // When in check, only the moves which can answer it are generated
+  U64 checkers = 0;
+  U64 king = bbs[S::base + W_KING];
+  if (king != 0) {
+    checkers = getCheckersAs<Us>(bitscan(king));
+    if (checkers != 0) {
+      getEvasionsAs<Us>(moves, checkers);
+      return;
+    }
+  }
+
+  U64 friends = getOccupied(Us);
+  U64 enemies = getOccupied(S::them);
   U64 occupied = friends | enemies;
 
   // Pieces other than pawns
   for (int i = 0; i < 5; i++) {
-    Piece p = (Piece)(i + 6*(int)player);
+    Piece p = (Piece)(i + S::base);
     // For each individual piece
     for (U64 b = bbs[p]; b != 0; b &= b - 1) {
       int from = bitscan(b);
@@ -347,62 +584,316 @@ std::vector<Move> Position::getLegalMoves() {
     }
   }
 
-  // Pawns
-  Piece p = makeColor(Piece::W_PAWN, player);
+  // Pawns. Rather than looping over each pawn, the targets of every pawn are
+  // found at once by shifting the whole bitboard. Offsets give the distance
+  // from the origin square to the target square.
+  const Piece p = (Piece)(S::base + W_PAWN);
+  U64 pawns = bbs[p];
+  U64 empty = ~occupied;
+  U64 single = shiftBy(pawns, S::push) & empty;
+  U64 doubles = shiftBy(single & S::thirdRank, S::push) & empty;
+  U64 left = shiftBy(pawns, S::leftOffset) & NOT_FILE_H;
+  U64 right = shiftBy(pawns, S::rightOffset) & NOT_FILE_A;
+
+  addPawnMoves(moves, p, single & ~S::lastRank, S::push, MoveType::QUIET);
+  addPawnMoves(moves, p, doubles, 2*S::push, MoveType::DOUBLE_PAWN_PUSH);
+  addPawnMoves(moves, p, left & enemies & ~S::lastRank, S::leftOffset,
+      MoveType::CAPTURE);
+  addPawnMoves(moves, p, right & enemies & ~S::lastRank, S::rightOffset,
+      MoveType::CAPTURE);
+  addPromotions(moves, p, single & S::lastRank, S::push, false);
+  addPromotions(moves, p, left & enemies & S::lastRank, S::leftOffset, true);
+  addPromotions(moves, p, right & enemies & S::lastRank, S::rightOffset, true);
+
+  // En passant
+  if (getEPFile() != -1) {
+    U64 epMask = ONE << (getEPFile() + S::epRank);
+    addPawnMoves(moves, p, left & epMask, S::leftOffset,
+        MoveType::EP_CAPTURE);
+    addPawnMoves(moves, p, right & epMask, S::rightOffset,
+        MoveType::EP_CAPTURE);
+  }
 
-  // Calculate square for potential en passant capture
-  int epSquare = getEPFile();
-  if (epSquare != -1)
-    epSquare += (p == Piece::W_PAWN) ? 40 : 16;
-  
-  // For each individual pawn
-  for (U64 b = bbs[p]; b != 0; b &= b - 1) {
-    int from = bitscan(b);
-    int file = squareToFile(from);
-    int front = (p == Piece::W_PAWN) ? from + 8 : from - 8;
-    // Single push forward
-    if (~occupied & (ONE << front)) {
-      addPawnMoves(moves, from, front);
-      int doubleFront = (p == Piece::W_PAWN) ? from + 16 : from - 16;
-      int homeRank = (p == Piece::W_PAWN) ? 1 : 6;
-      int rank = squareToRank(from);
-      // Check if double pawn push is possible
-      if ((rank == homeRank) && (~occupied & (ONE << doubleFront)))
-        moves.push_back(Move(p, from, doubleFront,MoveType::DOUBLE_PAWN_PUSH));
+  // Add castling moves if appropriate. The king is not in check, since the
+  // evasions would have been generated instead.
+  if (king != 0 && (flags & S::castlingRights)) {
+    addCastlingMoveIfAble(moves, Us, -1);
+    addCastlingMoveIfAble(moves, Us, 1);
+  }
+
+  // Go through every move and exclude any which would leave the friendly king
+  // in check, compacting the list in place
+  size_t legal = first;
+  for (size_t i = first; i < moves.size(); i++)
+    if (isLegalMoveAs<Us>(moves[i]))
+      moves[legal++] = moves[i];
+  moves.resize(legal);
+}
+
+// Returns the enemy pieces attacking the player's king on kingSq.
+template<Color Us>
+U64 Position::getCheckersAs(int kingSq) {
+  typedef Side<Us> S;
+  const U64* enemy = bbs + Side<S::them>::base;
+  return (MASKS.attackOnEmpty[W_KNIGHT][kingSq] & enemy[W_KNIGHT])
+    | (getAttackedSquares((Piece)(S::base + W_PAWN), kingSq) & enemy[W_PAWN])
+    | (getAttackedSquares(W_ROOK, kingSq) & (enemy[W_ROOK] | enemy[W_QUEEN]))
+    | (getAttackedSquares(W_BISHOP, kingSq)
+      & (enemy[W_BISHOP] | enemy[W_QUEEN]));
+}
+
+// Appends the legal moves of a player in check, given the checking pieces:
+// king moves to safe squares and, against a single checker, captures of it
+// and moves onto the squares between it and the king. Pinned pieces can do
+// neither, so they are left out, and every move but en passant is legal as
+// generated.
+template<Color Us, class List>
+void Position::getEvasionsAs(List& moves, U64 checkers) {
+  typedef Side<Us> S;
+  const U64* own = bbs + S::base;
+  const U64* enemy = bbs + Side<S::them>::base;
+  U64 friends = getOccupied(Us);
+  U64 enemies = getOccupied(S::them);
+  U64 occupied = friends | enemies;
+  U64 king = own[W_KING];
+  int kingSq = bitscan(king);
+
+  // King escapes. The king is removed from the board so that it cannot
+  // retreat along the ray of a slider giving check.
+  U64 danger = slidingAttacksSetwise(enemy[W_ROOK] | enemy[W_QUEEN],
+      enemy[W_BISHOP] | enemy[W_QUEEN], ~(occupied ^ king));
+  danger |= knightAttacksSetwise(enemy[W_KNIGHT]);
+  danger |= kingAttacksSetwise(enemy[W_KING]);
+  if (Us == Color::BLACK)
+    danger |= whitePawnAttacksSetwise(enemy[W_PAWN]);
+  else
+    danger |= blackPawnAttacksSetwise(enemy[W_PAWN]);
+  for (U64 a = MASKS.attackOnEmpty[W_KING][kingSq] & ~friends & ~danger;
+      a != 0; a &= a - 1) {
+    int to = bitscan(a);
+    moves.push_back(Move((Piece)(S::base + W_KING), kingSq, to,
+        (enemies & (ONE << to)) ? MoveType::CAPTURE : MoveType::QUIET));
+  }
+
+  // In double check only the king can move
+  if (checkers & (checkers - 1))
+    return;
+  U64 targets = checkers | MASKS.betweenMask[kingSq][bitscan(checkers)];
+
+  // Friendly pieces pinned to the king
+  U64 pinned = 0;
+  U64 sliders = (MASKS.attackOnEmpty[W_ROOK][kingSq]
+      & (enemy[W_ROOK] | enemy[W_QUEEN]))
+    | (MASKS.attackOnEmpty[W_BISHOP][kingSq]
+      & (enemy[W_BISHOP] | enemy[W_QUEEN]));
+  for (; sliders != 0; sliders &= sliders - 1) {
+    U64 blockers = MASKS.betweenMask[kingSq][bitscan(sliders)] & occupied;
+    if ((blockers & (blockers - 1)) == 0)
+      pinned |= blockers & friends;
+  }
+
+  // Pieces other than kings and pawns
+  for (int i = W_QUEEN; i <= W_KNIGHT; i++) {
+    Piece p = (Piece)(S::base + i);
+    for (U64 b = bbs[p] & ~pinned; b != 0; b &= b - 1) {
+      int from = bitscan(b);
+      for (U64 a = getAttackedSquares(p, from) & targets; a != 0;
+          a &= a - 1) {
+        int to = bitscan(a);
+        moves.push_back(Move(p, from, to, (checkers & (ONE << to))
+              ? MoveType::CAPTURE : MoveType::QUIET));
+      }
     }
-    // Capture left
-    if (file != 0) {
-      int left = front - 1;
-      if (left == epSquare) // ep capture left is possible
-        moves.push_back(Move(p, from, left, MoveType::EP_CAPTURE));
-      else if (enemies & (ONE << left)) // regular capture left is possible
-        addPawnMoves(moves, from, left);
+  }
+
+  // Pawns
+  const Piece p = (Piece)(S::base + W_PAWN);
+  U64 pawns = own[W_PAWN] & ~pinned;
+  U64 empty = ~occupied;
+  U64 single = shiftBy(pawns, S::push) & empty;
+  U64 doubles = shiftBy(single & S::thirdRank, S::push) & empty & targets;
+  U64 left = shiftBy(pawns, S::leftOffset) & NOT_FILE_H & checkers;
+  U64 right = shiftBy(pawns, S::rightOffset) & NOT_FILE_A & checkers;
+  single &= targets;
+
+  addPawnMoves(moves, p, single & ~S::lastRank, S::push, MoveType::QUIET);
+  addPawnMoves(moves, p, doubles, 2*S::push, MoveType::DOUBLE_PAWN_PUSH);
+  addPawnMoves(moves, p, left & ~S::lastRank, S::leftOffset,
+      MoveType::CAPTURE);
+  addPawnMoves(moves, p, right & ~S::lastRank, S::rightOffset,
+      MoveType::CAPTURE);
+  addPromotions(moves, p, single & S::lastRank, S::push, false);
+  addPromotions(moves, p, left & S::lastRank, S::leftOffset, true);
+  addPromotions(moves, p, right & S::lastRank, S::rightOffset, true);
+
+  // En passant can capture a pawn giving check. It removes two pawns from a
+  // rank, which can expose the king, so it is tested by making the move.
+  if (getEPFile() != -1) {
+    U64 epMask = ONE << (getEPFile() + S::epRank);
+    U64 all = own[W_PAWN];
+    size_t first = moves.size();
+    addPawnMoves(moves, p, shiftBy(all, S::leftOffset) & NOT_FILE_H & epMask,
+        S::leftOffset, MoveType::EP_CAPTURE);
+    addPawnMoves(moves, p, shiftBy(all, S::rightOffset) & NOT_FILE_A & epMask,
+        S::rightOffset, MoveType::EP_CAPTURE);
+    size_t legal = first;
+    for (size_t i = first; i < moves.size(); i++)
+      if (isLegalMoveAs<Us>(moves[i]))
+        moves[legal++] = moves[i];
+    moves.resize(legal);
+  }
+}
+
+// Returns the number of legal moves without generating them. Instead of
+// trying each move, the squares a piece may move to are restricted up front:
+// when in check, to the checking piece and the squares between it and the
+// king, and for pinned pieces, to the line of the pin. The count for each
+// piece is then a popcount. Only en passant, which can expose the king along
+// a rank, is tested by making the move. A player with no king has no king
+// moves or castling, and all the moves of its other pieces are counted.
+int Position::countLegalMoves() {
+  return countLegalMovesUpTo(INT_MAX);
+}
+
+// Returns true if the player to move has any legal move. King moves are tried
+// first, since they need no pin information, and the search stops at the
+// first move found.
+bool Position::hasLegalMove() {
+  return countLegalMovesUpTo(1) > 0;
+}
+
+// Does the work of countLegalMoves, but may stop counting as soon as limit
+// moves have been found.
+int Position::countLegalMovesUpTo(int limit) {
+  if (player == Color::WHITE)
+    return countLegalMovesAs<Color::WHITE>(limit);
+  else
+    return countLegalMovesAs<Color::BLACK>(limit);
+}
+
+// countLegalMovesUpTo for the given player to move.
+template<Color Us>
+int Position::countLegalMovesAs(int limit) {
+  typedef Side<Us> S;
+  const U64* own = bbs + S::base;
+  const U64* enemy = bbs + Side<S::them>::base;
+  U64 friends = getOccupied(Us);
+  U64 enemies = getOccupied(S::them);
+  U64 occupied = friends | enemies;
+  U64 king = own[W_KING];
+
+  // Squares the king may not step to. The king is removed from the board so
+  // that it cannot retreat along the ray of a slider giving check.
+  U64 danger = slidingAttacksSetwise(enemy[W_ROOK] | enemy[W_QUEEN],
+      enemy[W_BISHOP] | enemy[W_QUEEN], ~(occupied ^ king));
+  danger |= knightAttacksSetwise(enemy[W_KNIGHT]);
+  danger |= kingAttacksSetwise(enemy[W_KING]);
+  if (Us == Color::BLACK)
+    danger |= whitePawnAttacksSetwise(enemy[W_PAWN]);
+  else
+    danger |= blackPawnAttacksSetwise(enemy[W_PAWN]);
+
+  // Pieces giving check, and friendly pieces pinned to the king. A slider on
+  // a line with the king gives check if nothing is between them, and pins the
+  // piece between them if that is the only one and it is friendly. Without a
+  // king nothing is in check or pinned, so the moves of the other pieces are
+  // all counted, as getLegalMoves would generate them, and castling is not.
+  int count = 0;
+  U64 checkers = 0;
+  U64 checkMask = 0;
+  U64 pinned = 0;
+  U64 pinMask[64];
+  if (king != 0) {
+    int kingSq = bitscan(king);
+    count = popcount(MASKS.attackOnEmpty[W_KING][kingSq] & ~friends
+        & ~danger);
+    if (count >= limit)
+      return count;
+
+    checkers = (MASKS.attackOnEmpty[W_KNIGHT][kingSq] & enemy[W_KNIGHT])
+      | (getAttackedSquares((Piece)(S::base + W_PAWN), kingSq)
+        & enemy[W_PAWN]);
+    U64 sliders = (MASKS.attackOnEmpty[W_ROOK][kingSq]
+        & (enemy[W_ROOK] | enemy[W_QUEEN]))
+      | (MASKS.attackOnEmpty[W_BISHOP][kingSq]
+        & (enemy[W_BISHOP] | enemy[W_QUEEN]));
+    for (; sliders != 0; sliders &= sliders - 1) {
+      int sq = bitscan(sliders);
+      U64 between = MASKS.betweenMask[kingSq][sq];
+      U64 blockers = between & occupied;
+      if (blockers == 0) {
+        checkers |= ONE << sq;
+        checkMask = between;
+      }
+      else if ((blockers & (blockers - 1)) == 0 && (blockers & friends)) {
+        pinned |= blockers;
+        pinMask[bitscan(blockers)] = between | (ONE << sq);
+      }
     }
-    // Capture right
-    if (file != 7) {
-      int right = front + 1;
-      if (right == epSquare) // ep capture right is possible
-        moves.push_back(Move(p, from, right, MoveType::EP_CAPTURE));
-      else if (enemies & (ONE << right)) // regular capture right is possible
-        addPawnMoves(moves, from, right);
+  }
+
+  // In double check only the king can move
+  if (checkers & (checkers - 1))
+    return count;
+  if (checkers)
+    checkMask |= checkers;
+  else
+    checkMask = ~0ULL;
+  U64 targets = ~friends & checkMask;
+
+  // Pieces other than kings and pawns
+  for (int i = W_QUEEN; i <= W_KNIGHT; i++) {
+    Piece p = (Piece)(S::base + i);
+    for (U64 b = bbs[p]; b != 0; b &= b - 1) {
+      int from = bitscan(b);
+      U64 a = getAttackedSquares(p, from) & targets;
+      if (pinned & (ONE << from))
+        a &= pinMask[from];
+      count += popcount(a);
+      if (count >= limit)
+        return count;
     }
   }
 
-  // Add castling moves if appropriate
-  if (!inCheck(player)) {
-    addCastlingMoveIfAble(moves, player, -1);
-    addCastlingMoveIfAble(moves, player, 1);
+  // Pawns. Those which are not pinned are counted together.
+  U64 pawns = own[W_PAWN];
+  count += countPawnMoves<Us>(pawns & ~pinned, ~occupied, enemies, checkMask);
+  for (U64 b = pawns & pinned; b != 0; b &= b - 1) {
+    int from = bitscan(b);
+    count += countPawnMoves<Us>(ONE << from, ~occupied, enemies,
+        checkMask & pinMask[from]);
   }
+  if (count >= limit)
+    return count;
 
-  // Go through every move and exclude any which would leave the friendly king
-  // in check
-  std::vector<Move> legalMoves;
-  for (unsigned int i = 0; i < moves.size(); i++)
-    if (isLegalMove(moves[i]))
-      legalMoves.push_back(moves[i]);
-    
+  // En passant
+  if (getEPFile() != -1) {
+    int epSquare = getEPFile() + S::epRank;
+    const Piece pawn = (Piece)(S::base + W_PAWN);
+    U64 from = getAttackedSquares((Piece)(Side<S::them>::base + W_PAWN),
+        epSquare) & pawns;
+    for (; from != 0; from &= from - 1) {
+      Move m(pawn, bitscan(from), epSquare, MoveType::EP_CAPTURE);
+      if (isLegalMoveAs<Us>(m))
+        count++;
+    }
+  }
+  if (count >= limit)
+    return count;
+
+  // Castling, checked without making the moves: the right, an empty path
+  // between king and rook, and no attack on the squares the king crosses and
+  // lands on. Not being in check, the king cannot hide an attack on them.
+  if (king != 0 && !checkers && (flags & S::castlingRights)) {
+    if (canCastle(Us, -1) && !(occupied & S::longCastleEmpty)
+        && !(danger & S::longCastleSafe))
+      count++;
+    if (canCastle(Us, 1) && !(occupied & S::shortCastleEmpty)
+        && !(danger & S::shortCastleSafe))
+      count++;
+  }
 
-  return legalMoves;
+  return count;
 }
 
 // Searches the move list to see if one has a name that matches and returns its
@@ -428,6 +919,7 @@ int Position::lookupMove(std::string name, std::vector<Move>& moves) {
 
 // Assigns a name to every move in the vector.
 void Position::nameMoves(std::vector<Move>& moves) {
+  STAT_TIMER(TIMER_NAME_MOVES);
   for (unsigned int i = 0; i < moves.size(); i++) {
     // Assign a level 1 name
     nameMove(moves[i], 1);
@@ -493,6 +985,22 @@ void Position::nameMoves(std::vector<Move>& moves) {
   }
 }
 
+// Counts the leaf nodes of the legal move tree to the given depth.
+U64 Position::perft(int depth) {
+  if (depth == 0)
+    return 1;
+  if (depth == 1)
+    return countLegalMoves();
+  Arena& arena = Arena::forThread();
+  ArenaScope scope(arena);
+  MoveList moves{ArenaAllocator<Move>(arena)};
+  getLegalMoves(moves);
+  U64 nodes = 0;
+  for (unsigned int i = 0; i < moves.size(); i++)
+    nodes += afterMove(moves[i]).perft(depth - 1);
+  return nodes;
+}
+
 // Switches whose player's turn it is and returns that value.
 Color Position::switchPlayer() {
   if (player == Color::WHITE)
@@ -507,6 +1015,38 @@ U16 Position::getClock() {
   return clock;
 }
 
+// Returns the Zobrist key of the position, which is kept up to date as moves
+// are made and unmade.
+U64 Position::getKey() {
+  return key;
+}
+
+// Returns the Zobrist key of the pawns alone, which changes only when a pawn
+// moves, is captured or promotes.
+U64 Position::getPawnKey() {
+  return pawnKey;
+}
+
+// Calculates the Zobrist key from scratch.
+U64 Position::computeKey() {
+  U64 k = flagsKey(flags);
+  for (int p = 0; p < 12; p++)
+    for (U64 b = bbs[p]; b != 0; b &= b - 1)
+      k ^= ZOBRIST.pieces[p][bitscan(b)];
+  if (player == Color::BLACK)
+    k ^= ZOBRIST.side;
+  return k;
+}
+
+// Calculates the pawn key from scratch.
+U64 Position::computePawnKey() {
+  U64 k = 0;
+  for (int p = W_PAWN; p < 12; p += 6)
+    for (U64 b = bbs[p]; b != 0; b &= b - 1)
+      k ^= ZOBRIST.pieces[p][bitscan(b)];
+  return k;
+}
+
 // Returns if the current player is in check.
 bool Position::inCheck() {
   return inCheck(player);
@@ -517,6 +1057,19 @@ Color Position::getPlayer() {
   return player;
 }
 
+// Makes the position keep the accumulator up to date, starting by computing
+// it from scratch. Pass null to stop.
+void Position::setAccumulator(Accumulator* acc) {
+  accumulator = acc;
+  if (accumulator)
+    accumulator->refresh(bbs);
+}
+
+// Returns the accumulator kept for this position, or null.
+Accumulator* Position::getAccumulator() {
+  return accumulator;
+}
+
 // Returns the 0-indexed file on which en-passant is possible, or -1 if en
 // passant is unavailable.
 int Position::getEPFile() {
@@ -533,43 +1086,36 @@ void Position::setEPFile(int f) {
     flags &= 0xf0;
     return;
   }
+  flags &= 0xf0;
   flags |= (U8)f;
   flags |= 0x08;
 }
 
-// Disables the castling rights on the given side and color. Use -1 for
-// queenside, +1 for kingside, or 0 for both.
-void Position::setCastlingFlag(int side, Color c) {
-  // Disable long castle
-  if (side <= 0) {
-    if (c == Color::WHITE)
-      flags &= 0x7f;
-    else
-      flags &= 0xdf;
-  }
-  // Disable short castle
-  if (side >= 0) {
-    if (c == Color::WHITE)
-      flags &= 0xbf;
-    else
-      flags &= 0xef;
-  }
-}
-
 // Updates bitboards to put the piece in the given square.
 void Position::placePiece(Piece piece, int square) {
   if (piece == Piece::NO_PIECE)
     return;
   U64 mask = ONE << square;
   bbs[piece] |= mask;
+  key ^= ZOBRIST.pieces[piece][square];
+  if (piece % 6 == W_PAWN)
+    pawnKey ^= ZOBRIST.pieces[piece][square];
+  if (accumulator)
+    accumulator->add(piece, square);
 }
 
-// Moves the Piece from one square to the other
+// Moves the Piece from one square to the other. The accumulator is updated
+// for both squares at once.
 void Position::movePiece(Piece piece, int from, int to) {
   if (piece == Piece::NO_PIECE)
     return;
-  removePiece(piece, from);
-  placePiece(piece, to);
+  bbs[piece] ^= (ONE << from) | (ONE << to);
+  U64 change = ZOBRIST.pieces[piece][from] ^ ZOBRIST.pieces[piece][to];
+  key ^= change;
+  if (piece % 6 == W_PAWN)
+    pawnKey ^= change;
+  if (accumulator)
+    accumulator->move(piece, from, to);
 }
 
 // Returns the Piece at the given square, which may be NO_PIECE
@@ -585,10 +1131,17 @@ Piece Position::getPiece(int square) {
 
 // Like getPiece, but also removes that piece from the bitboard.
 Piece Position::removePiece(int square) {
+  STAT_INC(STAT_REMOVE_PIECE_SCANS);
   U64 mask = ONE << square;
   for (int i = 0; i < 12; i++) {
+    STAT_INC(STAT_REMOVE_PIECE_SCAN_STEPS);
     if (bbs[i] & mask) {
       bbs[i] ^= mask;
+      key ^= ZOBRIST.pieces[i][square];
+      if (i % 6 == W_PAWN)
+        pawnKey ^= ZOBRIST.pieces[i][square];
+      if (accumulator)
+        accumulator->remove((Piece)i, square);
       return (Piece)i;
     }
   }
@@ -602,6 +1155,11 @@ Piece Position::removePiece(Piece piece, int square) {
     return Piece::NO_PIECE;
   U64 mask = ~(ONE << square);
   bbs[piece] &= mask;
+  key ^= ZOBRIST.pieces[piece][square];
+  if (piece % 6 == W_PAWN)
+    pawnKey ^= ZOBRIST.pieces[piece][square];
+  if (accumulator)
+    accumulator->remove(piece, square);
   return piece;
 }
 
@@ -616,39 +1174,52 @@ U64 Position::getAttackedSquares(Piece piece, int sq) {
   if (piece == Piece::NO_PIECE)
     return 0;
 
+  // Pawn captures, masking off those which would wrap around to the other
+  // edge of the board
+  U64 s = ONE << sq;
   if (piece == Piece::W_PAWN)
-    return (ONE << (sq + 7)) | (ONE << (sq + 9));
+    return ((s << 7) & 0x7f7f7f7f7f7f7f7fULL) | ((s << 9) & 0xfefefefefefefefeULL);
   else if (piece == Piece::B_PAWN)
-    return (ONE << (sq - 9)) | (ONE << (sq - 7));
+    return ((s >> 9) & 0x7f7f7f7f7f7f7f7fULL) | ((s >> 7) & 0xfefefefefefefefeULL);
 
+  STAT_INC(STAT_ATTACK_LOOKUPS);
   Piece p = makeColor(piece, Color::WHITE);
 
   // Blockers and beyond algorithm
-  U64 a = attackOnEmpty[p][sq];
-  for (U64 b = getOccupied() & blockerMask[p][sq]; b != 0; b &= (b - 1)) {
+  U64 a = MASKS.attackOnEmpty[p][sq];
+  for (U64 b = getOccupied() & MASKS.blockerMask[p][sq]; b != 0; b &= (b - 1)) {
+    STAT_INC(STAT_BLOCKER_ITERATIONS);
     int blockerSquare = bitscan(b);
-    a &= ~behindMask[sq][blockerSquare];
+    a &= ~MASKS.behindMask[sq][blockerSquare];
   }
 
   return a;
 }
 
 // Like the above method, but this returns the union of all attacks available
-// for the given player.
+// for the given player. All pieces of a kind are handled at once with
+// set-wise shifts and fills, so the cost does not grow with the number of
+// pieces.
 U64 Position::getAttackedSquares(Color c) {
-  U64 a = 0;
-  // For each piece type
-  for (int i = 0; i < 6; i++) {
-    Piece p = (Piece)(i + 6*(int)c);
-    // For each piece of that type
-    for (U64 b = bbs[p]; b != 0; b &= b - 1) {
-      int sq = bitscan(b);
-      a |= getAttackedSquares(p, sq);
-    }
-  }
+  STAT_INC(STAT_COLOR_ATTACK_MAPS);
+  STAT_TIMER(TIMER_COLOR_ATTACK_MAP);
+  const U64* own = bbs + 6*(int)c;
+  U64 a = slidingAttacksSetwise(own[W_ROOK] | own[W_QUEEN],
+      own[W_BISHOP] | own[W_QUEEN], ~getOccupied());
+  a |= knightAttacksSetwise(own[W_KNIGHT]);
+  a |= kingAttacksSetwise(own[W_KING]);
+  if (c == Color::WHITE)
+    a |= whitePawnAttacksSetwise(own[W_PAWN]);
+  else
+    a |= blackPawnAttacksSetwise(own[W_PAWN]);
   return a;
 }
 
+// Returns the bitboard of the given piece.
+U64 Position::getBitboard(Piece p) {
+  return bbs[p];
+}
+
 // Returns the union of all piece bitboards.
 U64 Position::getOccupied() {
   U64 b = 0;
@@ -681,16 +1252,30 @@ bool Position::inCheck(Color c) {
 bool Position::inCheckmate() {
   if (!inCheck(player))
     return false;
-  return getLegalMoves().size() == 0;
+  return !hasLegalMove();
 }
 
 // Returns true if the given move would not leave the friendly king in check.
 // It is assumed that the move otherwise accords with the rules of piece
 // movement in chess. 
 bool Position::isLegalMove(Move& move) {
-  makeMove(move);
-  bool v = !inCheck(oppositeColor(player));
-  unmakeMove(move);
+  if (player == Color::WHITE)
+    return isLegalMoveAs<Color::WHITE>(move);
+  else
+    return isLegalMoveAs<Color::BLACK>(move);
+}
+
+// isLegalMove for the given player to move.
+template<Color Us>
+bool Position::isLegalMoveAs(Move& move) {
+  STAT_INC(STAT_LEGALITY_CHECKS);
+  STAT_TIMER(TIMER_IS_LEGAL_MOVE);
+  Position next = *this;
+  next.accumulator = nullptr;
+  next.makeMoveAs<Us>(move);
+  bool v = !next.inCheck(Us);
+  if (!v)
+    STAT_INC(STAT_LEGALITY_REJECTIONS);
   return v;
 }
 
@@ -717,7 +1302,8 @@ bool Position::canCastle(Color c, int dir) {
 // Note that this function does NOT consider whether the king is in check to
 // begin with (caller should determine this), or if it will end up in check 
 // (the move list will eventually be cleared of those sorts of moves)
-void Position::addCastlingMoveIfAble(std::vector<Move>& v, Color c, int dir) {
+template<class List>
+void Position::addCastlingMoveIfAble(List& v, Color c, int dir) {
   // Check if player has right to castle
   if (!canCastle(c, dir))
     return;
@@ -727,7 +1313,7 @@ void Position::addCastlingMoveIfAble(std::vector<Move>& v, Color c, int dir) {
   if (c == Color::WHITE && dir < 0) mask = 0x000000000000000e;
   else if (c == Color::WHITE && dir >= 0) mask = 0x0000000000000060;
   else if (c == Color::BLACK && dir < 0) mask = 0x0e00000000000000;
-  else if (c == Color::BLACK && dir >= 0) mask = 0x6000000000000000;
+  else mask = 0x6000000000000000;
   if (getOccupied() & mask)
     return;
 
@@ -736,7 +1322,7 @@ void Position::addCastlingMoveIfAble(std::vector<Move>& v, Color c, int dir) {
   if (c == Color::WHITE && dir < 0) sq = 3;
   else if (c == Color::WHITE && dir >= 0) sq = 5;
   else if (c == Color::BLACK && dir < 0) sq = 59;
-  else if (c == Color::BLACK && dir >= 0) sq = 61;
+  else sq = 61;
   U64 a = getAttackedSquares(oppositeColor(c));
   if (a & (ONE << sq))
     return;
@@ -847,7 +1433,7 @@ std::string Position::nameMove(Move& move, int nameLevel) {
   // To find out if + or # is needed, we must simulate the move.
   makeMove(move);
   if (inCheck(player)) {
-    if (getLegalMoves().size() == 0)
+    if (!hasLegalMove())
       name = name + '#';
     else
       name = name + '+';
@@ -857,190 +1443,51 @@ std::string Position::nameMove(Move& move, int nameLevel) {
   return name;
 }
 
-// Populates the attackOnEmpty array
-void Position::populateMaskArrays() {
-  for (int f = 0; f < 8; f++) {
-    for (int r = 0; r < 8; r++) {
-      int sq = frToSquare(f, r);
-      // Attack on otherwise empty bitboards
-      U64 rook = calculateRookAttackOnEmpty(f, r);
-      U64 bishop = calculateBishopAttackOnEmpty(f, r);
-      attackOnEmpty[Piece::W_ROOK][sq] = rook;
-      attackOnEmpty[Piece::W_BISHOP][sq] = bishop;
-      attackOnEmpty[Piece::W_QUEEN][sq] = rook | bishop;
-      attackOnEmpty[Piece::W_KING][sq] = calculateKingAttackOnEmpty(f, r);
-      attackOnEmpty[Piece::W_KNIGHT][sq] = calculateKnightAttackOnEmpty(f, r);
-
-      // "Blockers and beyond" bitboards
-      U64 rookBlocker = calculateRookBlockerMask(f, r);
-      U64 bishopBlocker = calculateBishopBlockerMask(f, r);
-      blockerMask[Piece::W_ROOK][sq] = rookBlocker;
-      blockerMask[Piece::W_BISHOP][sq] = bishopBlocker;
-      blockerMask[Piece::W_QUEEN][sq] = rookBlocker | bishopBlocker;
-      // std::cout << "Queen blockers on " << f << r << std::endl;
-      // printBitBoard(queenBlocker);
-
-      // Behind masks
-      int fDir[8] = {-1, 0, 1, -1, 1, -1, 0, 1};
-      int rDir[8] = {1, 1, 1, 0, 0, -1, -1, -1};
-      for (int i = 0; i < 8; i++) {
-        for (int toF = f + fDir[i], toR = r + rDir[i];
-            inBounds(toF, toR);
-            toF += fDir[i], toR += rDir[i]) {
-          U64 b = calculateBehindMask(f, r, toF, toR);
-          behindMask[sq][frToSquare(toF, toR)] = b;
-        }
-      }
-    }
+// Adds a pawn move of the given type to each square in targets. The origin of
+// each move is offset squares behind its target.
+template<class List>
+void Position::addPawnMoves(List& moves, Piece pawn, U64 targets, int offset,
+    MoveType type) {
+  for (; targets != 0; targets &= targets - 1) {
+    int to = bitscan(targets);
+    moves.push_back(Move(pawn, to - offset, to, type));
   }
 }
 
-// Generates the bitboard of rook attacks on an otherwise empty board with a
-// rook on the given file and rank.
-U64 Position::calculateRookAttackOnEmpty(int f, int r) {
-  U64 b = 0;
-  // Attacks along file
-  for (int i = 0; i < 8; i++)
-    b ^= ONE << (8*i + f);
-  // Attacks along rank
-  b ^= 0x00000000000000ffULL << (8*r);
-  // Note that the rook's square gets xor'd twice and ends up as 0, as it
-  // should.
-  return b;
-}
-
-// Generates the bitboard of bishop attacks on an otherwise empty board with a
-// bishop on the given file and rank
-U64 Position::calculateBishopAttackOnEmpty(int f, int r) {
-  U64 b = 0;
-  int df[4] = {-1, 1, 1, -1};
-  int dr[4] = {1, 1, -1, -1};
-  // Loop for each of 4 directions
-  for (int i = 0; i < 4; i++) {
-    int tf = f;
-    int tr = r;
-    while (inBounds(tf += df[i], tr += dr[i])) {
-      int sq = frToSquare(tf, tr);
-      b |= ONE << sq;
-    }
-  }
-  return b;
+// Counts the moves of the given pawns (other than en passant) whose target
+// squares are in allowed. Promotions count once for each piece.
+template<Color Us>
+int Position::countPawnMoves(U64 pawns, U64 empty, U64 enemies, U64 allowed) {
+  typedef Side<Us> S;
+  U64 single = shiftBy(pawns, S::push) & empty;
+  U64 doubles = shiftBy(single & S::thirdRank, S::push) & empty;
+
+  // Captures are kept per direction, since two pawns can capture on the same
+  // square
+  U64 captures[2] = {
+    shiftBy(pawns, S::leftOffset) & NOT_FILE_H & enemies & allowed,
+    shiftBy(pawns, S::rightOffset) & NOT_FILE_A & enemies & allowed
+  };
+  single &= allowed;
+
+  int count = popcount(single) + 3*popcount(single & S::lastRank)
+    + popcount(doubles & allowed);
+  for (int i = 0; i < 2; i++)
+    count += popcount(captures[i]) + 3*popcount(captures[i] & S::lastRank);
+  return count;
 }
 
-// Generates the bitboard of king attacks on an otherwise empty board with a
-// king on the given file and rank
-U64 Position::calculateKingAttackOnEmpty(int f, int r) {
-  U64 b = 0;
-  int df[8] = {-1, 0, 1, -1, 1, -1, 0, 1};
-  int dr[8] = {1, 1, 1, 0, 0, -1, -1, -1};
-  for (int i = 0; i < 8; i++) {
-    if (inBounds(f + df[i], r + dr[i])) {
-      int sq = frToSquare(f + df[i], r + dr[i]);
-      b |= ONE << sq;
-    }
+// Like addPawnMoves, but adds all four promotions for each target.
+template<class List>
+void Position::addPromotions(List& moves, Piece pawn, U64 targets, int offset,
+    bool isCapture) {
+  int base = isCapture ? MoveType::KNIGHT_PROMOTION_CAPTURE
+    : MoveType::KNIGHT_PROMOTION;
+  for (; targets != 0; targets &= targets - 1) {
+    int to = bitscan(targets);
+    for (int i = 0; i < 4; i++)
+      moves.push_back(Move(pawn, to - offset, to, (MoveType)(base + i)));
   }
-  return b;
-}
-
-// Generates the bitboard of knight attacks on an otherwise empty board with a
-// knight on the given file and rank
-U64 Position::calculateKnightAttackOnEmpty(int f, int r) {
-  U64 b = 0;
-  int df[8] = {-1, 1, -2, 2, -2, 2, -1, 1};
-  int dr[8] = {2, 2, 1, 1, -1, -1, -2, -2};
-  for (int i = 0; i < 8; i++) {
-    if (inBounds(f + df[i], r + dr[i])) {
-      int sq = frToSquare(f + df[i], r + dr[i]);
-      b |= ONE << sq;
-    }
-  }
-  return b;
-}
-
-// Calculates the "blockers and beyond" mask for a rook on the given file and
-// rank.
-U64 Position::calculateRookBlockerMask(int f, int r) {
-  U64 b = 0;
-  // Attacks along file, ignoring outermost two
-  for (int i = 1; i <= 6; i++)
-    b |= ONE << (8*i + f);
-  // Attacks along rank, ignoring outermost two
-  b |= 0x000000000000007eULL << (8*r);
-  // Eliminate rook's own square
-  int sq = frToSquare(f, r);
-  b &= ~(ONE << sq);
-  return b;
-} 
-
-// Calculates the "blockers and beyond" mask for a bishop on the given file and
-// rank.
-U64 Position::calculateBishopBlockerMask(int f, int r) {
-  U64 b = calculateBishopAttackOnEmpty(f, r);
-  return b &= 0x007e7e7e7e7e7e00ull;
-}
-
-// Calculates the "behind" mask from one square to another. This mask is all
-// 1's along the ray from the "from" point to the "to" point, but only behind
-// the "to" point. It is assumed that the two points can be connected by a
-// queen move, unless the two points are equal, in which case this just returns
-// 0.
-U64 Position::calculateBehindMask(int fromF, int fromR, int toF, int toR) {
-
-  if (fromF == toF && fromR == toR)
-    return 0;
-
-  int fDir = 0;
-  int rDir = 0;
-  if (fromR < toR) // north
-    rDir = 1;
-  else if (fromR > toR) // south
-    rDir = -1;
-  if (fromF < toF) // east
-    fDir = 1;
-  else if (fromF > toF) // west
-    fDir = -1;
-
-  U64 b = 0;
-  for (int f = toF + fDir, r = toR + rDir; 
-      inBounds(f, r); f += fDir, r += rDir) {
-    b |= ONE << frToSquare(f,r);
-  }
-  return b;
-}
-
-// Given a to and from square, adds all of the possible pawn moves between the
-// two. ie, it will either just add one move if it is not a promotion, or it
-// will add four moves (one per promotion). Double pawn pushes and captures en
-// passant should be handled some other way.
-void Position::addPawnMoves(std::vector<Move>& moves, int from, int to) {
-  Piece pawn = (from < to) ? Piece::W_PAWN : Piece::B_PAWN;
-  bool isPromotion = false;
-  bool isCapture = false;
-  if (squareToRank(to) == 0 || squareToRank(to) == 7)
-    isPromotion = true;
-  if (squareToFile(from) != squareToFile(to))
-    isCapture = true;
-
-  // Promotions with Capture
-  if (isPromotion && isCapture) {
-    moves.push_back(Move(pawn, from, to, MoveType::KNIGHT_PROMOTION_CAPTURE));
-    moves.push_back(Move(pawn, from, to, MoveType::BISHOP_PROMOTION_CAPTURE));
-    moves.push_back(Move(pawn, from, to, MoveType::ROOK_PROMOTION_CAPTURE));
-    moves.push_back(Move(pawn, from, to, MoveType::QUEEN_PROMOTION_CAPTURE));
-  }
-  // Promotions without Capture
-  else if (isPromotion) {
-    moves.push_back(Move(pawn, from, to, MoveType::KNIGHT_PROMOTION));
-    moves.push_back(Move(pawn, from, to, MoveType::BISHOP_PROMOTION));
-    moves.push_back(Move(pawn, from, to, MoveType::ROOK_PROMOTION));
-    moves.push_back(Move(pawn, from, to, MoveType::QUEEN_PROMOTION));
-  }
-  // Captures without Promotion
-  else if (isCapture)
-    moves.push_back(Move(pawn, from, to, MoveType::CAPTURE));
-  // Neither capture nor promotion
-  else
-    moves.push_back(Move(pawn, from, to, MoveType::QUIET));
 }
 
 // Returns if the given file-rank coordinate is inbounds
@@ -1135,18 +1582,6 @@ Color Position::oppositeColor(Color c) {
     return Color::WHITE;
 }
 
-U64 Position::deb = 0x03f79d71b4cb0a89;
-int Position::debArray[64] = {
-  0,  1, 48,  2, 57, 49, 28,  3,
-  61, 58, 50, 42, 38, 29, 17,  4,
-  62, 55, 59, 36, 53, 51, 43, 22,
-  45, 39, 33, 30, 24, 18, 12,  5,
-  63, 47, 56, 27, 60, 41, 37, 16,
-  54, 35, 52, 21, 44, 32, 23, 11,
-  46, 26, 40, 15, 34, 20, 31, 10,
-  25, 14, 19,  9, 13,  8,  7,  6
-};
-
 // Returns the index of the least significant 1 bit in the given U64. Returns
 // -1 if the U64 is all 0.
 int Position::bitscan(U64 bb) {
@@ -1156,3 +1591,8 @@ int Position::bitscan(U64 bb) {
   }
   return debArray[((bb & -bb) * deb) >> 58];
 }
+
+// Returns the number of set bits.
+int Position::popcount(U64 b) {
+  return __builtin_popcountll(b);
+}
@@ -0,0 +1,447 @@
+#include "regression.h"
+#include "attacks.h"
+#include "batch.h"
+#include "position.h"
+#include "server.h"
+#include "types.h"
+#include "move.h"
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <filesystem>
+#include <fstream>
+#include <iomanip>
+#include <iostream>
+#include <map>
+#include <random>
+#include <sstream>
+#include <thread>
+#include <vector>
+
+// Outcome of running one suite
+struct SuiteResult {
+  std::string name;
+  std::string path;
+  bool measured = false;
+  std::vector<std::string> failures;
+  U64 nodes = 0;
+  double seconds = 0;
+
+  double nps() {
+    return seconds > 0 ? nodes / seconds : 0;
+  }
+};
+
+// Reads the non-empty, non-comment lines of the file along with their line
+// numbers. Returns false if the file cannot be opened.
+static bool readLines(std::string path,
+    std::vector<std::pair<int, std::string>>& lines) {
+  std::ifstream file(path);
+  if (!file.is_open())
+    return false;
+  std::string line;
+  int lineNum = 0;
+  while (getline(file, line)) {
+    lineNum++;
+    if (line.size() == 0 || line[0] == '#')
+      continue;
+    lines.push_back(std::make_pair(lineNum, line));
+  }
+  return true;
+}
+
+// Makes each listed move in turn, checking that it is legal and that making
+// and unmaking it leaves the position untouched. At the end every move is
+// unmade and the starting position must be restored.
+static void runMakeMoveSuite(SuiteResult& r,
+    std::vector<std::pair<int, std::string>>& lines) {
+  Position p(lines[0].second);
+  std::string start = p.getFEN();
+  std::vector<Move> made;
+
+  for (unsigned int i = 1; i < lines.size(); i++) {
+    std::istringstream in(lines[i].second);
+    int from, to, type;
+    if (!(in >> from >> to >> type)) {
+      r.failures.push_back("line " + std::to_string(lines[i].first)
+          + ": cannot parse move");
+      return;
+    }
+
+    std::vector<Move> moves = p.getLegalMoves();
+    r.nodes += moves.size();
+    int m = -1;
+    for (unsigned int j = 0; j < moves.size(); j++) {
+      if (moves[j].getFrom() == from && moves[j].getTo() == to
+          && moves[j].getType() == type)
+        m = j;
+    }
+    if (m == -1) {
+      r.failures.push_back("line " + std::to_string(lines[i].first)
+          + ": move is not legal in " + p.getFEN());
+      return;
+    }
+
+    std::string before = p.getFEN();
+    p.makeMove(moves[m]);
+    p.unmakeMove(moves[m]);
+    if (p.getFEN() != before) {
+      r.failures.push_back("line " + std::to_string(lines[i].first)
+          + ": unmake gave " + p.getFEN() + ", expected " + before);
+      return;
+    }
+    p.makeMove(moves[m]);
+    made.push_back(moves[m]);
+  }
+
+  while (made.size() > 0) {
+    p.unmakeMove(made.back());
+    made.pop_back();
+  }
+  if (p.getFEN() != start)
+    r.failures.push_back("unmaking every move gave " + p.getFEN()
+        + ", expected " + start);
+}
+
+// Checks the number of legal moves in each position, both generated and
+// counted.
+static void runMoveGenSuite(SuiteResult& r,
+    std::vector<std::pair<int, std::string>>& lines) {
+  for (unsigned int i = 0; i < lines.size(); i++) {
+    size_t comma = lines[i].second.find(",");
+    if (comma == std::string::npos) {
+      r.failures.push_back("line " + std::to_string(lines[i].first)
+          + ": formatting error");
+      continue;
+    }
+    Position p(lines[i].second.substr(0, comma));
+    int numMoves = p.getLegalMoves().size();
+    int expected = std::stoi(lines[i].second.substr(comma + 1));
+    r.nodes += numMoves;
+    if (numMoves != expected) {
+      r.failures.push_back("line " + std::to_string(lines[i].first)
+          + ": expected " + std::to_string(expected) + " moves, got "
+          + std::to_string(numMoves));
+    }
+    else if (p.countLegalMoves() != numMoves) {
+      r.failures.push_back("line " + std::to_string(lines[i].first)
+          + ": generated " + std::to_string(numMoves) + " moves, counted "
+          + std::to_string(p.countLegalMoves()));
+    }
+  }
+}
+
+// Counts perft nodes to each listed depth.
+static void runPerftSuite(SuiteResult& r,
+    std::vector<std::pair<int, std::string>>& lines) {
+  Position p(lines[0].second);
+  for (unsigned int i = 1; i < lines.size(); i++) {
+    std::istringstream in(lines[i].second);
+    int depth;
+    U64 expected;
+    if (!(in >> depth >> expected)) {
+      r.failures.push_back("line " + std::to_string(lines[i].first)
+          + ": cannot parse depth and node count");
+      continue;
+    }
+    U64 nodes = p.perft(depth);
+    r.nodes += nodes;
+    if (nodes != expected) {
+      r.failures.push_back("depth " + std::to_string(depth) + ": expected "
+          + std::to_string(expected) + " nodes, got " + std::to_string(nodes));
+    }
+  }
+}
+
+// Squares attacked by the sliders, traced one ray at a time.
+static U64 traceSlidingAttacks(U64 orthogonal, U64 diagonal, U64 occupied) {
+  const int directions[8][2] = {{0, 1}, {0, -1}, {1, 0}, {-1, 0},
+    {1, 1}, {1, -1}, {-1, 1}, {-1, -1}};
+  U64 a = 0;
+  for (int sq = 0; sq < 64; sq++) {
+    for (int d = 0; d < 8; d++) {
+      U64 sliders = (d < 4) ? orthogonal : diagonal;
+      if (!(sliders & (ONE << sq)))
+        continue;
+      int f = sq % 8 + directions[d][0], rk = sq / 8 + directions[d][1];
+      for (; f >= 0 && f < 8 && rk >= 0 && rk < 8;
+          f += directions[d][0], rk += directions[d][1]) {
+        a |= ONE << (8*rk + f);
+        if (occupied & (ONE << (8*rk + f)))
+          break;
+      }
+    }
+  }
+  return a;
+}
+
+// Compares the set-wise sliding attacks, both as dispatched (the vector
+// kernel where the CPU has one) and in the portable version, with attacks
+// traced ray by ray on random boards. Each line is "seed boards".
+static void runAttacksSuite(SuiteResult& r,
+    std::vector<std::pair<int, std::string>>& lines) {
+  for (unsigned int i = 0; i < lines.size(); i++) {
+    std::istringstream in(lines[i].second);
+    U64 seed;
+    int boards;
+    if (!(in >> seed >> boards)) {
+      r.failures.push_back("line " + std::to_string(lines[i].first)
+          + ": cannot parse seed and board count");
+      continue;
+    }
+    std::mt19937_64 rng(seed);
+    for (int b = 0; b < boards; b++) {
+      U64 occupied = rng() & rng();
+      U64 orthogonal = occupied & rng() & rng();
+      U64 diagonal = occupied & rng() & rng();
+      U64 expected = traceSlidingAttacks(orthogonal, diagonal, occupied);
+      U64 dispatched = slidingAttacksSetwise(orthogonal, diagonal, ~occupied);
+      U64 scalar = slidingAttacksScalar(orthogonal, diagonal, ~occupied);
+      r.nodes++;
+      if (dispatched != expected || scalar != expected) {
+        std::ostringstream msg;
+        msg << "line " << lines[i].first << ": board " << b << " (sliders "
+          << std::hex << orthogonal << " " << diagonal << ", occupied "
+          << occupied << ") gave " << dispatched << " and " << scalar
+          << ", expected " << expected;
+        r.failures.push_back(msg.str());
+        return;
+      }
+    }
+  }
+}
+
+// Squares attacked by the side, one piece at a time.
+static U64 pieceByPieceAttacks(Position& p, Color c) {
+  U64 a = 0;
+  for (int i = 0; i < 6; i++) {
+    Piece piece = (Piece)(6*c + i);
+    for (U64 b = p.getBitboard(piece); b != 0; b &= b - 1)
+      a |= p.getAttackedSquares(piece, Position::bitscan(b));
+  }
+  return a;
+}
+
+// Compares PositionBatch, with every attack kernel the CPU can run, against
+// the single position API on positions from random games. Each line is
+// "seed positions".
+static void runBatchSuite(SuiteResult& r,
+    std::vector<std::pair<int, std::string>>& lines) {
+  const PositionBatch::Kernel kernels[4] = {PositionBatch::AUTO,
+    PositionBatch::AVX512, PositionBatch::AVX2, PositionBatch::GENERIC};
+  const char* kernelNames[4] = {"auto", "avx512", "avx2", "generic"};
+  for (unsigned int i = 0; i < lines.size(); i++) {
+    std::istringstream in(lines[i].second);
+    U64 seed;
+    int count;
+    if (!(in >> seed >> count)) {
+      r.failures.push_back("line " + std::to_string(lines[i].first)
+          + ": cannot parse seed and position count");
+      continue;
+    }
+    std::mt19937_64 rng(seed);
+    std::vector<Position> positions;
+    Position p;
+    p.initPieces();
+    while ((int)positions.size() < count) {
+      std::vector<Move> moves = p.getLegalMoves();
+      if (moves.empty() || p.getClock() >= 100) {
+        p.initPieces();
+        continue;
+      }
+      positions.push_back(p);
+      p.makeMove(moves[rng() % moves.size()]);
+    }
+
+    PositionBatch batch;
+    for (unsigned int j = 0; j < positions.size(); j++)
+      batch.add(positions[j]);
+    for (int k = 0; k < 4; k++) {
+      if (!PositionBatch::isKernelSupported(kernels[k]))
+        continue;
+      batch.compute(true, kernels[k]);
+      for (unsigned int j = 0; j < positions.size(); j++) {
+        Position& q = positions[j];
+        r.nodes++;
+        if (batch.getOccupied(j) != q.getOccupied()
+            || batch.getAttacks(j, WHITE) != pieceByPieceAttacks(q, WHITE)
+            || batch.getAttacks(j, BLACK) != pieceByPieceAttacks(q, BLACK)
+            || batch.inCheck(j) != q.inCheck()
+            || batch.getLegalMoveCount(j) != (int)q.getLegalMoves().size()) {
+          r.failures.push_back("line " + std::to_string(lines[i].first)
+              + ": " + kernelNames[k] + " kernel differs on " + q.getFEN());
+          return;
+        }
+      }
+    }
+  }
+}
+
+// Sends the requests to the game server's request handler, in order, and
+// checks each reply. Each line is "request => reply".
+static void runServerSuite(SuiteResult& r,
+    std::vector<std::pair<int, std::string>>& lines) {
+  std::vector<std::string> requests, expected;
+  for (unsigned int i = 0; i < lines.size(); i++) {
+    size_t arrow = lines[i].second.find(" => ");
+    if (arrow == std::string::npos) {
+      r.failures.push_back("line " + std::to_string(lines[i].first)
+          + ": expected \"request => reply\"");
+      return;
+    }
+    requests.push_back(lines[i].second.substr(0, arrow));
+    expected.push_back(lines[i].second.substr(arrow + 4));
+  }
+  std::vector<std::string> replies = replayServerRequests(requests);
+  for (unsigned int i = 0; i < requests.size(); i++) {
+    r.nodes++;
+    std::string reply = (i < replies.size()) ? replies[i] : "(no reply)";
+    if (reply != expected[i])
+      r.failures.push_back("line " + std::to_string(lines[i].first) + ": "
+          + requests[i] + " gave \"" + reply + "\", expected \""
+          + expected[i] + "\"");
+  }
+}
+
+// Runs the suite stored in r.path, timing it.
+static void runSuite(SuiteResult& r) {
+  std::vector<std::pair<int, std::string>> lines;
+  if (!readLines(r.path, lines) || lines.size() == 0) {
+    r.failures.push_back("unable to read " + r.path);
+    return;
+  }
+
+  auto start = std::chrono::steady_clock::now();
+  if (r.name.rfind("makemove_", 0) == 0)
+    runMakeMoveSuite(r, lines);
+  else if (r.name.rfind("movegen_", 0) == 0)
+    runMoveGenSuite(r, lines);
+  else if (r.name.rfind("attacks_", 0) == 0)
+    runAttacksSuite(r, lines);
+  else if (r.name.rfind("batch_", 0) == 0)
+    runBatchSuite(r, lines);
+  else if (r.name.rfind("server_", 0) == 0)
+    runServerSuite(r, lines);
+  else {
+    runPerftSuite(r, lines);
+    r.measured = true;
+  }
+  std::chrono::duration<double> d = std::chrono::steady_clock::now() - start;
+  r.seconds = d.count();
+}
+
+// Reads "suite nps" pairs from the baseline file.
+static std::map<std::string, double> readBaseline(std::string path) {
+  std::map<std::string, double> baseline;
+  std::vector<std::pair<int, std::string>> lines;
+  readLines(path, lines);
+  for (unsigned int i = 0; i < lines.size(); i++) {
+    std::istringstream in(lines[i].second);
+    std::string name;
+    double nps;
+    if (in >> name >> nps)
+      baseline[name] = nps;
+  }
+  return baseline;
+}
+
+// Writes the nodes per second of every measured suite to the baseline file.
+static void writeBaseline(std::string path, std::vector<SuiteResult>& results) {
+  std::ofstream file(path);
+  file << "# Nodes per second of each perft suite, as measured by" << std::endl;
+  file << "#   bin/main test --update-baseline" << std::endl;
+  file << "# A suite fails when it runs more than the tolerance below this."
+    << std::endl;
+  for (unsigned int i = 0; i < results.size(); i++) {
+    if (results[i].measured && results[i].failures.size() == 0)
+      file << results[i].name << " " << (U64)results[i].nps() << std::endl;
+  }
+}
+
+// Runs every suite in the test directory and prints a report. Returns the
+// process exit code: 0 if everything passed.
+int runRegressionTests(RegressionOptions& opt) {
+  // Collect the suites
+  std::vector<SuiteResult> results;
+  std::error_code ec;
+  for (auto& entry : std::filesystem::directory_iterator(opt.directory, ec)) {
+    std::string name = entry.path().stem().string();
+    if (entry.path().extension() != ".txt")
+      continue;
+    if (name.rfind("makemove_", 0) != 0 && name.rfind("movegen_", 0) != 0
+        && name.rfind("perft_", 0) != 0 && name.rfind("attacks_", 0) != 0
+        && name.rfind("batch_", 0) != 0 && name.rfind("server_", 0) != 0)
+      continue;
+    if (name.find(opt.filter) == std::string::npos)
+      continue;
+    SuiteResult r;
+    r.name = name;
+    r.path = entry.path().string();
+    results.push_back(r);
+  }
+  if (results.size() == 0) {
+    std::cout << "No test suites found in " << opt.directory << std::endl;
+    return 1;
+  }
+  std::sort(results.begin(), results.end(),
+      [](const SuiteResult& a, const SuiteResult& b) { return a.name < b.name; });
+
+  // Run them in parallel
+  int numThreads = opt.threads;
+  if (numThreads <= 0)
+    numThreads = std::max(1u, std::thread::hardware_concurrency());
+  numThreads = std::min(numThreads, (int)results.size());
+  std::atomic<int> next(0);
+  std::vector<std::thread> workers;
+  auto start = std::chrono::steady_clock::now();
+  for (int t = 0; t < numThreads; t++) {
+    workers.push_back(std::thread([&]() {
+      for (int i = next++; i < (int)results.size(); i = next++)
+        runSuite(results[i]);
+    }));
+  }
+  for (unsigned int t = 0; t < workers.size(); t++)
+    workers[t].join();
+  std::chrono::duration<double> total = std::chrono::steady_clock::now() - start;
+
+  // Compare against the baseline
+  std::map<std::string, double> baseline = readBaseline(opt.baselineFile);
+  int failed = 0;
+  std::cout << std::fixed;
+  for (unsigned int i = 0; i < results.size(); i++) {
+    SuiteResult& r = results[i];
+    if (r.measured && !opt.updateBaseline && baseline.count(r.name)
+        && r.nps() < baseline[r.name] * (1 - opt.tolerance)) {
+      std::ostringstream msg;
+      msg << std::fixed << std::setprecision(0) << "speed " << r.nps()
+        << " nps is below the baseline of " << baseline[r.name] << " nps";
+      r.failures.push_back(msg.str());
+    }
+
+    std::cout << (r.failures.size() == 0 ? "PASS  " : "FAIL  ")
+      << std::left << std::setw(32) << r.name << std::right
+      << std::setprecision(3) << std::setw(9) << r.seconds << "s"
+      << std::setw(12) << r.nodes << " nodes";
+    if (r.measured) {
+      std::cout << std::setprecision(0) << std::setw(12) << r.nps() << " nps";
+      if (baseline.count(r.name))
+        std::cout << " (baseline " << baseline[r.name] << ")";
+    }
+    std::cout << std::endl;
+    for (unsigned int j = 0; j < r.failures.size(); j++)
+      std::cout << "      " << r.failures[j] << std::endl;
+    if (r.failures.size() > 0)
+      failed++;
+  }
+
+  std::cout << std::setprecision(3) << (results.size() - failed) << " of "
+    << results.size() << " suites passed in " << total.count() << "s using "
+    << numThreads << " threads" << std::endl;
+
+  if (opt.updateBaseline) {
+    writeBaseline(opt.baselineFile, results);
+    std::cout << "Baseline written to " << opt.baselineFile << std::endl;
+  }
+  return failed == 0 ? 0 : 1;
+}
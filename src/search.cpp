@@ -0,0 +1,671 @@
+#include "search.h"
+#include "eval.h"
+#include "position.h"
+#include "tablebase.h"
+#include "types.h"
+#include "move.h"
+
+#include <algorithm>
+#include <cmath>
+#include <cstring>
+#include <thread>
+
+// Half width of the first aspiration window, in centipawns
+static const int ASPIRATION_WINDOW = 25;
+
+// Drop in score from the last iteration which counts as failing low
+static const int FAIL_LOW_MARGIN = 30;
+
+// How far below alpha, per ply of depth left, quiet moves are skipped
+static const int FUTILITY_MARGIN = 150;
+
+// History scores approach this but never reach it, so that quiet moves stay
+// ordered after killers (79000 and up)
+static const int MAX_HISTORY = 16384;
+
+// Late move reductions by depth and the move's index in the ordering
+struct LMRTable {
+  int reductions[MAX_PLY][64];
+};
+
+static LMRTable computeLMR() {
+  LMRTable t;
+  for (int depth = 0; depth < MAX_PLY; depth++)
+    for (int i = 0; i < 64; i++)
+      t.reductions[depth][i] = (depth == 0 || i == 0) ? 0
+        : (int)(0.75 + std::log(depth) * std::log(i) / 2.25);
+  return t;
+}
+
+static const LMRTable LMR = computeLMR();
+
+// Resizes the table to the given number of megabytes, rounded down to a power
+// of two entries, and clears it.
+void TranspositionTable::resize(int megabytes) {
+  U64 bytes = (U64)std::max(1, megabytes) << 20;
+  U64 n = 1;
+  while (2 * n * sizeof(TTEntry) <= bytes)
+    n *= 2;
+  entries.assign(n, TTEntry());
+  mask = n - 1;
+  clear();
+}
+
+void TranspositionTable::clear() {
+  std::fill(entries.begin(), entries.end(), TTEntry{0, 0, 0, NONE, 0});
+}
+
+// Returns the entry for the key, or nullptr if it holds another position.
+TTEntry* TranspositionTable::probe(U64 key) {
+  TTEntry* e = &entries[key & mask];
+  return (e->key == key && e->bound != NONE) ? e : nullptr;
+}
+
+// Stores a result, replacing whatever was in the slot unless it was the same
+// position searched deeper.
+void TranspositionTable::store(U64 key, int score, int depth, Bound bound,
+    U16 move) {
+  TTEntry* e = &entries[key & mask];
+  if (e->key == key && e->depth > depth && bound != EXACT)
+    return;
+  if (move == 0 && e->key == key)
+    move = e->move;
+  *e = TTEntry{key, (I16)score, (U8)depth, bound, move};
+}
+
+// Sets the option with the given name, returning false if there is none or the
+// value is not valid.
+bool SearchOptions::set(std::string name, std::string value) {
+  bool on = (value == "1" || value == "true" || value == "on");
+  bool off = (value == "0" || value == "false" || value == "off");
+  if (name == "hash") {
+    try {
+      hashMB = std::max(1, std::stoi(value));
+    } catch (...) {
+      return false;
+    }
+    return true;
+  }
+  if (name == "nnue") {
+    if (value.empty() || off) {
+      nnueFile.clear();
+      return true;
+    }
+    nnueFile = value;
+    return Network::load(value) != nullptr;
+  }
+  if (!on && !off)
+    return false;
+  if (name == "quiescence")
+    quiescence = on;
+  else if (name == "tablebases")
+    tablebases = on;
+  else if (name == "pvs")
+    pvs = on;
+  else if (name == "aspiration")
+    aspiration = on;
+  else if (name == "nullmove")
+    nullMove = on;
+  else if (name == "lmr")
+    lmr = on;
+  else if (name == "futility")
+    futility = on;
+  else if (name == "checkext")
+    checkExtensions = on;
+  else
+    return false;
+  return true;
+}
+
+Search::Search(SearchOptions opt) : options(opt), stopped(false),
+    pondering(false), thinking(false), ponderHitMs(0) {
+  tt.resize(options.hashMB);
+  if (!options.nnueFile.empty())
+    network = Network::load(options.nnueFile);
+  if (network) {
+    accumulators.resize(MAX_PLY + 1);
+    for (unsigned int i = 0; i < accumulators.size(); i++)
+      accumulators[i].network = network.get();
+  }
+  newGame();
+}
+
+// Forgets everything learned from earlier positions.
+void Search::newGame() {
+  tt.clear();
+  memset(killers, 0, sizeof(killers));
+  memset(history, 0, sizeof(history));
+}
+
+// Asks a running search to return as soon as possible. Safe to call from
+// another thread.
+void Search::stop() {
+  stopped = true;
+}
+
+// Tells a ponder search that the opponent played the expected move, so it is
+// now thinking on its own clock. Time already spent counts towards the soft
+// limit, so the move usually comes quickly; the hard limit starts now. Safe
+// to call from another thread.
+void Search::ponderHit() {
+  ponderHitMs = (int)(elapsed() * 1000);
+  pondering = false;
+}
+
+// Returns true from when a search has set itself up, so that stop and
+// ponderHit reach it, until it returns.
+bool Search::isThinking() {
+  return thinking;
+}
+
+// Sets a function to be called after every completed iteration.
+void Search::setInfoCallback(std::function<void(SearchResult&)> fn) {
+  infoCallback = fn;
+}
+
+SearchOptions& Search::getOptions() {
+  return options;
+}
+
+bool Search::isMateScore(int score) {
+  return std::abs(score) >= MATE_SCORE - MAX_PLY;
+}
+
+U16 Search::packMove(Move& m) {
+  return m.getFrom() | (m.getTo() << 6) | (m.getType() << 12);
+}
+
+// Returns the index of the packed move in the list, or -1.
+int Search::findPackedMove(U16 packed, std::vector<Move>& moves) {
+  for (unsigned int i = 0; i < moves.size(); i++)
+    if (packMove(moves[i]) == packed)
+      return i;
+  return -1;
+}
+
+// Seconds since the search started
+double Search::elapsed() {
+  std::chrono::duration<double> d = std::chrono::steady_clock::now()
+    - startTime;
+  return d.count();
+}
+
+// Searches the position until a limit is reached and returns the best move
+// found. keys holds the Zobrist keys of the positions played before this one
+// in the game, most recent last, so that repetitions can be recognized.
+SearchResult Search::think(Position& position, SearchLimits& lim,
+    std::vector<U64>& gameKeys) {
+  Position root = position;
+  root.setAccumulator(network ? &accumulators[0] : nullptr);
+  limits = lim;
+  stopped = false;
+  nodes = 0;
+  startTime = std::chrono::steady_clock::now();
+  ponderHitMs = 0;
+  pondering = limits.ponder;
+  timeManager.start(limits.clockMs, limits.incrementMs, limits.movesToGo,
+      limits.timeMs);
+  thinking = true;
+  pawnHitsAtStart = PawnHashTable::forThread().getHits();
+  pawnProbesAtStart = PawnHashTable::forThread().getProbes();
+  keys = gameKeys;
+  keys.push_back(root.getKey());
+  memset(killers, 0, sizeof(killers));
+  for (int p = 0; p < 12; p++)
+    for (int sq = 0; sq < 64; sq++)
+      history[p][sq] /= 8;
+
+  SearchResult result;
+  std::vector<Move> moves = root.getLegalMoves();
+  if (moves.empty()) {
+    thinking = false;
+    return result;
+  }
+  result.best = moves[0];
+
+  arena.resetPeak();
+  int numLines = std::max(1, std::min(limits.multiPV, (int)moves.size()));
+  int stable = 0;  // iterations in a row with the same best move
+  for (int depth = 1; depth <= limits.depth; depth++) {
+    // Each pass finds the best line among the moves the earlier passes of
+    // this iteration left
+    std::vector<SearchLine> lines;
+    excludedRootMoves.clear();
+    failedLow = false;
+    for (int k = 0; k < numLines && !stopped; k++) {
+      arena.reset();
+      int guess = (k < (int)result.lines.size()) ? result.lines[k].score
+        : (k > 0) ? lines[k - 1].score : 0;
+      SearchLine line;
+      line.score = searchRoot(root, depth, guess);
+      if (stopped && depth > 1)
+        break;
+      line.pv = buildPV(root);
+      if (line.pv.empty())
+        break;
+      excludedRootMoves.push_back(packMove(line.pv[0]));
+      lines.push_back(line);
+    }
+    excludedRootMoves.clear();
+    if (lines.empty() || (stopped && depth > 1))
+      break;
+
+    // A later pass may score better than an earlier one when the search was
+    // unstable
+    std::stable_sort(lines.begin(), lines.end(),
+        [](const SearchLine& a, const SearchLine& b) {
+          return a.score > b.score;
+        });
+    int score = lines[0].score;
+    if (depth > 1 && packMove(lines[0].pv[0]) == packMove(result.best))
+      stable++;
+    else
+      stable = 0;
+    if (depth > 1 && score < result.score - FAIL_LOW_MARGIN)
+      failedLow = true;
+    result.best = lines[0].pv[0];
+    result.pv = lines[0].pv;
+    result.lines = lines;
+    result.score = score;
+    result.depth = depth;
+    recordStats(result);
+
+    // Report the lines in their final order, best first
+    for (int k = 0; infoCallback && k < (int)lines.size(); k++) {
+      result.line = k;
+      infoCallback(result);
+    }
+    result.line = 0;
+    if (stopped)
+      break;
+
+    // Nothing more to learn once a forced mate has been found, or if there is
+    // only one move
+    if (numLines == 1 && isMateScore(score)
+        && MATE_SCORE - std::abs(score) <= depth)
+      break;
+    if (!pondering && timeManager.stopAfterIteration(elapsed() * 1000,
+          stable, failedLow, moves.size() == 1))
+      break;
+  }
+
+  // A ponder search must not answer before the opponent has moved
+  while (pondering && !stopped)
+    std::this_thread::sleep_for(std::chrono::milliseconds(1));
+  recordStats(result);
+  thinking = false;
+  return result;
+}
+
+// Searches the root to the given depth. With aspiration windows, the window
+// starts narrow around the score of the last iteration and is widened on
+// whichever side the score falls outside it.
+int Search::searchRoot(Position& root, int depth, int guess) {
+  if (!options.aspiration || depth < 4 || isMateScore(guess))
+    return negamax(root, -INFINITE_SCORE, INFINITE_SCORE, depth, 0);
+
+  int delta = ASPIRATION_WINDOW;
+  int alpha = std::max(guess - delta, -INFINITE_SCORE);
+  int beta = std::min(guess + delta, INFINITE_SCORE);
+  while (true) {
+    int score = negamax(root, alpha, beta, depth, 0);
+    if (stopped)
+      return score;
+    delta *= 2;
+    if (score <= alpha) {
+      alpha = std::max(score - delta, -INFINITE_SCORE);
+      failedLow = failedLow || excludedRootMoves.empty();
+    }
+    else if (score >= beta)
+      beta = std::min(score + delta, INFINITE_SCORE);
+    else
+      return score;
+  }
+}
+
+// Fills in the counts and timing of the search so far.
+void Search::recordStats(SearchResult& result) {
+  result.nodes = nodes;
+  result.seconds = elapsed();
+  result.arenaPeak = arena.getPeak();
+  PawnHashTable& pawns = PawnHashTable::forThread();
+  result.pawnHashHits = pawns.getHits() - pawnHitsAtStart;
+  result.pawnHashProbes = pawns.getProbes() - pawnProbesAtStart;
+}
+
+// Converts the principal variation of the last iteration to moves. Cutoffs
+// from the transposition table end it early, so it is continued with the
+// moves stored in the table for the positions which follow, as long as they
+// are legal and no position repeats. The second move is then usually known,
+// which is the one to ponder on.
+std::vector<Move> Search::buildPV(Position& root) {
+  std::vector<Move> line;
+  std::vector<U64> seen;
+  Position p = root;
+  p.setAccumulator(nullptr);
+  while ((int)line.size() < MAX_PLY - 1) {
+    U16 packed = 0;
+    if ((int)line.size() < pvLength[0])
+      packed = pv[0][line.size()];
+    else {
+      TTEntry* e = tt.probe(p.getKey());
+      if (e == nullptr || e->move == 0
+          || std::find(seen.begin(), seen.end(), p.getKey()) != seen.end())
+        break;
+      packed = e->move;
+    }
+    std::vector<Move> moves = p.getLegalMoves();
+    int m = findPackedMove(packed, moves);
+    if (m == -1)
+      break;
+    seen.push_back(p.getKey());
+    line.push_back(moves[m]);
+    p.makeMove(moves[m]);
+  }
+  return line;
+}
+
+// Returns true if an earlier MultiPV pass of this iteration has already
+// found the root move.
+bool Search::isExcludedRootMove(Move& m) {
+  U16 packed = packMove(m);
+  for (U16 excluded : excludedRootMoves)
+    if (excluded == packed)
+      return true;
+  return false;
+}
+
+// The child of the position at ply after the move, which keeps its
+// accumulator in the next ply's slot when evaluating with the network.
+Position Search::afterMove(Position& p, Move& m, int ply) {
+  if (network)
+    return p.afterMove(m, &accumulators[ply + 1]);
+  return p.afterMove(m);
+}
+
+// Stops the search once the node or time budget is used up.
+void Search::checkLimits() {
+  if (limits.nodes > 0 && nodes >= limits.nodes)
+    stopped = true;
+  if (timeManager.isActive() && !pondering && (nodes & 1023) == 0
+      && elapsed() * 1000 - ponderHitMs >= timeManager.getHardMs())
+    stopped = true;
+}
+
+// Returns true if the position is drawn by the fifty move rule or by
+// repeating an earlier position. keys holds this position at ply.
+bool Search::isDraw(Position& p, int ply) {
+  if (p.getClock() >= 100)
+    return true;
+  // Only positions since the last capture or pawn move can repeat, and only
+  // with the same player to move. One repetition within the search is
+  // treated as a draw, since the same moves could be played again.
+  int n = keys.size() - 1;
+  int oldest = std::max(0, n - (int)p.getClock());
+  int seen = 0;
+  for (int i = n - 2; i >= oldest; i -= 2) {
+    if (keys[i] == keys[n]) {
+      if (i >= n - ply)
+        return true;
+      if (++seen >= 2)
+        return true;
+    }
+  }
+  return false;
+}
+
+// Scores the moves for ordering: the move from the table first, then captures
+// of the most valuable victims by the least valuable attackers, promotions,
+// killer moves and finally quiet moves by their history.
+void Search::orderMoves(Position& p, MoveList& moves,
+    ArenaVector<int>& scores, U16 ttMove, int ply) {
+  scores.resize(moves.size());
+  for (unsigned int i = 0; i < moves.size(); i++) {
+    Move& m = moves[i];
+    U16 packed = packMove(m);
+    int s;
+    if (packed == ttMove)
+      s = 1000000;
+    else if (m.isCapture()) {
+      Piece victim = p.getPiece(m.getTo());
+      int value = (victim == NO_PIECE) ? PIECE_VALUES[W_PAWN]
+        : PIECE_VALUES[victim % 6];
+      s = 100000 + 10 * value - PIECE_VALUES[m.getMovingPiece() % 6] / 10;
+    }
+    else if (m.getPromotedPiece() != NO_PIECE)
+      s = 90000 + PIECE_VALUES[m.getPromotedPiece() % 6];
+    else if (packed == killers[ply][0])
+      s = 80000;
+    else if (packed == killers[ply][1])
+      s = 79000;
+    else
+      s = history[m.getMovingPiece()][m.getTo()];
+    scores[i] = s;
+  }
+}
+
+// Moves the best scored move from index i onwards to index i.
+void Search::pickMove(MoveList& moves, ArenaVector<int>& scores,
+    unsigned int i) {
+  unsigned int best = i;
+  for (unsigned int j = i + 1; j < moves.size(); j++)
+    if (scores[j] > scores[best])
+      best = j;
+  if (best != i) {
+    std::swap(moves[i], moves[best]);
+    std::swap(scores[i], scores[best]);
+  }
+}
+
+int Search::negamax(Position& p, int alpha, int beta, int depth, int ply,
+    bool allowNull) {
+  pvLength[ply] = 0;
+  if (ply > 0 && isDraw(p, ply))
+    return 0;
+  bool inCheck = p.inCheck();
+  if (inCheck && options.checkExtensions)
+    depth++;
+  if (depth <= 0 || ply >= MAX_PLY - 1)
+    return quiescence(p, alpha, beta, ply);
+
+  nodes++;
+  checkLimits();
+  if (stopped)
+    return 0;
+
+  // Perfect knowledge of small endings
+  if (options.tablebases && ply > 0
+      && Position::popcount(p.getOccupied()) <= Tablebase::MAX_PIECES) {
+    TBResult r;
+    int dtm;
+    if (Tablebase::probe(p, r, dtm)) {
+      if (r == TB_WIN)
+        return MATE_SCORE - ply - dtm;
+      if (r == TB_LOSS)
+        return -MATE_SCORE + ply + dtm;
+      return 0;
+    }
+  }
+
+  // Transposition table. Mate scores are stored relative to this node.
+  U16 ttMove = 0;
+  TTEntry* e = tt.probe(p.getKey());
+  if (e != nullptr) {
+    ttMove = e->move;
+    int s = e->score;
+    if (isMateScore(s))
+      s += (s > 0) ? -ply : ply;
+    if (ply > 0 && e->depth >= depth
+        && (e->bound == TranspositionTable::EXACT
+          || (e->bound == TranspositionTable::LOWER && s >= beta)
+          || (e->bound == TranspositionTable::UPPER && s <= alpha)))
+      return s;
+  }
+
+  bool pvNode = beta - alpha > 1;
+  int staticEval = inCheck ? -INFINITE_SCORE : evaluate(p);
+
+  // Null move: if passing the turn still scores at least beta with a reduced
+  // search, a real move almost certainly would too. Not tried without pieces
+  // other than pawns, where having to move can be a disadvantage.
+  Color us = p.getPlayer();
+  U64 pieces = p.getOccupied(us)
+    ^ p.getBitboard((Piece)(6*us + W_PAWN)) ^ p.getBitboard((Piece)(6*us));
+  if (options.nullMove && allowNull && !pvNode && !inCheck && depth >= 3
+      && staticEval >= beta && pieces != 0) {
+    int r = 2 + depth / 4;
+    Position child = p.afterNullMove();
+    keys.push_back(child.getKey());
+    int score = -negamax(child, -beta, -beta + 1, depth - 1 - r, ply + 1,
+        false);
+    keys.pop_back();
+    if (stopped)
+      return 0;
+    if (score >= beta)
+      return isMateScore(score) ? beta : score;
+  }
+
+  // Quiet moves are not worth searching near the leaves when even a good
+  // margin above the evaluation cannot reach alpha
+  bool futile = options.futility && !pvNode && !inCheck && depth <= 2
+    && !isMateScore(alpha) && staticEval + FUTILITY_MARGIN * depth <= alpha;
+
+  ArenaScope scope(arena);
+  MoveList moves{ArenaAllocator<Move>(arena)};
+  p.getLegalMoves(moves);
+  if (moves.empty())
+    return inCheck ? -MATE_SCORE + ply : 0;
+
+  ArenaVector<int> scores{ArenaAllocator<int>(arena)};
+  orderMoves(p, moves, scores, ttMove, ply);
+  int best = -INFINITE_SCORE;
+  U16 bestMove = 0;
+  int originalAlpha = alpha;
+  for (unsigned int i = 0; i < moves.size(); i++) {
+    pickMove(moves, scores, i);
+    Move& m = moves[i];
+    if (ply == 0 && isExcludedRootMove(m))
+      continue;
+    bool quiet = !m.isCapture() && m.getPromotedPiece() == NO_PIECE;
+    Position child = afterMove(p, m, ply);
+    bool givesCheck = child.inCheck();
+    if (futile && i > 0 && quiet && !givesCheck)
+      continue;
+
+    // Late quiet moves are searched less deeply, depending on how far down
+    // the ordering they are
+    int r = 0;
+    if (options.lmr && depth >= 3 && i >= 3 && quiet && !inCheck
+        && !givesCheck) {
+      r = LMR.reductions[std::min(depth, MAX_PLY - 1)][std::min((int)i, 63)];
+      if (pvNode)
+        r--;
+      r = std::max(0, std::min(r, depth - 2));
+    }
+
+    // Moves after the first are expected to fail low, which a null window
+    // (or a reduced depth) shows cheaply. Those which beat alpha are searched
+    // again with the full depth and window.
+    keys.push_back(child.getKey());
+    int score = 0;
+    bool full = (best == -INFINITE_SCORE);  // the first move searched
+    if (!full) {
+      int scoutBeta = options.pvs ? alpha + 1 : beta;
+      score = -negamax(child, -scoutBeta, -alpha, depth - 1 - r, ply + 1);
+      if (r > 0 && score > alpha && !stopped)
+        score = -negamax(child, -scoutBeta, -alpha, depth - 1, ply + 1);
+      full = score > alpha && score < beta && scoutBeta < beta;
+    }
+    if (full && !stopped)
+      score = -negamax(child, -beta, -alpha, depth - 1, ply + 1);
+    keys.pop_back();
+    if (stopped)
+      return 0;
+
+    if (score > best) {
+      best = score;
+      bestMove = packMove(m);
+      if (score > alpha) {
+        alpha = score;
+        pv[ply][0] = bestMove;
+        for (int j = 0; j < pvLength[ply + 1]; j++)
+          pv[ply][j + 1] = pv[ply + 1][j];
+        pvLength[ply] = pvLength[ply + 1] + 1;
+      }
+    }
+    if (alpha >= beta) {
+      if (quiet) {
+        if (killers[ply][0] != bestMove) {
+          killers[ply][1] = killers[ply][0];
+          killers[ply][0] = bestMove;
+        }
+        // Each bonus moves the score part of the way to the maximum
+        int& h = history[m.getMovingPiece()][m.getTo()];
+        int bonus = std::min(depth * depth, MAX_HISTORY);
+        h += bonus - h * bonus / MAX_HISTORY;
+      }
+      break;
+    }
+  }
+
+  TranspositionTable::Bound bound = (best >= beta) ? TranspositionTable::LOWER
+    : (best > originalAlpha) ? TranspositionTable::EXACT
+    : TranspositionTable::UPPER;
+  int stored = best;
+  if (isMateScore(stored))
+    stored += (stored > 0) ? ply : -ply;
+
+  // The score of a root searched without some of its moves is not the
+  // position's
+  if (ply > 0 || excludedRootMoves.empty())
+    tt.store(p.getKey(), stored, depth, bound, bestMove);
+  return best;
+}
+
+// Searches captures and promotions until the position is quiet, so that the
+// evaluation is not taken in the middle of an exchange. When in check every
+// move is searched.
+int Search::quiescence(Position& p, int alpha, int beta, int ply) {
+  nodes++;
+  checkLimits();
+  if (stopped)
+    return 0;
+  if (!options.quiescence || ply >= MAX_PLY - 1)
+    return evaluate(p);
+
+  bool check = p.inCheck();
+  int best = -INFINITE_SCORE;
+  if (!check) {
+    best = evaluate(p);
+    if (best >= beta)
+      return best;
+    alpha = std::max(alpha, best);
+  }
+
+  ArenaScope scope(arena);
+  MoveList moves{ArenaAllocator<Move>(arena)};
+  p.getLegalMoves(moves);
+  if (moves.empty())
+    return check ? -MATE_SCORE + ply : 0;
+
+  ArenaVector<int> scores{ArenaAllocator<int>(arena)};
+  orderMoves(p, moves, scores, 0, ply);
+  for (unsigned int i = 0; i < moves.size(); i++) {
+    pickMove(moves, scores, i);
+    Move& m = moves[i];
+    if (!check && !m.isCapture() && m.getPromotedPiece() == NO_PIECE)
+      continue;
+    Position child = afterMove(p, m, ply);
+    int score = -quiescence(child, -beta, -alpha, ply + 1);
+    if (stopped)
+      return 0;
+    if (score > best) {
+      best = score;
+      if (score > alpha)
+        alpha = score;
+    }
+    if (alpha >= beta)
+      break;
+  }
+  return best;
+}
@@ -0,0 +1,515 @@
+#include "server.h"
+#include "position.h"
+#include "types.h"
+#include "move.h"
+
+#include <csignal>
+#include <cstring>
+#include <iostream>
+#include <sstream>
+#include <string>
+#include <vector>
+
+#ifdef __linux__
+#include <errno.h>
+#include <sys/epoll.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <unistd.h>
+#endif
+
+// Longest request line accepted before the connection is dropped
+const size_t MAX_LINE = 4096;
+
+// One game. Slots are reused once a game is closed, keeping the capacity of
+// their vectors, so a busy server stops allocating once it is warmed up.
+struct Session {
+  bool active = false;
+  Position position;
+  std::vector<Move> history;
+
+  // Legal moves of the current position, named, or empty if out of date
+  std::vector<Move> moves;
+  bool movesValid = false;
+};
+
+// Fixed pool of sessions with a free list of unused slots.
+class SessionPool {
+  public:
+    SessionPool(int size) : slots(size) {
+      for (int i = size - 1; i >= 0; i--)
+        freeSlots.push_back(i);
+    }
+
+    // Returns the id of a new session, or -1 if the pool is full.
+    int open() {
+      if (freeSlots.empty())
+        return -1;
+      int id = freeSlots.back();
+      freeSlots.pop_back();
+      Session& s = slots[id];
+      s.active = true;
+      s.history.clear();
+      s.movesValid = false;
+      return id;
+    }
+
+    void close(int id) {
+      slots[id].active = false;
+      freeSlots.push_back(id);
+    }
+
+    // Returns the session with the given id, or nullptr if there is none.
+    Session* get(int id) {
+      if (id < 0 || id >= (int)slots.size() || !slots[id].active)
+        return nullptr;
+      return &slots[id];
+    }
+
+  private:
+    std::vector<Session> slots;
+    std::vector<int> freeSlots;
+};
+
+// Returns true if the FEN is well formed and describes a position the engine
+// can play from safely: one king each, no pawns on the back ranks, the side
+// not to move not in check, castling rights only where the king and rook are
+// at home, and an en passant square only behind a pawn which just moved.
+// Requests come from other processes, so nothing is assumed. The FEN is
+// rewritten with single spaces into normalized.
+static bool normalizeFEN(std::string fen, std::string& normalized) {
+  std::istringstream in(fen);
+  std::string fields[6];
+  for (int i = 0; i < 6; i++)
+    if (!(in >> fields[i]))
+      return false;
+  std::string rest;
+  if (in >> rest)
+    return false;
+
+  // Piece placement
+  int rank = 7, file = 0;
+  for (char c : fields[0]) {
+    if (c == '/') {
+      if (file != 8 || rank == 0)
+        return false;
+      rank--;
+      file = 0;
+    }
+    else if (c >= '1' && c <= '8')
+      file += c - '0';
+    else if (std::string("KQRBNPkqrbnp").find(c) != std::string::npos)
+      file++;
+    else
+      return false;
+    if (file > 8)
+      return false;
+  }
+  if (rank != 0 || file != 8)
+    return false;
+
+  // Side to move, castling rights, en passant square and clocks
+  if (fields[1] != "w" && fields[1] != "b")
+    return false;
+  if (fields[2] != "-") {
+    for (char c : fields[2])
+      if (std::string("KQkq").find(c) == std::string::npos)
+        return false;
+  }
+  if (fields[3] != "-" && (fields[3].size() != 2 || fields[3][0] < 'a'
+        || fields[3][0] > 'h' || (fields[3][1] != '3' && fields[3][1] != '6')))
+    return false;
+  for (int i = 4; i < 6; i++) {
+    if (fields[i].size() > 4)
+      return false;
+    for (char c : fields[i])
+      if (c < '0' || c > '9')
+        return false;
+  }
+
+  // The position itself
+  normalized = fields[0];
+  for (int i = 1; i < 6; i++)
+    normalized += " " + fields[i];
+  Position p(normalized);
+  U64 whiteKings = 0, blackKings = 0, pawns = 0;
+  for (int sq = 0; sq < 64; sq++) {
+    Piece piece = p.getPiece(sq);
+    if (piece == W_KING)
+      whiteKings |= ONE << sq;
+    else if (piece == B_KING)
+      blackKings |= ONE << sq;
+    else if (piece == W_PAWN || piece == B_PAWN)
+      pawns |= ONE << sq;
+  }
+  if (Position::popcount(whiteKings) != 1 || Position::popcount(blackKings) != 1)
+    return false;
+  if (pawns & 0xff000000000000ffULL)
+    return false;
+  Color opponent = (p.getPlayer() == WHITE) ? BLACK : WHITE;
+  if (p.inCheck(opponent))
+    return false;
+
+  // An en passant square must be on the right rank for the side to move,
+  // behind an enemy pawn which could just have moved two squares
+  if (fields[3] != "-") {
+    bool white = p.getPlayer() == WHITE;
+    int ep = 8*(fields[3][1] - '1') + (fields[3][0] - 'a');
+    int pawn = white ? ep - 8 : ep + 8;
+    int origin = white ? ep + 8 : ep - 8;
+    if (fields[3][1] != (white ? '6' : '3')
+        || p.getPiece(pawn) != (white ? B_PAWN : W_PAWN)
+        || p.getPiece(ep) != NO_PIECE || p.getPiece(origin) != NO_PIECE)
+      return false;
+  }
+  const char rights[4] = {'K', 'Q', 'k', 'q'};
+  const int kings[4] = {4, 4, 60, 60};
+  const int rooks[4] = {7, 0, 63, 56};
+  for (int i = 0; i < 4; i++) {
+    if (fields[2].find(rights[i]) == std::string::npos)
+      continue;
+    Piece king = (i < 2) ? W_KING : B_KING;
+    Piece rook = (i < 2) ? W_ROOK : B_ROOK;
+    if (p.getPiece(kings[i]) != king || p.getPiece(rooks[i]) != rook)
+      return false;
+  }
+  return true;
+}
+
+// Finds the move given either by name or as from and to squares with an
+// optional promotion letter. Returns -1 if there is no such legal move.
+static int findMove(Position& p, std::string text, std::vector<Move>& moves) {
+  int m = p.lookupMove(text, moves);
+  if (m != -1)
+    return m;
+  if (text.size() != 4 && text.size() != 5)
+    return -1;
+  for (unsigned int i = 0; i < moves.size(); i++)
+    if (moves[i].getCoordinates() == text)
+      return i;
+  return -1;
+}
+
+// Returns the status of the game, from the point of view of the rules.
+static std::string gameStatus(Session& s) {
+  bool check = s.position.inCheck();
+  if (!s.position.hasLegalMove())
+    return check ? "checkmate" : "stalemate";
+  if (s.position.getClock() >= 100)
+    return "fifty";
+  return check ? "check" : "playing";
+}
+
+// Makes sure the session's move list matches its position.
+static std::vector<Move>& legalMoves(Session& s) {
+  if (!s.movesValid) {
+    s.moves = s.position.getLegalMoves();
+    s.position.nameMoves(s.moves);
+    s.movesValid = true;
+  }
+  return s.moves;
+}
+
+// Carries out one request line and returns the reply, without the newline.
+// Sets quit if the client asked to disconnect.
+static std::string handleRequest(SessionPool& pool, std::string line,
+    bool& quit) {
+  std::istringstream in(line);
+  std::string command;
+  if (!(in >> command))
+    return "error empty request";
+
+  if (command == "quit") {
+    quit = true;
+    return "ok";
+  }
+
+  if (command == "new") {
+    std::string fen;
+    std::getline(in >> std::ws, fen);
+    if (fen.empty())
+      fen = "rnbqkbnr/pppppppp/8/8/8/8/PPPPPPPP/RNBQKBNR w KQkq - 0 1";
+    std::string normalized;
+    if (!normalizeFEN(fen, normalized))
+      return "error invalid fen";
+    int id = pool.open();
+    if (id == -1)
+      return "error no free sessions";
+    pool.get(id)->position.loadFEN(normalized);
+    return "ok " + std::to_string(id);
+  }
+
+  // Every other command refers to a session
+  int id = -1;
+  std::string idText;
+  if (!(in >> idText) || idText.find_first_not_of("0123456789") !=
+      std::string::npos || idText.size() > 9)
+    return "error expected a session id";
+  id = std::stoi(idText);
+  Session* s = pool.get(id);
+  if (s == nullptr)
+    return "error no such session";
+
+  if (command == "move") {
+    std::string text;
+    if (!(in >> text))
+      return "error expected a move";
+    std::vector<Move>& moves = legalMoves(*s);
+    int m = findMove(s->position, text, moves);
+    if (m == -1)
+      return "error illegal move";
+    Move move = moves[m];
+    s->position.makeMove(move);
+    s->history.push_back(move);
+    s->movesValid = false;
+    return "ok " + move.getName() + " " + gameStatus(*s);
+  }
+  if (command == "undo") {
+    if (s->history.empty())
+      return "error no moves to undo";
+    s->position.unmakeMove(s->history.back());
+    s->history.pop_back();
+    s->movesValid = false;
+    return "ok " + gameStatus(*s);
+  }
+  if (command == "moves") {
+    std::string reply = "ok";
+    std::vector<Move>& moves = legalMoves(*s);
+    for (unsigned int i = 0; i < moves.size(); i++)
+      reply += " " + moves[i].getName();
+    return reply;
+  }
+  if (command == "fen")
+    return "ok " + s->position.getFEN();
+  if (command == "status")
+    return "ok " + gameStatus(*s);
+  if (command == "history") {
+    std::string reply = "ok";
+    for (unsigned int i = 0; i < s->history.size(); i++)
+      reply += " " + s->history[i].getName();
+    return reply;
+  }
+  if (command == "close") {
+    pool.close(id);
+    return "ok";
+  }
+  return "error unknown command";
+}
+
+std::vector<std::string> replayServerRequests(
+    std::vector<std::string>& requests) {
+  SessionPool pool(16);
+  std::vector<std::string> replies;
+  bool quit = false;
+  for (unsigned int i = 0; i < requests.size() && !quit; i++)
+    replies.push_back(handleRequest(pool, requests[i], quit));
+  return replies;
+}
+
+#ifdef __linux__
+
+// State of one client connection
+struct Connection {
+  bool open = false;
+  std::string in;
+  std::string out;
+  bool closeAfterWrite = false;
+  bool waitingToWrite = false;
+};
+
+static volatile sig_atomic_t stopRequested = 0;
+
+static void requestStop(int) {
+  stopRequested = 1;
+}
+
+// Sends as much of the connection's pending output as the socket will take.
+// Returns false if the connection failed.
+static bool flush(int fd, Connection& c) {
+  while (!c.out.empty()) {
+    ssize_t n = send(fd, c.out.data(), c.out.size(), MSG_NOSIGNAL);
+    if (n < 0) {
+      if (errno == EAGAIN || errno == EWOULDBLOCK)
+        return true;
+      if (errno == EINTR)
+        continue;
+      return false;
+    }
+    c.out.erase(0, n);
+  }
+  return true;
+}
+
+int runServer(ServerOptions& opt) {
+  sockaddr_un addr;
+  memset(&addr, 0, sizeof(addr));
+  addr.sun_family = AF_UNIX;
+  if (opt.socketPath.size() >= sizeof(addr.sun_path)) {
+    std::cout << "Socket path is too long" << std::endl;
+    return 1;
+  }
+  strcpy(addr.sun_path, opt.socketPath.c_str());
+
+  int listenFd = socket(AF_UNIX, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+  if (listenFd < 0) {
+    std::cout << "Unable to create socket: " << strerror(errno) << std::endl;
+    return 1;
+  }
+  unlink(opt.socketPath.c_str());
+  if (bind(listenFd, (sockaddr*)&addr, sizeof(addr)) < 0
+      || listen(listenFd, SOMAXCONN) < 0) {
+    std::cout << "Unable to listen on " << opt.socketPath << ": "
+      << strerror(errno) << std::endl;
+    close(listenFd);
+    return 1;
+  }
+
+  int epollFd = epoll_create1(EPOLL_CLOEXEC);
+  epoll_event ev;
+  memset(&ev, 0, sizeof(ev));
+  ev.events = EPOLLIN;
+  ev.data.fd = listenFd;
+  epoll_ctl(epollFd, EPOLL_CTL_ADD, listenFd, &ev);
+
+  signal(SIGINT, requestStop);
+  signal(SIGTERM, requestStop);
+
+  SessionPool pool(opt.maxSessions);
+  std::vector<Connection> connections;
+  int numConnections = 0;
+  std::cout << "Serving up to " << opt.maxSessions << " games on "
+    << opt.socketPath << std::endl;
+
+  auto closeConnection = [&](int fd) {
+    epoll_ctl(epollFd, EPOLL_CTL_DEL, fd, nullptr);
+    close(fd);
+    connections[fd] = Connection();
+    numConnections--;
+  };
+
+  // Registers or unregisters interest in writing, depending on whether
+  // output is pending
+  auto updateInterest = [&](int fd, Connection& c) {
+    bool wantWrite = !c.out.empty();
+    if (wantWrite == c.waitingToWrite)
+      return;
+    epoll_event e;
+    memset(&e, 0, sizeof(e));
+    e.events = wantWrite ? (EPOLLIN | EPOLLOUT) : EPOLLIN;
+    e.data.fd = fd;
+    epoll_ctl(epollFd, EPOLL_CTL_MOD, fd, &e);
+    c.waitingToWrite = wantWrite;
+  };
+
+  const int MAX_EVENTS = 256;
+  epoll_event events[MAX_EVENTS];
+  char buffer[65536];
+  while (!stopRequested) {
+    int n = epoll_wait(epollFd, events, MAX_EVENTS, -1);
+    if (n < 0) {
+      if (errno == EINTR)
+        continue;
+      std::cout << "epoll_wait failed: " << strerror(errno) << std::endl;
+      break;
+    }
+
+    for (int i = 0; i < n; i++) {
+      int fd = events[i].data.fd;
+
+      // New connections
+      if (fd == listenFd) {
+        while (true) {
+          int client = accept4(listenFd, nullptr, nullptr,
+              SOCK_NONBLOCK | SOCK_CLOEXEC);
+          if (client < 0)
+            break;
+          if (numConnections >= opt.maxConnections) {
+            close(client);
+            continue;
+          }
+          if ((int)connections.size() <= client)
+            connections.resize(client + 1);
+          connections[client] = Connection();
+          connections[client].open = true;
+          numConnections++;
+          epoll_event e;
+          memset(&e, 0, sizeof(e));
+          e.events = EPOLLIN;
+          e.data.fd = client;
+          epoll_ctl(epollFd, EPOLL_CTL_ADD, client, &e);
+        }
+        continue;
+      }
+
+      Connection& c = connections[fd];
+      if (!c.open)
+        continue;
+
+      // Read whatever has arrived
+      bool failed = false;
+      bool eof = false;
+      if (events[i].events & (EPOLLIN | EPOLLHUP | EPOLLERR)) {
+        while (true) {
+          ssize_t r = recv(fd, buffer, sizeof(buffer), 0);
+          if (r > 0)
+            c.in.append(buffer, r);
+          else if (r == 0) {
+            eof = true;
+            break;
+          }
+          else if (errno == EINTR)
+            continue;
+          else {
+            failed = (errno != EAGAIN && errno != EWOULDBLOCK);
+            break;
+          }
+        }
+      }
+
+      // Answer every complete line
+      size_t start = 0, end;
+      while (!c.closeAfterWrite
+          && (end = c.in.find('\n', start)) != std::string::npos) {
+        std::string line = c.in.substr(start, end - start);
+        if (!line.empty() && line.back() == '\r')
+          line.pop_back();
+        start = end + 1;
+        bool quit = false;
+        c.out += handleRequest(pool, line, quit) + "\n";
+        if (quit)
+          c.closeAfterWrite = true;
+      }
+      c.in.erase(0, start);
+      if (c.in.size() > MAX_LINE) {
+        c.out += "error line too long\n";
+        c.closeAfterWrite = true;
+      }
+
+      // A client which has hung up gets what can still be sent
+      if (failed || !flush(fd, c) || eof
+          || (c.closeAfterWrite && c.out.empty())) {
+        closeConnection(fd);
+        continue;
+      }
+      updateInterest(fd, c);
+    }
+  }
+
+  for (unsigned int fd = 0; fd < connections.size(); fd++)
+    if (connections[fd].open)
+      close(fd);
+  close(epollFd);
+  close(listenFd);
+  unlink(opt.socketPath.c_str());
+  std::cout << "Server stopped" << std::endl;
+  return 0;
+}
+
+#else
+
+int runServer(ServerOptions&) {
+  std::cout << "The server needs Linux (epoll)" << std::endl;
+  return 1;
+}
+
+#endif
@@ -0,0 +1,172 @@
+#include "solve.h"
+#include "epd.h"
+#include "position.h"
+#include "search.h"
+#include "types.h"
+#include "move.h"
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <iomanip>
+#include <iostream>
+#include <memory>
+#include <mutex>
+#include <sstream>
+#include <thread>
+#include <vector>
+
+// Outcome of one position
+struct SolveRecord {
+  bool scored = false;  // false if skipped
+  bool solved = false;
+  double solvedAt = 0;  // seconds to solution
+  U64 nodes = 0;
+  double seconds = 0;
+  std::string best;
+};
+
+// Finds the moves of a bm or am operand, eg "Nf3 Qxh7+", in the list of
+// legal moves. Annotations such as "!" are ignored. Returns false if one of
+// them is not a legal move.
+static bool findMoves(Position& p, std::string operand,
+    std::vector<Move>& moves, std::vector<U16>& found) {
+  std::istringstream in(operand);
+  std::string san;
+  while (in >> san) {
+    while (!san.empty() && (san.back() == '!' || san.back() == '?'))
+      san.pop_back();
+    int m = p.lookupMove(san, moves);
+    if (m == -1)
+      return false;
+    found.push_back(Search::packMove(moves[m]));
+  }
+  return true;
+}
+
+static bool contains(std::vector<U16>& moves, U16 move) {
+  return std::find(moves.begin(), moves.end(), move) != moves.end();
+}
+
+int runSolver(SolveOptions& opt) {
+  std::vector<EPDEntry> entries;
+  if (!loadEPD(opt.epdFile, entries)) {
+    std::cout << "Cannot read " << opt.epdFile << std::endl;
+    return 1;
+  }
+  if (entries.empty()) {
+    std::cout << "No positions in " << opt.epdFile << std::endl;
+    return 1;
+  }
+
+  int numThreads = std::max(1, std::min(opt.threads, (int)entries.size()));
+  std::cout << entries.size() << " positions from " << opt.epdFile << ", ";
+  if (opt.nodes > 0)
+    std::cout << opt.nodes << " nodes";
+  else
+    std::cout << opt.timeMs / 1000.0 << "s";
+  std::cout << " per position, " << numThreads << " threads" << std::endl;
+
+  std::vector<SolveRecord> records(entries.size());
+  std::mutex outMutex;
+  std::atomic<int> next(0);
+  auto start = std::chrono::steady_clock::now();
+
+  std::vector<std::thread> workers;
+  for (int t = 0; t < numThreads; t++) {
+    workers.push_back(std::thread([&]() {
+      std::unique_ptr<Search> search(new Search(opt.engine));
+      std::vector<U64> keys;
+
+      for (int i = next++; i < (int)entries.size(); i = next++) {
+        EPDEntry& entry = entries[i];
+        std::string id = entry.getOperation("id");
+        if (id.empty())
+          id = "#" + std::to_string(i + 1);
+        Position p;
+        p.loadFEN(entry.fen);
+        std::vector<Move> moves = p.getLegalMoves();
+        p.nameMoves(moves);
+
+        std::vector<U16> bestMoves, avoidMoves;
+        std::string bm = entry.getOperation("bm");
+        std::string am = entry.getOperation("am");
+        if ((bm.empty() && am.empty()) || moves.empty()
+            || !findMoves(p, bm, moves, bestMoves)
+            || !findMoves(p, am, moves, avoidMoves)) {
+          std::lock_guard<std::mutex> lock(outMutex);
+          std::cout << std::setw(5) << (i + 1) << "  " << id
+            << "  skipped: no legal bm or am" << std::endl;
+          continue;
+        }
+
+        // The solution time is that of the first report in the final run of
+        // reports whose best move is right
+        auto isRight = [&](Move& m) {
+          U16 packed = Search::packMove(m);
+          return (bestMoves.empty() || contains(bestMoves, packed))
+            && !contains(avoidMoves, packed);
+        };
+        SolveRecord& record = records[i];
+        bool right = false;
+        search->setInfoCallback([&](SearchResult& r) {
+          if (isRight(r.best) && !right)
+            record.solvedAt = r.seconds;
+          right = isRight(r.best);
+        });
+
+        SearchLimits limits;
+        limits.timeMs = opt.timeMs;
+        limits.nodes = opt.nodes;
+        search->newGame();
+        keys.clear();
+        SearchResult r = search->think(p, limits, keys);
+        record.solved = isRight(r.best);
+        record.nodes = r.nodes;
+        record.seconds = r.seconds;
+        int m = Search::findPackedMove(Search::packMove(r.best), moves);
+        record.best = (m == -1) ? "-" : moves[m].getName();
+        record.scored = true;
+
+        std::lock_guard<std::mutex> lock(outMutex);
+        std::cout << std::fixed << std::setprecision(2) << std::setw(5)
+          << (i + 1) << "  " << id << "  " << record.best << "  "
+          << (record.solved ? "solved" : "failed");
+        if (record.solved)
+          std::cout << " in " << record.solvedAt << "s";
+        std::cout << "  (" << (bm.empty() ? "am " + am : "bm " + bm) << ")"
+          << std::endl;
+      }
+    }));
+  }
+  for (unsigned int t = 0; t < workers.size(); t++)
+    workers[t].join();
+  std::chrono::duration<double> wall = std::chrono::steady_clock::now()
+    - start;
+
+  int total = 0, solved = 0;
+  double solveTime = 0, searchTime = 0;
+  U64 nodes = 0;
+  for (unsigned int i = 0; i < records.size(); i++) {
+    if (!records[i].scored)
+      continue;
+    total++;
+    nodes += records[i].nodes;
+    searchTime += records[i].seconds;
+    if (records[i].solved) {
+      solved++;
+      solveTime += records[i].solvedAt;
+    }
+  }
+
+  std::cout << std::fixed << std::setprecision(1) << "Solved " << solved
+    << " of " << total << " (" << (total ? 100.0 * solved / total : 0)
+    << "%)" << std::setprecision(3) << ", mean time to solution "
+    << (solved ? solveTime / solved : 0) << "s" << std::endl;
+  std::cout << std::setprecision(0) << nodes << " nodes in "
+    << std::setprecision(1) << wall.count() << "s, "
+    << std::setprecision(0) << nodes / std::max(wall.count(), 0.001)
+    << " nps on " << numThreads << " threads ("
+    << nodes / std::max(searchTime, 0.001) << " per thread)" << std::endl;
+  return 0;
+}
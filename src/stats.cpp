@@ -0,0 +1,88 @@
+#include "stats.h"
+
+#ifdef TCHESS_STATS
+
+#include <cstdlib>
+#include <iomanip>
+#include <iostream>
+#include <mutex>
+#include <vector>
+
+// Every thread's statistics. They are never freed so that the totals of
+// finished threads are still available when the report is printed.
+static std::vector<Stats::ThreadStats*> allThreads;
+static std::mutex allThreadsMutex;
+
+static const char* counterNames[NUM_STAT_COUNTERS] = {
+  "makeMove calls",
+  "getLegalMoves calls",
+  "isLegalMove calls",
+  "isLegalMove rejections",
+  "removePiece(int) scans",
+  "removePiece(int) scan steps",
+  "getAttackedSquares(Piece)",
+  "blocker loop iterations",
+  "getAttackedSquares(Color)",
+};
+
+static const char* timerNames[NUM_STAT_TIMERS] = {
+  "getLegalMoves",
+  "isLegalMove",
+  "makeMove",
+  "unmakeMove",
+  "getAttackedSquares(Color)",
+  "nameMoves",
+};
+
+// Creates the statistics for a new thread. The report is scheduled for exit
+// the first time this is called.
+Stats::ThreadStats* Stats::registerThread() {
+  ThreadStats* s = new ThreadStats();
+  std::lock_guard<std::mutex> lock(allThreadsMutex);
+  if (allThreads.size() == 0)
+    atexit(Stats::report);
+  allThreads.push_back(s);
+  return s;
+}
+
+// Prints the counters and timers summed over all threads. Counters are also
+// shown per makeMove call, which is the closest thing to a node count.
+void Stats::report() {
+  std::lock_guard<std::mutex> lock(allThreadsMutex);
+  ThreadStats total = {};
+  for (unsigned int t = 0; t < allThreads.size(); t++) {
+    for (int i = 0; i < NUM_STAT_COUNTERS; i++)
+      total.counters[i] += allThreads[t]->counters[i];
+    for (int i = 0; i < NUM_STAT_TIMERS; i++) {
+      total.timerCalls[i] += allThreads[t]->timerCalls[i];
+      total.timerCycles[i] += allThreads[t]->timerCycles[i];
+    }
+  }
+  double nodes = total.counters[STAT_MAKE_MOVES];
+
+  std::cerr << "==== Hot path statistics (" << allThreads.size()
+    << " threads) ====" << std::endl;
+  std::cerr << std::left << std::setw(30) << "counter" << std::right
+    << std::setw(16) << "total" << std::setw(14) << "per move" << std::endl;
+  std::cerr << std::fixed << std::setprecision(3);
+  for (int i = 0; i < NUM_STAT_COUNTERS; i++) {
+    std::cerr << std::left << std::setw(30) << counterNames[i] << std::right
+      << std::setw(16) << total.counters[i] << std::setw(14)
+      << (nodes > 0 ? total.counters[i] / nodes : 0.0) << std::endl;
+  }
+
+  std::cerr << std::left << std::setw(30) << "timer" << std::right
+    << std::setw(16) << "calls" << std::setw(16) << "cycles"
+    << std::setw(14) << "cycles/call" << std::endl;
+  std::cerr << std::setprecision(1);
+  for (int i = 0; i < NUM_STAT_TIMERS; i++) {
+    U64 calls = total.timerCalls[i];
+    std::cerr << std::left << std::setw(30) << timerNames[i] << std::right
+      << std::setw(16) << calls << std::setw(16) << total.timerCycles[i]
+      << std::setw(14)
+      << (calls > 0 ? (double)total.timerCycles[i] / calls : 0.0)
+      << std::endl;
+  }
+}
+
+#endif
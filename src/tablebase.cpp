@@ -0,0 +1,761 @@
+#include "tablebase.h"
+#include "position.h"
+#include "types.h"
+#include "move.h"
+
+#include <algorithm>
+#include <chrono>
+#include <cstring>
+#include <fcntl.h>
+#include <fstream>
+#include <iostream>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <thread>
+#include <unistd.h>
+
+// Static variables.
+std::map<std::string, std::unique_ptr<Tablebase>> Tablebase::registry;
+std::recursive_mutex Tablebase::registryMutex;
+std::atomic<U8> Tablebase::materialStates[MATERIAL_INDICES];
+std::atomic<Tablebase*> Tablebase::materialTables[MATERIAL_INDICES];
+std::string Tablebase::cacheDirectory;
+int Tablebase::threads = 0;
+
+// Letters used in material signatures, in Piece order.
+static const std::string PIECE_LETTERS = "KQRBNP";
+
+// Header of a cached table file. The packed entries follow immediately.
+struct TablebaseFileHeader {
+  char magic[4];
+  U32 version;
+  char signature[16];
+  U32 bitsPerEntry;
+  U32 maxPlies;
+  U64 numEntries;
+  U64 numWords;
+};
+
+static const U32 TABLEBASE_FILE_VERSION = 1;
+
+// Returns true if the pieces of side a (a string such as "KQ") are at least as
+// strong as those of side b. More pieces is stronger, and otherwise the side
+// with the earlier piece in Piece order wins.
+static bool strongerOrEqual(std::string a, std::string b) {
+  if (a.size() != b.size())
+    return a.size() > b.size();
+  for (unsigned int i = 0; i < a.size(); i++) {
+    size_t ia = PIECE_LETTERS.find(a[i]);
+    size_t ib = PIECE_LETTERS.find(b[i]);
+    if (ia != ib)
+      return ia < ib;
+  }
+  return true;
+}
+
+// Builds a signature out of a list of pieces in any order.
+static std::string signatureFromPieces(std::vector<Piece> pieces) {
+  std::sort(pieces.begin(), pieces.end());
+  std::string sig;
+  for (unsigned int i = 0; i < pieces.size(); i++)
+    sig += PIECE_LETTERS[(int)pieces[i] % 6];
+  return sig;
+}
+
+// Constructor. The table is empty until it is generated or loaded. An invalid
+// signature results in a table with zero pieces.
+Tablebase::Tablebase(std::string sig) {
+  signature = sig;
+  numPieces = 0;
+  numEntries = 0;
+  bitsPerEntry = 0;
+  maxPlies = 0;
+  data = nullptr;
+  mapAddress = nullptr;
+  mapLength = 0;
+  if (!parseSignature(sig, pieces, numPieces))
+    numPieces = 0;
+  else
+    numEntries = (U64)2 << (6*numPieces);
+}
+
+Tablebase::~Tablebase() {
+  if (mapAddress != nullptr)
+    munmap(mapAddress, mapLength);
+}
+
+std::string Tablebase::getSignature() {
+  return signature;
+}
+
+int Tablebase::getMaxPlies() {
+  return maxPlies;
+}
+
+U64 Tablebase::getSizeInBytes() {
+  return ((numEntries * bitsPerEntry + 63) / 64) * sizeof(U64);
+}
+
+// Prints the number of won, lost and drawn entries.
+void Tablebase::printSummary() {
+  U64 wins = 0, losses = 0, draws = 0;
+  for (U64 i = 0; i < numEntries; i++) {
+    U64 v = readEntry(i);
+    if (v == 0)
+      draws++;
+    else if ((v - 1) % 2 == 1)
+      wins++;
+    else
+      losses++;
+  }
+  std::cout << signature << ": " << wins << " won, " << losses << " lost, "
+    << draws << " drawn or illegal, longest mate " << maxPlies << " plies, "
+    << bitsPerEntry << " bits per entry, " << getSizeInBytes() << " bytes"
+    << std::endl;
+}
+
+// Sets the directory used to cache generated tables. An empty string disables
+// caching.
+void Tablebase::setCacheDirectory(std::string dir) {
+  std::lock_guard<std::recursive_mutex> lock(registryMutex);
+  cacheDirectory = dir;
+  forgetMaterial();
+}
+
+// Sets the number of threads used for generation. Zero means one per core.
+void Tablebase::setThreads(int n) {
+  threads = n;
+}
+
+// Returns the table which covers the given signature, loading it from the
+// cache or generating it if necessary. Returns nullptr if the signature is
+// not valid or has too many pieces.
+Tablebase* Tablebase::get(std::string sig) {
+  std::lock_guard<std::recursive_mutex> lock(registryMutex);
+  std::string key = canonicalSignature(sig);
+  auto it = registry.find(key);
+  if (it != registry.end() && it->second != nullptr)
+    return it->second.get();
+
+  std::unique_ptr<Tablebase> table(new Tablebase(key));
+  if (table->numPieces == 0)
+    return nullptr;
+  if (cacheDirectory.empty() || !table->load(cacheDirectory)) {
+    if (!table->generate(threads))
+      return nullptr;
+    if (!cacheDirectory.empty())
+      table->save(cacheDirectory);
+  }
+  Tablebase* t = table.get();
+  registry[key] = std::move(table);
+  forgetMaterial();
+  return t;
+}
+
+// Looks up the given position in the tables which have already been generated
+// or can be loaded from the cache. Tables are never generated here, so this is
+// safe to call from search. Returns false if no table covers the position,
+// otherwise sets the result for the side to move and the distance to mate in
+// plies (0 for draws).
+//
+// Once the table for a material index has been looked for, later probes of
+// that material only read materialStates and materialTables, taking no lock
+// and allocating nothing.
+bool Tablebase::probe(Position& p, TBResult& result, int& dtm) {
+  // Castling rights are not part of any table
+  if (p.flags & 0xf0)
+    return false;
+
+  int material = materialIndex(p);
+  if (material < 0)
+    return false;
+  if (material == 0) {
+    result = TB_DRAW;
+    dtm = 0;
+    return true;
+  }
+
+  U8 state = materialStates[material].load(std::memory_order_acquire);
+  if (state == MATERIAL_UNKNOWN)
+    state = findMaterial(p, material);
+  if (state == MATERIAL_MISSING)
+    return false;
+  Tablebase* t = materialTables[material].load(std::memory_order_relaxed);
+  result = t->probeIndex(t->indexOf(p, state == MATERIAL_FLIPPED), dtm);
+  return true;
+}
+
+// Returns the index of the material of the position, from the number of each
+// piece other than the kings (a base 3 digit each), or -1 if it has too many
+// pieces or not one king on each side. Only kings is 0.
+int Tablebase::materialIndex(Position& p) {
+  if (Position::popcount(p.bbs[W_KING]) != 1
+      || Position::popcount(p.bbs[B_KING]) != 1)
+    return -1;
+  int index = 0, pieces = 2;
+  for (int i = 0; i < 12; i++) {
+    if (i % 6 == W_KING)
+      continue;
+    int n = Position::popcount(p.bbs[i]);
+    pieces += n;
+    if (pieces > MAX_PIECES)
+      return -1;
+    index = 3*index + n;
+  }
+  return index;
+}
+
+// Finds the table for the material of the position in the registry or the
+// cache, and records it under the material index. Returns the new state.
+U8 Tablebase::findMaterial(Position& p, int material) {
+  std::lock_guard<std::recursive_mutex> lock(registryMutex);
+  U8 state = materialStates[material].load(std::memory_order_relaxed);
+  if (state != MATERIAL_UNKNOWN)
+    return state;
+
+  std::string sig = getMaterialSignature(p);
+  std::string key = canonicalSignature(sig);
+  Tablebase* t = nullptr;
+  auto it = registry.find(key);
+  if (it != registry.end())
+    t = it->second.get();
+  else {
+    // Try the cache once, remembering a miss as a null entry
+    std::unique_ptr<Tablebase> table(new Tablebase(key));
+    if (table->numPieces == 0 || cacheDirectory.empty()
+        || !table->load(cacheDirectory))
+      table.reset();
+    t = table.get();
+    registry[key] = std::move(table);
+  }
+
+  state = (t == nullptr) ? MATERIAL_MISSING
+    : (key != sig) ? MATERIAL_FLIPPED : MATERIAL_FOUND;
+  materialTables[material].store(t, std::memory_order_relaxed);
+  materialStates[material].store(state, std::memory_order_release);
+  return state;
+}
+
+// Makes every material index be looked up again, after the registry or the
+// cache directory has changed. Called with the registry locked.
+void Tablebase::forgetMaterial() {
+  for (int i = 0; i < MATERIAL_INDICES; i++)
+    materialStates[i].store(MATERIAL_UNKNOWN, std::memory_order_relaxed);
+}
+
+// Returns the material signature of the position, eg "KRKP".
+std::string Tablebase::getMaterialSignature(Position& p) {
+  std::string sig;
+  for (int c = 0; c < 2; c++) {
+    for (int i = 0; i < 6; i++) {
+      for (U64 b = p.bbs[i + 6*c]; b != 0; b &= b - 1)
+        sig += PIECE_LETTERS[i];
+    }
+  }
+  return sig;
+}
+
+// Returns the signature under which the given material is stored. This is
+// either the signature itself or its color-flipped twin.
+std::string Tablebase::canonicalSignature(std::string sig) {
+  size_t split = sig.find('K', 1);
+  if (split == std::string::npos)
+    return sig;
+  std::string w = sig.substr(0, split);
+  std::string b = sig.substr(split);
+  if (strongerOrEqual(w, b))
+    return sig;
+  return b + w;
+}
+
+// Returns the signature with the colors swapped.
+std::string Tablebase::flipSignature(std::string sig) {
+  size_t split = sig.find('K', 1);
+  if (split == std::string::npos)
+    return sig;
+  return sig.substr(split) + sig.substr(0, split);
+}
+
+// Converts a signature into a list of pieces, white first and each side in
+// Piece order. Returns false if the signature is malformed.
+bool Tablebase::parseSignature(std::string sig, Piece* out, int& n) {
+  if (sig.size() < 2 || (int)sig.size() > MAX_PIECES || sig[0] != 'K')
+    return false;
+  size_t split = sig.find('K', 1);
+  if (split == std::string::npos || sig.find('K', split + 1) != std::string::npos)
+    return false;
+
+  std::vector<Piece> list;
+  for (unsigned int i = 0; i < sig.size(); i++) {
+    size_t t = PIECE_LETTERS.find(sig[i]);
+    if (t == std::string::npos)
+      return false;
+    int color = (i < split) ? 0 : 1;
+    list.push_back((Piece)(t + 6*color));
+  }
+  std::sort(list.begin(), list.end());
+  n = list.size();
+  for (int i = 0; i < n; i++)
+    out[i] = list[i];
+  return true;
+}
+
+// Computes the index of the given piece squares and side to move.
+U64 Tablebase::encode(const int* sq, Color stm) {
+  U64 idx = (U64)stm;
+  for (int i = numPieces - 1; i >= 0; i--)
+    idx = (idx << 6) | (U64)sq[i];
+  return idx;
+}
+
+// Inverse of encode.
+void Tablebase::decode(U64 idx, int* sq, Color& stm) {
+  for (int i = 0; i < numPieces; i++)
+    sq[i] = (idx >> (6*i)) & 63;
+  stm = (Color)(idx >> (6*numPieces));
+}
+
+// Identical pieces are interchangeable, so only the placement which lists
+// them in increasing square order is used.
+bool Tablebase::isCanonicalOrder(const int* sq) {
+  for (int i = 0; i + 1 < numPieces; i++)
+    if (pieces[i] == pieces[i + 1] && sq[i] > sq[i + 1])
+      return false;
+  return true;
+}
+
+// Reorders the squares of identical pieces so that they are increasing.
+void Tablebase::canonicalizeOrder(int* sq) {
+  for (int i = 1; i < numPieces; i++) {
+    for (int j = i; j > 0 && pieces[j] == pieces[j - 1] && sq[j] < sq[j - 1];
+        j--)
+      std::swap(sq[j], sq[j - 1]);
+  }
+}
+
+// Returns the index of the position, which must have exactly the material of
+// this table (or of its twin, in which case flip must be true).
+U64 Tablebase::indexOf(Position& p, bool flip) {
+  U64 remaining[12];
+  for (int i = 0; i < 12; i++)
+    remaining[i] = p.bbs[i];
+
+  int sq[MAX_PIECES];
+  for (int i = 0; i < numPieces; i++) {
+    Piece actual = flip ? Position::swapColor(pieces[i]) : pieces[i];
+    int s = Position::bitscan(remaining[actual]);
+    remaining[actual] &= remaining[actual] - 1;
+    sq[i] = flip ? (s ^ 56) : s;
+  }
+  canonicalizeOrder(sq);
+  Color stm = flip ? Position::oppositeColor(p.player) : p.player;
+  return encode(sq, stm);
+}
+
+// Sets up the position with the given index. Returns false if the placement
+// is impossible (overlapping pieces, pawns on the first or last rank, or
+// identical pieces out of order). Whether the side not to move is in check
+// is not considered here.
+bool Tablebase::setupPosition(U64 idx, Position& p) {
+  int sq[MAX_PIECES];
+  Color stm;
+  decode(idx, sq, stm);
+  if (!isCanonicalOrder(sq))
+    return false;
+
+  p = Position();
+  p.player = stm;
+  U64 occupied = 0;
+  for (int i = 0; i < numPieces; i++) {
+    U64 mask = ONE << sq[i];
+    if (occupied & mask)
+      return false;
+    if ((pieces[i] == Piece::W_PAWN || pieces[i] == Piece::B_PAWN)
+        && (sq[i] < 8 || sq[i] >= 56))
+      return false;
+    occupied |= mask;
+    p.placePiece(pieces[i], sq[i]);
+  }
+  return true;
+}
+
+// Returns the packed value of the entry.
+U64 Tablebase::readEntry(U64 idx) {
+  U64 bit = idx * bitsPerEntry;
+  U64 word = bit >> 6;
+  int offset = bit & 63;
+  U64 v = data[word] >> offset;
+  if (offset + bitsPerEntry > 64)
+    v |= data[word + 1] << (64 - offset);
+  return v & ((ONE << bitsPerEntry) - 1);
+}
+
+// Decodes the entry into a result for the side to move and its DTM.
+TBResult Tablebase::probeIndex(U64 idx, int& dtm) {
+  U64 v = readEntry(idx);
+  if (v == 0) {
+    dtm = 0;
+    return TB_DRAW;
+  }
+  dtm = v - 1;
+  return (dtm % 2 == 1) ? TB_WIN : TB_LOSS;
+}
+
+// Resolves a position reached by leaving this table through a capture or
+// promotion, using the smaller tables.
+bool Tablebase::probeExit(Position& p, TBResult& result, int& dtm) {
+  std::string sig = getMaterialSignature(p);
+  if (sig == "KK") {
+    result = TB_DRAW;
+    dtm = 0;
+    return true;
+  }
+  std::string key = canonicalSignature(sig);
+  auto it = subTables.find(key);
+  if (it == subTables.end())
+    return false;
+  Tablebase* t = it->second;
+  result = t->probeIndex(t->indexOf(p, key != sig), dtm);
+  return true;
+}
+
+// Adds the entry to the bucket of positions which are resolved at the given
+// ply.
+void Tablebase::schedule(std::vector<std::vector<U64>>& buckets, int ply,
+    U64 idx, EntryState s) {
+  if ((int)buckets.size() <= ply)
+    buckets.resize(ply + 1);
+  buckets[ply].push_back((idx << 2) | s);
+}
+
+// Examines every entry in [lo, hi): marks illegal placements, mates and
+// stalemates, counts the moves which stay inside the table and resolves the
+// moves which leave it.
+void Tablebase::initializeRange(U64 lo, U64 hi,
+    std::vector<std::vector<U64>>& buckets) {
+  Position p;
+  for (U64 idx = lo; idx < hi; idx++) {
+    counts[idx] = 0;
+    if (!setupPosition(idx, p) || p.inCheck(Position::oppositeColor(p.player))) {
+      state[idx] = ILLEGAL;
+      continue;
+    }
+
+    std::vector<Move> moves = p.getLegalMoves();
+    if (moves.size() == 0) {
+      if (p.inCheck(p.player))
+        schedule(buckets, 0, idx, LOSS);
+      else
+        state[idx] = DRAW;
+      continue;
+    }
+
+    int inTable = 0;
+    int minWin = -1;
+    int maxLoss = 0;
+    bool exitDraw = false;
+    for (unsigned int i = 0; i < moves.size(); i++) {
+      if (!moves[i].isCapture() && moves[i].getPromotedPiece() == NO_PIECE) {
+        inTable++;
+        continue;
+      }
+      TBResult r = TB_DRAW;
+      int d = 0;
+      p.makeMove(moves[i]);
+      probeExit(p, r, d);
+      p.unmakeMove(moves[i]);
+      // r is from the opponent's point of view
+      if (r == TB_LOSS) {
+        if (minWin < 0 || d + 1 < minWin)
+          minWin = d + 1;
+      }
+      else if (r == TB_DRAW)
+        exitDraw = true;
+      else
+        maxLoss = std::max(maxLoss, d + 1);
+    }
+
+    counts[idx] = inTable;
+    exitLoss[idx] = maxLoss;
+    blocked[idx] = (minWin >= 0 || exitDraw);
+    if (minWin >= 0)
+      schedule(buckets, minWin, idx, WIN);
+    else if (inTable == 0) {
+      if (exitDraw)
+        state[idx] = DRAW;
+      else
+        schedule(buckets, maxLoss, idx, LOSS);
+    }
+  }
+}
+
+// Visits the predecessors of the entries frontier[lo, hi), which were all
+// resolved at the given ply. Predecessors of a loss are wins one ply later.
+// Predecessors of a win lose once all of their moves are known to lose.
+void Tablebase::propagateRange(std::vector<U64>& frontier, size_t lo,
+    size_t hi, int ply, std::vector<std::vector<U64>>& buckets) {
+  Position p;
+  int sq[MAX_PIECES];
+  int prev[MAX_PIECES];
+  for (size_t k = lo; k < hi; k++) {
+    U64 idx = frontier[k];
+    Color stm;
+    decode(idx, sq, stm);
+    setupPosition(idx, p);
+    Color mover = Position::oppositeColor(stm);
+    U64 occupied = p.getOccupied();
+    bool isLoss = (state[idx] == LOSS);
+
+    for (int i = 0; i < numPieces; i++) {
+      if (Position::getColor(pieces[i]) != mover)
+        continue;
+
+      // Squares the piece could have come from with a non-capturing move
+      int t = sq[i];
+      U64 froms = 0;
+      if (pieces[i] == Piece::W_PAWN) {
+        if (t >= 16 && !(occupied & (ONE << (t - 8)))) {
+          froms |= ONE << (t - 8);
+          if (Position::squareToRank(t) == 3 && !(occupied & (ONE << (t - 16))))
+            froms |= ONE << (t - 16);
+        }
+      }
+      else if (pieces[i] == Piece::B_PAWN) {
+        if (t <= 47 && !(occupied & (ONE << (t + 8)))) {
+          froms |= ONE << (t + 8);
+          if (Position::squareToRank(t) == 4 && !(occupied & (ONE << (t + 16))))
+            froms |= ONE << (t + 16);
+        }
+      }
+      else
+        froms = p.getAttackedSquares(pieces[i], t) & ~occupied;
+
+      for (; froms != 0; froms &= froms - 1) {
+        for (int j = 0; j < numPieces; j++)
+          prev[j] = sq[j];
+        prev[i] = Position::bitscan(froms);
+        canonicalizeOrder(prev);
+        U64 q = encode(prev, mover);
+        if (state[q] != UNKNOWN)
+          continue;
+        if (isLoss)
+          schedule(buckets, ply + 1, q, WIN);
+        else if (counts[q].fetch_sub(1) == 1 && !blocked[q])
+          schedule(buckets, std::max(ply + 1, (int)exitLoss[q]), q, LOSS);
+      }
+    }
+  }
+}
+
+// Runs fn(thread, lo, hi, buckets) over [0, n) split across the given number
+// of threads, then merges the buckets each thread produced.
+template <typename F>
+static void runSplit(U64 n, int numThreads, F fn,
+    std::vector<std::vector<U64>>& buckets) {
+  std::vector<std::vector<std::vector<U64>>> local(numThreads);
+  std::vector<std::thread> workers;
+  U64 chunk = (n + numThreads - 1) / numThreads;
+  for (int t = 0; t < numThreads; t++) {
+    U64 lo = std::min(n, t * chunk);
+    U64 hi = std::min(n, lo + chunk);
+    workers.push_back(std::thread(fn, lo, hi, std::ref(local[t])));
+  }
+  for (unsigned int t = 0; t < workers.size(); t++)
+    workers[t].join();
+
+  for (int t = 0; t < numThreads; t++) {
+    if (local[t].size() > buckets.size())
+      buckets.resize(local[t].size());
+    for (unsigned int ply = 0; ply < local[t].size(); ply++)
+      buckets[ply].insert(buckets[ply].end(), local[t][ply].begin(),
+          local[t][ply].end());
+  }
+}
+
+// Generates the table by retrograde analysis, first making sure that every
+// table reachable by a capture or promotion exists. Returns false if one of
+// those could not be generated.
+bool Tablebase::generate(int numThreads) {
+  if (numPieces == 0)
+    return false;
+  if (numThreads <= 0)
+    numThreads = std::max(1u, std::thread::hardware_concurrency());
+  auto start = std::chrono::steady_clock::now();
+
+  // Collect the material left after every capture and promotion
+  std::vector<std::string> subs;
+  for (int promo = -1; promo < numPieces; promo++) {
+    if (promo >= 0 && pieces[promo] != Piece::W_PAWN
+        && pieces[promo] != Piece::B_PAWN)
+      continue;
+    for (int captured = -1; captured < numPieces; captured++) {
+      if (promo == -1 && captured == -1)
+        continue;
+      if (captured == promo)
+        continue;
+      if (captured >= 0 && (pieces[captured] == Piece::W_KING
+            || pieces[captured] == Piece::B_KING))
+        continue;
+      // Promotions are always to one of queen, rook, bishop or knight
+      for (int to = Piece::W_QUEEN; to <= Piece::W_KNIGHT; to++) {
+        std::vector<Piece> list;
+        for (int i = 0; i < numPieces; i++) {
+          if (i == captured)
+            continue;
+          if (i == promo)
+            list.push_back(Position::makeColor((Piece)to,
+                  Position::getColor(pieces[i])));
+          else
+            list.push_back(pieces[i]);
+        }
+        subs.push_back(signatureFromPieces(list));
+        if (promo == -1)
+          break;
+      }
+    }
+  }
+  for (unsigned int i = 0; i < subs.size(); i++) {
+    if (subs[i] == "KK")
+      continue;
+    std::string key = canonicalSignature(subs[i]);
+    if (subTables.count(key))
+      continue;
+    Tablebase* t = get(key);
+    if (t == nullptr)
+      return false;
+    subTables[key] = t;
+  }
+
+  state.assign(numEntries, UNKNOWN);
+  plies.assign(numEntries, 0);
+  exitLoss.assign(numEntries, 0);
+  blocked.assign(numEntries, 0);
+  counts.reset(new std::atomic<U8>[numEntries]);
+
+  std::vector<std::vector<U64>> buckets;
+  runSplit(numEntries, numThreads,
+      [this](U64 lo, U64 hi, std::vector<std::vector<U64>>& b) {
+        initializeRange(lo, hi, b);
+      }, buckets);
+
+  // Resolve entries one ply at a time
+  std::vector<U64> frontier;
+  for (int ply = 0; ply < (int)buckets.size(); ply++) {
+    frontier.clear();
+    for (unsigned int i = 0; i < buckets[ply].size(); i++) {
+      U64 idx = buckets[ply][i] >> 2;
+      if (state[idx] != UNKNOWN)
+        continue;
+      state[idx] = (EntryState)(buckets[ply][i] & 3);
+      plies[idx] = ply;
+      frontier.push_back(idx);
+    }
+    std::vector<U64>().swap(buckets[ply]);
+    if (frontier.size() == 0)
+      continue;
+
+    runSplit(frontier.size(), numThreads,
+        [this, &frontier, ply](U64 lo, U64 hi,
+          std::vector<std::vector<U64>>& b) {
+          propagateRange(frontier, lo, hi, ply, b);
+        }, buckets);
+  }
+
+  pack();
+
+  // Release the scratch space
+  std::vector<U8>().swap(state);
+  std::vector<U16>().swap(plies);
+  std::vector<U16>().swap(exitLoss);
+  std::vector<U8>().swap(blocked);
+  counts.reset();
+
+  auto end = std::chrono::steady_clock::now();
+  std::chrono::duration<double> elapsed = end - start;
+  std::cout << "Generated " << signature << " in " << elapsed.count() << "s"
+    << std::endl;
+  return true;
+}
+
+// Packs the generated results into as few bits per entry as the longest mate
+// allows. Unresolved entries are draws.
+void Tablebase::pack() {
+  maxPlies = 0;
+  for (U64 i = 0; i < numEntries; i++)
+    if (state[i] == WIN || state[i] == LOSS)
+      maxPlies = std::max(maxPlies, (int)plies[i]);
+  bitsPerEntry = 1;
+  while ((ONE << bitsPerEntry) < (U64)maxPlies + 2)
+    bitsPerEntry++;
+
+  packed.assign((numEntries * bitsPerEntry + 63) / 64 + 1, 0);
+  for (U64 i = 0; i < numEntries; i++) {
+    if (state[i] != WIN && state[i] != LOSS)
+      continue;
+    U64 v = (U64)plies[i] + 1;
+    U64 bit = i * bitsPerEntry;
+    U64 word = bit >> 6;
+    int offset = bit & 63;
+    packed[word] |= v << offset;
+    if (offset + bitsPerEntry > 64)
+      packed[word + 1] |= v >> (64 - offset);
+  }
+  data = packed.data();
+}
+
+// Writes the table to dir. Returns false on failure.
+bool Tablebase::save(std::string dir) {
+  std::ofstream file(dir + "/" + signature + ".tctb", std::ios::binary);
+  if (!file.is_open())
+    return false;
+
+  TablebaseFileHeader header;
+  memset(&header, 0, sizeof(header));
+  memcpy(header.magic, "TCTB", 4);
+  header.version = TABLEBASE_FILE_VERSION;
+  strncpy(header.signature, signature.c_str(), sizeof(header.signature) - 1);
+  header.bitsPerEntry = bitsPerEntry;
+  header.maxPlies = maxPlies;
+  header.numEntries = numEntries;
+  header.numWords = packed.size();
+  file.write((const char*)&header, sizeof(header));
+  file.write((const char*)packed.data(), packed.size() * sizeof(U64));
+  return file.good();
+}
+
+// Memory maps the table from dir. Returns false if there is no valid cached
+// file for this signature.
+bool Tablebase::load(std::string dir) {
+  std::string path = dir + "/" + signature + ".tctb";
+  int fd = open(path.c_str(), O_RDONLY);
+  if (fd < 0)
+    return false;
+  struct stat st;
+  if (fstat(fd, &st) != 0 || (size_t)st.st_size < sizeof(TablebaseFileHeader)) {
+    close(fd);
+    return false;
+  }
+  void* addr = mmap(nullptr, st.st_size, PROT_READ, MAP_SHARED, fd, 0);
+  close(fd);
+  if (addr == MAP_FAILED)
+    return false;
+
+  const TablebaseFileHeader* header = (const TablebaseFileHeader*)addr;
+  bool valid = memcmp(header->magic, "TCTB", 4) == 0
+    && header->version == TABLEBASE_FILE_VERSION
+    && signature == std::string(header->signature)
+    && header->numEntries == numEntries
+    && (size_t)st.st_size
+      == sizeof(TablebaseFileHeader) + header->numWords * sizeof(U64);
+  if (!valid) {
+    munmap(addr, st.st_size);
+    return false;
+  }
+
+  mapAddress = addr;
+  mapLength = st.st_size;
+  bitsPerEntry = header->bitsPerEntry;
+  maxPlies = header->maxPlies;
+  data = (const U64*)((const char*)addr + sizeof(TablebaseFileHeader));
+  return true;
+}
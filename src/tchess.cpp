@@ -1,36 +1,352 @@
 #include "position.h"
 #include "types.h"
 #include "move.h"
+#include "tablebase.h"
+#include "regression.h"
+#include "server.h"
+#include "match.h"
+#include "datagen.h"
+#include "solve.h"
+#include "tune.h"
+#include "uci.h"
 
 #include <iostream>
 #include <unistd.h>
 #include <fstream>
+#include <sstream>
 #include <string>
 #include <stack>
 #include <vector>
 
-void testMakeMove(std::string);
-void testMoveGenAccuracy(std::string);
 void printHelp();
+void printUsage();
+int generateTablebase(int, char**);
+int probeTablebase(int, char**);
+int runTests(int, char**);
+int serve(int, char**);
+int match(int, char**);
+int solve(int, char**);
+int datagen(int, char**);
+int tune(int, char**);
 int playGame();
 int bitscan(U64);
 
 int main(int argc, char** argv) {
-  // No arguments allowed
-  if (argc != 1) {
-    std::cout << "This program should not be run with arguments." << std::endl;
-    argv[0] = argv[0]; // Suppress warning that argv is unused.
+  // Without arguments, play a game on the console
+  if (argc == 1) {
+    int result = playGame();
+    if (result == 1)
+      std::cout << "White won." << std::endl;
+    else if (result == -1)
+      std::cout << "Black won." << std::endl;
+    else
+      std::cout << "Drawn." << std::endl;
     return 0;
   }
-  
-  Position::populateMaskArrays();
-  int result = playGame();
-  if (result == 1)
-    std::cout << "White won." << std::endl;
-  else if (result == -1)
-    std::cout << "Black won." << std::endl;
+
+  std::string mode(argv[1]);
+  if (mode == "tbgen" && argc >= 3)
+    return generateTablebase(argc, argv);
+  if (mode == "tbprobe" && argc >= 3)
+    return probeTablebase(argc, argv);
+  if (mode == "test")
+    return runTests(argc, argv);
+  if (mode == "serve")
+    return serve(argc, argv);
+  if (mode == "match")
+    return match(argc, argv);
+  if (mode == "datagen")
+    return datagen(argc, argv);
+  if (mode == "tune")
+    return tune(argc, argv);
+  if (mode == "uci")
+    return runUCI(std::cin, std::cout);
+  if (mode == "solve" && argc >= 3)
+    return solve(argc, argv);
+
+  printUsage();
+  return 1;
+}
+
+// Prints the command line modes.
+void printUsage() {
+  std::cout << "Usage:" << std::endl;
+  std::cout << "  main                                  play a game" << std::endl;
+  std::cout << "  main tbgen <material> [threads] [dir] generate a tablebase, eg KQK" << std::endl;
+  std::cout << "  main tbprobe <fen> [dir]              look up a position" << std::endl;
+  std::cout << "  main test [options]                   run the suites in tests/" << std::endl;
+  std::cout << "    --threads n, --filter name, --tolerance fraction," << std::endl;
+  std::cout << "    --baseline file, --update-baseline" << std::endl;
+  std::cout << "  main serve [socket] [sessions]        serve games over a Unix socket" << std::endl;
+  std::cout << "  main uci                              play through a UCI chess GUI" << std::endl;
+  std::cout << "  main match [options]                  play engine A against B" << std::endl;
+  std::cout << "    --games n, --concurrency n, --tc base+inc (seconds)," << std::endl;
+  std::cout << "    --openings file.epd, --pgn file, --max-plies n," << std::endl;
+  std::cout << "    --sprt elo0 elo1, --alpha a, --beta b, --no-sprt," << std::endl;
+  std::cout << "    --a name=value,... and --b name=value,... (hash, quiescence, tablebases," << std::endl;
+  std::cout << "    nnue=file, pvs, aspiration, nullmove, lmr, futility, checkext)" << std::endl;
+  std::cout << "  main solve <file.epd> [options]       run a bm/am test suite" << std::endl;
+  std::cout << "    --threads n, --time ms, --nodes n, --engine name=value,..." << std::endl;
+  std::cout << "  main datagen [options]                write self-play training data" << std::endl;
+  std::cout << "    --games n, --threads n, --nodes n, --depth n, --random-plies n," << std::endl;
+  std::cout << "    --hash mb, --seed n, --output file" << std::endl;
+  std::cout << "  main tune <data>... [options]         tune the evaluation on datagen output" << std::endl;
+  std::cout << "    --threads n, --epochs n, --lr rate, --k k, --quiescence," << std::endl;
+  std::cout << "    --params file, --output file" << std::endl;
+}
+
+// Generates training data with the options given on the command line.
+int datagen(int argc, char** argv) {
+  DatagenOptions opt;
+  try {
+    for (int i = 2; i < argc; i++) {
+      std::string arg(argv[i]);
+      bool hasValue = i + 1 < argc;
+      if (arg == "--games" && hasValue)
+        opt.games = std::stoull(argv[++i]);
+      else if (arg == "--threads" && hasValue)
+        opt.threads = std::max(1, std::stoi(argv[++i]));
+      else if (arg == "--nodes" && hasValue)
+        opt.nodes = std::stoull(argv[++i]);
+      else if (arg == "--depth" && hasValue)
+        opt.depth = std::min(MAX_PLY - 1, std::max(1, std::stoi(argv[++i])));
+      else if (arg == "--random-plies" && hasValue)
+        opt.randomPlies = std::max(0, std::stoi(argv[++i]));
+      else if (arg == "--hash" && hasValue)
+        opt.hashMB = std::max(1, std::stoi(argv[++i]));
+      else if (arg == "--seed" && hasValue)
+        opt.seed = std::stoull(argv[++i]);
+      else if (arg == "--output" && hasValue)
+        opt.outputFile = argv[++i];
+      else {
+        printUsage();
+        return 1;
+      }
+    }
+  } catch (...) {
+    printUsage();
+    return 1;
+  }
+  return runDatagen(opt);
+}
+
+// Tunes the evaluation with the options given on the command line.
+int tune(int argc, char** argv) {
+  TuneOptions opt;
+  try {
+    for (int i = 2; i < argc; i++) {
+      std::string arg(argv[i]);
+      bool hasValue = i + 1 < argc;
+      if (arg == "--threads" && hasValue)
+        opt.threads = std::max(1, std::stoi(argv[++i]));
+      else if (arg == "--epochs" && hasValue)
+        opt.epochs = std::max(0, std::stoi(argv[++i]));
+      else if (arg == "--lr" && hasValue)
+        opt.learningRate = std::stod(argv[++i]);
+      else if (arg == "--k" && hasValue)
+        opt.k = std::stod(argv[++i]);
+      else if (arg == "--quiescence")
+        opt.quiescence = true;
+      else if (arg == "--params" && hasValue)
+        opt.paramsFile = argv[++i];
+      else if (arg == "--output" && hasValue)
+        opt.outputFile = argv[++i];
+      else if (arg.rfind("--", 0) != 0)
+        opt.dataFiles.push_back(arg);
+      else {
+        printUsage();
+        return 1;
+      }
+    }
+  } catch (...) {
+    printUsage();
+    return 1;
+  }
+  if (opt.dataFiles.empty()) {
+    printUsage();
+    return 1;
+  }
+  return runTuner(opt);
+}
+
+// Applies engine options given as "name=value,name=value".
+static bool parseEngineOptions(std::string list, SearchOptions& options) {
+  std::istringstream in(list);
+  std::string item;
+  while (std::getline(in, item, ',')) {
+    size_t eq = item.find('=');
+    if (eq == std::string::npos
+        || !options.set(item.substr(0, eq), item.substr(eq + 1))) {
+      std::cout << "Unknown engine option " << item << std::endl;
+      return false;
+    }
+  }
+  return true;
+}
+
+// Plays a match with the options given on the command line.
+int match(int argc, char** argv) {
+  MatchOptions opt;
+  try {
+    for (int i = 2; i < argc; i++) {
+      std::string arg(argv[i]);
+      bool hasValue = i + 1 < argc;
+      if (arg == "--games" && hasValue)
+        opt.games = std::max(1, std::stoi(argv[++i]));
+      else if (arg == "--concurrency" && hasValue)
+        opt.concurrency = std::max(1, std::stoi(argv[++i]));
+      else if (arg == "--tc" && hasValue) {
+        std::string tc(argv[++i]);
+        size_t plus = tc.find('+');
+        opt.baseMs = (int)(std::stod(tc.substr(0, plus)) * 1000);
+        opt.incrementMs = (plus == std::string::npos) ? 0
+          : (int)(std::stod(tc.substr(plus + 1)) * 1000);
+      }
+      else if (arg == "--openings" && hasValue)
+        opt.openingsFile = argv[++i];
+      else if (arg == "--pgn" && hasValue)
+        opt.pgnFile = argv[++i];
+      else if (arg == "--max-plies" && hasValue)
+        opt.maxPlies = std::max(1, std::stoi(argv[++i]));
+      else if (arg == "--sprt" && i + 2 < argc) {
+        opt.elo0 = std::stod(argv[++i]);
+        opt.elo1 = std::stod(argv[++i]);
+      }
+      else if (arg == "--alpha" && hasValue)
+        opt.alpha = std::stod(argv[++i]);
+      else if (arg == "--beta" && hasValue)
+        opt.beta = std::stod(argv[++i]);
+      else if (arg == "--no-sprt")
+        opt.sprt = false;
+      else if ((arg == "--a" || arg == "--b") && hasValue) {
+        EngineConfig& e = opt.engines[arg == "--a" ? 0 : 1];
+        if (!parseEngineOptions(argv[++i], e.options))
+          return 1;
+        e.name += std::string(" ") + argv[i];
+      }
+      else {
+        printUsage();
+        return 1;
+      }
+    }
+  } catch (...) {
+    printUsage();
+    return 1;
+  }
+  return runMatch(opt);
+}
+
+// Runs the test suite given on the command line.
+int solve(int argc, char** argv) {
+  SolveOptions opt;
+  opt.epdFile = argv[2];
+  try {
+    for (int i = 3; i < argc; i++) {
+      std::string arg(argv[i]);
+      bool hasValue = i + 1 < argc;
+      if (arg == "--threads" && hasValue)
+        opt.threads = std::max(1, std::stoi(argv[++i]));
+      else if (arg == "--time" && hasValue) {
+        opt.timeMs = std::max(1, std::stoi(argv[++i]));
+        opt.nodes = 0;
+      }
+      else if (arg == "--nodes" && hasValue) {
+        opt.nodes = std::max(1ULL, std::stoull(argv[++i]));
+        opt.timeMs = 0;
+      }
+      else if (arg == "--engine" && hasValue) {
+        if (!parseEngineOptions(argv[++i], opt.engine))
+          return 1;
+      }
+      else {
+        printUsage();
+        return 1;
+      }
+    }
+  } catch (...) {
+    printUsage();
+    return 1;
+  }
+  return runSolver(opt);
+}
+
+// Serves games on the socket given on the command line.
+int serve(int argc, char** argv) {
+  ServerOptions opt;
+  if (argc >= 3)
+    opt.socketPath = argv[2];
+  if (argc >= 4)
+    opt.maxSessions = std::max(1, std::stoi(argv[3]));
+  return runServer(opt);
+}
+
+// Runs the regression suites with the options given on the command line.
+int runTests(int argc, char** argv) {
+  RegressionOptions opt;
+  for (int i = 2; i < argc; i++) {
+    std::string arg(argv[i]);
+    if (arg == "--update-baseline")
+      opt.updateBaseline = true;
+    else if (arg == "--threads" && i + 1 < argc)
+      opt.threads = std::stoi(argv[++i]);
+    else if (arg == "--filter" && i + 1 < argc)
+      opt.filter = argv[++i];
+    else if (arg == "--tolerance" && i + 1 < argc)
+      opt.tolerance = std::stod(argv[++i]);
+    else if (arg == "--baseline" && i + 1 < argc)
+      opt.baselineFile = argv[++i];
+    else if (arg == "--dir" && i + 1 < argc)
+      opt.directory = argv[++i];
+    else {
+      printUsage();
+      return 1;
+    }
+  }
+  return runRegressionTests(opt);
+}
+
+// Generates the tablebase for the material given on the command line, caching
+// it (and every smaller table it needs) in the given directory.
+int generateTablebase(int argc, char** argv) {
+  if (argc >= 4)
+    Tablebase::setThreads(std::stoi(argv[3]));
+  if (argc >= 5)
+    Tablebase::setCacheDirectory(argv[4]);
+  Tablebase* t = Tablebase::get(argv[2]);
+  if (t == nullptr) {
+    std::cout << "Cannot generate a table for " << argv[2] << std::endl;
+    return 1;
+  }
+  t->printSummary();
+  return 0;
+}
+
+// Looks up the FEN given on the command line, generating the table if it is
+// not cached.
+int probeTablebase(int argc, char** argv) {
+  if (argc >= 4)
+    Tablebase::setCacheDirectory(argv[3]);
+  Position p(argv[2]);
+  std::string sig = Tablebase::getMaterialSignature(p);
+  if (sig.size() > 2 && Tablebase::get(sig) == nullptr) {
+    std::cout << "No table for " << sig << std::endl;
+    return 1;
+  }
+  TBResult result;
+  int dtm;
+  if (!Tablebase::probe(p, result, dtm)) {
+    std::cout << "Position is not covered by the tablebase." << std::endl;
+    return 1;
+  }
+  p.printBoard();
+  if (result == TB_WIN)
+    std::cout << "Win, mate in " << (dtm + 1) / 2 << " (" << dtm << " plies)";
+  else if (result == TB_LOSS)
+    std::cout << "Loss, mated in " << dtm / 2 << " (" << dtm << " plies)";
   else
-    std::cout << "Drawn." << std::endl;
+    std::cout << "Draw";
+  std::cout << std::endl;
+  return 0;
 }
 
 int playGame() {
@@ -42,12 +358,11 @@ int playGame() {
   bool drawAvailable = false;
   while (true) {
     p.printBoard();
-    std::vector<Move> moves = p.getLegalMoves();
-    p.nameMoves(moves);
 
     // Checkmate notification.
     bool check = p.inCheck();
-    if (check && moves.size() == 0) {
+    bool canMove = p.hasLegalMove();
+    if (check && !canMove) {
       if (p.getPlayer() == Color::WHITE) {
         std::cout << "White has been checkmated." << std::endl;
         return -1;
@@ -59,7 +374,7 @@ int playGame() {
     }
 
     // Stalemate notification.
-    if (moves.size() == 0) {
+    if (!canMove) {
       if (p.getPlayer() == Color::WHITE)
         std::cout << "White is in stalemate." << std::endl;
       else
@@ -81,6 +396,10 @@ int playGame() {
     if (check)
       std::cout << "You are in check." << std::endl;
 
+    // Moves are only generated and named once the game is known to go on
+    std::vector<Move> moves = p.getLegalMoves();
+    p.nameMoves(moves);
+
     // Get command
     std::cout << "Enter a command: " << std::endl;
     std::string response;
@@ -149,42 +468,3 @@ void printHelp() {
   std::cout << "[H]elp - shows this menu." << std::endl;
   std::cout << "[E]xit - exits this program." << std::endl;
 }
-
-void testMoveGenAccuracy(std::string filename) {
-  // Open file
-  std::ifstream file(filename);
-  if (!file.is_open()) {
-    std::cout << "Unable to open file " << filename << std::endl;
-    return;
-  }
-
-  std::string line;
-  int lineNum = 0;
-  while (getline(file, line)) {
-    // Ignore empty lines and comments
-    lineNum++;
-    if (line.size() == 0 || line[0] == '#')
-      continue;
-
-    // Locate comma
-    size_t comma = line.find(",");
-    if (comma == std::string::npos) {
-      std::cout << "Line formatting error: " << lineNum << std::endl;
-      return;
-    }
-
-    // Create position from FEN
-    Position p(line.substr(0, comma));
-
-    // Count number of moves in position
-    std::vector<Move> moves = p.getLegalMoves();
-    int numMoves = moves.size();
-    int expected = std::stoi(line.substr(comma + 1));
-    if (numMoves != expected) {
-      printf("Line %d: expected %d, got %d\n", lineNum, expected, numMoves);
-      for (unsigned int i = 0; i < moves.size(); i++)
-        moves[i].debugPrint();
-      p.printBoard();
-    }
-  }
-}
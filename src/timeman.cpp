@@ -0,0 +1,73 @@
+#include "timeman.h"
+
+#include <algorithm>
+
+// Time kept in reserve for communication and scheduling delays
+static const int MOVE_OVERHEAD_MS = 20;
+
+// Moves assumed to remain when there is no time control to reach
+static const int DEFAULT_MOVES_TO_GO = 30;
+
+// Sets the limits for a move. clockMs is the time left on the player's clock,
+// or 0 for no clock, and moveTimeMs a fixed time per move, or 0.
+void TimeManager::start(int clockMs, int incrementMs, int movesToGo,
+    int moveTimeMs) {
+  softMs = hardMs = 0;
+  fixed = false;
+  if (moveTimeMs > 0) {
+    softMs = hardMs = moveTimeMs;
+    fixed = true;
+    return;
+  }
+  if (clockMs <= 0)
+    return;
+
+  int available = std::max(1, clockMs - MOVE_OVERHEAD_MS);
+  int moves = (movesToGo > 0) ? std::min(movesToGo, DEFAULT_MOVES_TO_GO)
+    : DEFAULT_MOVES_TO_GO;
+  softMs = available / moves + incrementMs * 3 / 4;
+
+  // With the last move before the control, nearly all of it may be used
+  int most = (moves == 1) ? available * 9 / 10 : available * 3 / 4;
+  hardMs = std::max(1, std::min(softMs * 4, most));
+  softMs = std::max(1, std::min(softMs, hardMs));
+}
+
+// Returns true if there is any time limit.
+bool TimeManager::isActive() {
+  return hardMs > 0;
+}
+
+int TimeManager::getSoftMs() {
+  return softMs;
+}
+
+int TimeManager::getHardMs() {
+  return hardMs;
+}
+
+// Returns true if no new iteration should be started, elapsedMs after the
+// search started. stableIterations counts the iterations in a row, ending
+// with the last, which found the same best move; failedLow is true if the
+// last iteration scored worse than it was expected to. onlyMove is true if
+// there is just one legal move.
+bool TimeManager::stopAfterIteration(double elapsedMs, int stableIterations,
+    bool failedLow, bool onlyMove) {
+  if (!isActive())
+    return false;
+  if (onlyMove)
+    return true;
+  if (fixed)
+    return elapsedMs >= hardMs;
+
+  double scale = 1.0;
+  if (stableIterations == 0)
+    scale = 1.4;
+  else if (stableIterations >= 6)
+    scale = 0.5;
+  else if (stableIterations >= 3)
+    scale = 0.75;
+  if (failedLow)
+    scale *= 1.5;
+  return elapsedMs >= std::min(softMs * scale, (double)hardMs);
+}
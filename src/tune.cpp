@@ -0,0 +1,255 @@
+#include "tune.h"
+#include "arena.h"
+#include "datagen.h"
+#include "eval.h"
+#include "position.h"
+#include "types.h"
+#include "move.h"
+
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <functional>
+#include <iomanip>
+#include <iostream>
+#include <thread>
+#include <vector>
+
+// Deepest capture sequence followed when resolving positions
+static const int MAX_QUIESCENCE_PLY = 16;
+
+// Runs fn(begin, end) over n items split evenly among the threads.
+static void parallelFor(int threads, size_t n,
+    std::function<void(int, size_t, size_t)> fn) {
+  std::vector<std::thread> workers;
+  for (int t = 0; t < threads; t++) {
+    size_t begin = n * t / threads, end = n * (t + 1) / threads;
+    workers.push_back(std::thread(fn, t, begin, end));
+  }
+  for (unsigned int t = 0; t < workers.size(); t++)
+    workers[t].join();
+}
+
+// Score of a capture search from the point of view of the player to move.
+// leaf is set to the position at the end of the principal line.
+static int quiescenceLeaf(Position& p, int alpha, int beta, Position& leaf,
+    int ply) {
+  leaf = p;
+  int best = evaluate(p);
+  if (best >= beta || ply >= MAX_QUIESCENCE_PLY)
+    return best;
+  alpha = std::max(alpha, best);
+
+  Arena& arena = Arena::forThread();
+  ArenaScope scope(arena);
+  MoveList moves{ArenaAllocator<Move>(arena)};
+  p.getLegalMoves(moves);
+  for (unsigned int i = 0; i < moves.size(); i++) {
+    if (!moves[i].isCapture() && moves[i].getPromotedPiece() == NO_PIECE)
+      continue;
+    Position child = p.afterMove(moves[i]);
+    Position childLeaf;
+    int score = -quiescenceLeaf(child, -beta, -alpha, childLeaf, ply + 1);
+    if (score > best) {
+      best = score;
+      leaf = childLeaf;
+      alpha = std::max(alpha, score);
+    }
+    if (alpha >= beta)
+      break;
+  }
+  return best;
+}
+
+// Evaluation of the packed position from white's point of view
+static double evaluatePacked(PackedPosition& pp, std::vector<double>& params) {
+  U64 bbs[12];
+  pp.getBitboards(bbs);
+  double score = 0;
+  forEachEvalTerm(bbs, [&](int i, int weight) {
+    score += params[i] * weight;
+  });
+  return score / EVAL_SCALE;
+}
+
+static double sigmoid(double k, double score) {
+  return 1 / (1 + std::exp(-k * score * std::log(10.0) / 400));
+}
+
+// Mean squared error of the predicted results
+static double meanError(std::vector<PackedPosition>& positions,
+    std::vector<double>& params, double k, int threads) {
+  std::vector<double> sums(threads, 0);
+  parallelFor(threads, positions.size(), [&](int t, size_t begin, size_t end) {
+    double sum = 0;
+    for (size_t i = begin; i < end; i++) {
+      double d = positions[i].result / 2.0
+        - sigmoid(k, evaluatePacked(positions[i], params));
+      sum += d * d;
+    }
+    sums[t] = sum;
+  });
+  double total = 0;
+  for (int t = 0; t < threads; t++)
+    total += sums[t];
+  return total / positions.size();
+}
+
+// Finds the K which minimizes the error by golden section search.
+static double fitK(std::vector<PackedPosition>& positions,
+    std::vector<double>& params, int threads) {
+  const double ratio = (std::sqrt(5.0) - 1) / 2;
+  double lo = 0.1, hi = 5;
+  double a = hi - ratio * (hi - lo), b = lo + ratio * (hi - lo);
+  double ea = meanError(positions, params, a, threads);
+  double eb = meanError(positions, params, b, threads);
+  while (hi - lo > 0.001) {
+    if (ea < eb) {
+      hi = b;
+      b = a;
+      eb = ea;
+      a = hi - ratio * (hi - lo);
+      ea = meanError(positions, params, a, threads);
+    }
+    else {
+      lo = a;
+      a = b;
+      ea = eb;
+      b = lo + ratio * (hi - lo);
+      eb = meanError(positions, params, b, threads);
+    }
+  }
+  return (lo + hi) / 2;
+}
+
+// Adds the gradient of the error over the positions to grad, and returns the
+// sum of squared errors.
+static double addGradient(std::vector<PackedPosition>& positions,
+    size_t begin, size_t end, std::vector<double>& params, double k,
+    std::vector<double>& grad) {
+  double sum = 0;
+  double c = k * std::log(10.0) / 400 / EVAL_SCALE;
+  for (size_t i = begin; i < end; i++) {
+    U64 bbs[12];
+    positions[i].getBitboards(bbs);
+    double score = 0;
+    forEachEvalTerm(bbs, [&](int j, int weight) {
+      score += params[j] * weight;
+    });
+    double s = sigmoid(k, score / EVAL_SCALE);
+    double d = positions[i].result / 2.0 - s;
+    sum += d * d;
+
+    // d(error)/d(param) = -2 d s (1 - s) c weight
+    double g = -2 * d * s * (1 - s) * c;
+    forEachEvalTerm(bbs, [&](int j, int weight) {
+      grad[j] += g * weight;
+    });
+  }
+  return sum;
+}
+
+int runTuner(TuneOptions& opt) {
+  std::vector<PackedPosition> positions;
+  for (unsigned int i = 0; i < opt.dataFiles.size(); i++) {
+    if (!loadPackedPositions(opt.dataFiles[i], positions)) {
+      std::cout << "Cannot read " << opt.dataFiles[i] << std::endl;
+      return 1;
+    }
+  }
+  if (positions.empty()) {
+    std::cout << "No positions to tune with" << std::endl;
+    return 1;
+  }
+
+  EvalParams start = defaultEvalParams();
+  if (!opt.paramsFile.empty() && !loadEvalParams(opt.paramsFile, start)) {
+    std::cout << "Cannot read " << opt.paramsFile << std::endl;
+    return 1;
+  }
+  evalParams = start;
+  int threads = std::max(1, opt.threads);
+  std::cout << "Tuning " << NUM_EVAL_PARAMS << " parameters with "
+    << positions.size() << " positions ("
+    << positions.size() * sizeof(PackedPosition) / (1 << 20) << " MB) on "
+    << threads << " threads" << std::endl;
+
+  // Replace each position by the quiet position at the end of its capture
+  // sequence, keeping its label
+  if (opt.quiescence) {
+    parallelFor(threads, positions.size(), [&](int, size_t begin, size_t end) {
+      for (size_t i = begin; i < end; i++) {
+        Position p, leaf;
+        positions[i].unpack(p);
+        quiescenceLeaf(p, -1000000, 1000000, leaf, 0);
+        PackedPosition pp = PackedPosition::pack(leaf, 0, 0, positions[i].ply);
+        pp.score = positions[i].score;
+        pp.result = positions[i].result;
+        positions[i] = pp;
+      }
+    });
+  }
+
+  std::vector<double> params(start.begin(), start.end());
+  double k = opt.k;
+  if (k <= 0) {
+    k = fitK(positions, params, threads);
+    std::cout << "Fitted K = " << k << std::endl;
+  }
+  std::cout << std::fixed << std::setprecision(6) << "Starting error "
+    << meanError(positions, params, k, threads) << std::endl;
+
+  // Adam
+  const double beta1 = 0.9, beta2 = 0.999, epsilon = 1e-8;
+  std::vector<double> m(NUM_EVAL_PARAMS, 0), v(NUM_EVAL_PARAMS, 0);
+  std::vector<std::vector<double>> grads(threads,
+      std::vector<double>(NUM_EVAL_PARAMS));
+  std::vector<double> errors(threads);
+  EvalParams result;
+  for (int epoch = 1; epoch <= opt.epochs; epoch++) {
+    auto begin = std::chrono::steady_clock::now();
+    parallelFor(threads, positions.size(), [&](int t, size_t from, size_t to) {
+      std::fill(grads[t].begin(), grads[t].end(), 0);
+      errors[t] = addGradient(positions, from, to, params, k, grads[t]);
+    });
+
+    double error = 0;
+    for (int t = 0; t < threads; t++)
+      error += errors[t];
+    error /= positions.size();
+    for (int i = 0; i < NUM_EVAL_PARAMS; i++) {
+      double g = 0;
+      for (int t = 0; t < threads; t++)
+        g += grads[t][i];
+      g /= positions.size();
+      m[i] = beta1 * m[i] + (1 - beta1) * g;
+      v[i] = beta2 * v[i] + (1 - beta2) * g * g;
+      double mHat = m[i] / (1 - std::pow(beta1, epoch));
+      double vHat = v[i] / (1 - std::pow(beta2, epoch));
+      params[i] -= opt.learningRate * mHat / (std::sqrt(vHat) + epsilon);
+    }
+    std::chrono::duration<double> seconds =
+      std::chrono::steady_clock::now() - begin;
+    std::cout << std::setprecision(6) << "Epoch " << std::setw(4) << epoch
+      << "  error " << error << std::setprecision(2) << "  "
+      << seconds.count() << "s" << std::endl;
+
+    // Save as we go, so that a long run can be stopped at any time
+    if (epoch % 10 == 0 || epoch == opt.epochs) {
+      for (int i = 0; i < NUM_EVAL_PARAMS; i++)
+        result[i] = (int)std::lround(params[i]);
+      if (!saveEvalParams(opt.outputFile, result)) {
+        std::cout << "Cannot write " << opt.outputFile << std::endl;
+        return 1;
+      }
+    }
+  }
+
+  if (opt.epochs > 0) {
+    std::cout << std::setprecision(6) << "Final error "
+      << meanError(positions, params, k, threads) << ", parameters written to "
+      << opt.outputFile << std::endl;
+    printEvalParams(result);
+  }
+  return 0;
+}
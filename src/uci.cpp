@@ -0,0 +1,258 @@
+#include "uci.h"
+#include "position.h"
+#include "search.h"
+#include "types.h"
+#include "move.h"
+
+#include <algorithm>
+#include <atomic>
+#include <cctype>
+#include <cstdlib>
+#include <chrono>
+#include <memory>
+#include <mutex>
+#include <sstream>
+#include <string>
+#include <thread>
+#include <vector>
+
+static const std::string START_FEN =
+  "rnbqkbnr/pppppppp/8/8/8/8/PPPPPPPP/RNBQKBNR w KQkq - 0 1";
+
+// State of the engine between commands
+struct UCIEngine {
+  std::ostream& out;
+  std::mutex outMutex;
+  SearchOptions options;
+  std::unique_ptr<Search> search;
+  bool optionsChanged = false;
+  int multiPV = 1;
+  Position position;
+  std::vector<U64> keys;  // of the positions before the current one
+  std::thread worker;
+  std::atomic<bool> stopRequested{false};
+  std::atomic<bool> workerDone{true};
+
+  UCIEngine(std::ostream& o) : out(o) {}
+
+  void send(std::string line) {
+    std::lock_guard<std::mutex> lock(outMutex);
+    out << line << std::endl;
+  }
+};
+
+// The score as UCI gives it: centipawns, or moves to mate
+static std::string scoreString(int score) {
+  if (!Search::isMateScore(score))
+    return "cp " + std::to_string(score);
+  int plies = MATE_SCORE - std::abs(score);
+  int moves = (plies + 1) / 2;
+  return "mate " + std::to_string(score > 0 ? moves : -moves);
+}
+
+// Reply to the uci command, listing the options
+static void identify(UCIEngine& e) {
+  e.send("id name TChess");
+  e.send("id author TChess developers");
+  e.send("option name Hash type spin default 16 min 1 max 65536");
+  e.send("option name Ponder type check default false");
+  e.send("option name MultiPV type spin default 1 min 1 max 256");
+  e.send("option name NNUE type string default <empty>");
+  const char* checks[] = {"Quiescence", "Tablebases", "PVS", "Aspiration",
+    "NullMove", "LMR", "Futility", "CheckExt"};
+  for (const char* name : checks)
+    e.send(std::string("option name ") + name + " type check default true");
+  e.send("uciok");
+}
+
+// Waits for the search thread, if any, to finish.
+static void finishSearch(UCIEngine& e) {
+  if (e.worker.joinable()) {
+    e.stopRequested = true;
+    if (e.search)
+      e.search->stop();
+    e.worker.join();
+  }
+}
+
+// Creates the search, or creates it again if the options have changed.
+static void prepareSearch(UCIEngine& e) {
+  if (!e.search || e.optionsChanged) {
+    e.search.reset(new Search(e.options));
+    e.optionsChanged = false;
+  }
+}
+
+// setoption name <name> value <value>. Names are matched without regard to
+// case, and the engine options take the lower case name.
+static void setOption(UCIEngine& e, std::istringstream& in) {
+  std::string token, name, value;
+  in >> token;  // name
+  while (in >> token && token != "value")
+    name += (name.empty() ? "" : " ") + token;
+  std::getline(in >> std::ws, value);
+  std::transform(name.begin(), name.end(), name.begin(), ::tolower);
+  if (name == "ponder")
+    return;
+  if (value == "<empty>")
+    value.clear();
+  if (name == "multipv") {
+    e.multiPV = std::max(1, std::min(256, std::atoi(value.c_str())));
+    return;
+  }
+  if (e.options.set(name, value))
+    e.optionsChanged = true;
+  else
+    e.send("info string unknown option or value: " + name + " " + value);
+}
+
+// position (startpos | fen <fen>) [moves <move>...]
+static void setPosition(UCIEngine& e, std::istringstream& in) {
+  std::string token, fen;
+  in >> token;
+  if (token == "startpos") {
+    fen = START_FEN;
+    in >> token;
+  }
+  else if (token == "fen") {
+    while (in >> token && token != "moves")
+      fen += token + " ";
+  }
+  else
+    return;
+  e.position.loadFEN(fen);
+  e.keys.clear();
+  if (token != "moves")
+    return;
+
+  while (in >> token) {
+    std::vector<Move> moves = e.position.getLegalMoves();
+    int m = -1;
+    for (unsigned int i = 0; i < moves.size() && m == -1; i++)
+      if (moves[i].getCoordinates() == token)
+        m = i;
+    if (m == -1) {
+      e.send("info string illegal move " + token);
+      return;
+    }
+    e.keys.push_back(e.position.getKey());
+    e.position.makeMove(moves[m]);
+  }
+}
+
+// go [wtime ms] [btime ms] [winc ms] [binc ms] [movestogo n] [depth n]
+// [nodes n] [movetime ms] [infinite] [ponder]
+static void go(UCIEngine& e, std::istringstream& in) {
+  finishSearch(e);
+  prepareSearch(e);
+
+  SearchLimits limits;
+  limits.multiPV = e.multiPV;
+  bool white = e.position.getPlayer() == Color::WHITE;
+  bool infinite = false;
+  std::string token;
+  while (in >> token) {
+    if (token == "wtime" || token == "btime") {
+      int ms = 0;
+      in >> ms;
+      if ((token == "wtime") == white)
+        limits.clockMs = std::max(1, ms);
+    }
+    else if (token == "winc" || token == "binc") {
+      int ms = 0;
+      in >> ms;
+      if ((token == "winc") == white)
+        limits.incrementMs = std::max(0, ms);
+    }
+    else if (token == "movestogo")
+      in >> limits.movesToGo;
+    else if (token == "depth") {
+      in >> limits.depth;
+      limits.depth = std::min(MAX_PLY - 1, std::max(1, limits.depth));
+    }
+    else if (token == "nodes")
+      in >> limits.nodes;
+    else if (token == "movetime")
+      in >> limits.timeMs;
+    else if (token == "infinite")
+      infinite = true;
+    else if (token == "ponder")
+      limits.ponder = true;
+  }
+
+  e.search->setInfoCallback([&e](SearchResult& r) {
+    SearchLine& l = r.lines[r.line];
+    std::ostringstream line;
+    line << "info depth " << r.depth << " multipv " << (r.line + 1)
+      << " score " << scoreString(l.score) << " nodes " << r.nodes << " nps "
+      << (U64)(r.nodes / std::max(r.seconds, 0.001)) << " time "
+      << (U64)(r.seconds * 1000) << " pv";
+    for (unsigned int i = 0; i < l.pv.size(); i++)
+      line << " " << l.pv[i].getCoordinates();
+    e.send(line.str());
+  });
+
+  e.stopRequested = false;
+  e.workerDone = false;
+  Position root = e.position;
+  std::vector<U64> keys = e.keys;
+  e.worker = std::thread([&e, root, keys, limits, infinite]() mutable {
+    SearchResult r = e.search->think(root, limits, keys);
+    e.workerDone = true;
+
+    // The GUI expects no answer to go infinite before it says stop
+    while (infinite && !e.stopRequested)
+      std::this_thread::sleep_for(std::chrono::milliseconds(1));
+    if (!root.hasLegalMove()) {
+      e.send("bestmove 0000");
+      return;
+    }
+    std::string line = "bestmove " + r.best.getCoordinates();
+    if (r.pv.size() >= 2)
+      line += " ponder " + r.pv[1].getCoordinates();
+    e.send(line);
+  });
+
+  // Wait until the search is ready for stop and ponderhit
+  while (!e.search->isThinking() && !e.workerDone)
+    std::this_thread::yield();
+}
+
+int runUCI(std::istream& in, std::ostream& out) {
+  UCIEngine e(out);
+  e.position.loadFEN(START_FEN);
+  std::string line;
+  while (std::getline(in, line)) {
+    std::istringstream words(line);
+    std::string command;
+    words >> command;
+    if (command == "uci")
+      identify(e);
+    else if (command == "isready") {
+      if (!e.worker.joinable())
+        prepareSearch(e);
+      e.send("readyok");
+    }
+    else if (command == "ucinewgame") {
+      finishSearch(e);
+      prepareSearch(e);
+      e.search->newGame();
+    }
+    else if (command == "setoption")
+      setOption(e, words);
+    else if (command == "position")
+      setPosition(e, words);
+    else if (command == "go")
+      go(e, words);
+    else if (command == "stop")
+      finishSearch(e);
+    else if (command == "ponderhit") {
+      if (e.search)
+        e.search->ponderHit();
+    }
+    else if (command == "quit")
+      break;
+  }
+  finishSearch(e);
+  return 0;
+}